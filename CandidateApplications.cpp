@@ -1,6 +1,12 @@
 #include "CandidateApplications.h"
+#include "Decompressor.h"
 #include "FlashUpdater.h"
+#include "ImageHasher.h"
+#include "StaticSlotLayout.h"
 #include "UCErrorCodes.h"
+#if defined(MBED_CONF_UPDATE_CLIENT_SECTOR_MAP)
+#include <utility>
+#endif
 
 #if MBED_CONF_MBED_TRACE_ENABLE
 #include "mbed_trace.h"
@@ -11,13 +17,42 @@
 
 namespace update_client {
 
-CandidateApplications::CandidateApplications(FlashUpdater& flashUpdater, uint32_t storageAddress, uint32_t storageSize, uint32_t headerSize, uint32_t nbrOfSlots) :
+#if defined(MBED_CONF_UPDATE_CLIENT_SECTOR_MAP)
+namespace {
+
+// slot table of the configured storage, computed and checked at build time
+typedef StaticSlotLayout<MBED_CONF_UPDATE_CLIENT_SECTOR_MAP,
+                         MBED_CONF_UPDATE_CLIENT_STORAGE_ADDRESS,
+                         MBED_CONF_UPDATE_CLIENT_STORAGE_SIZE,
+                         MBED_CONF_UPDATE_CLIENT_STORAGE_LOCATIONS> SlotLayout;
+
+// the usable size depends on the header size and is set at runtime
+template <std::size_t... SlotIndexes>
+const SlotGeometry* getStaticSlotTable(std::index_sequence<SlotIndexes...>) {
+  static constexpr SlotGeometry slotTable[] = {
+    { SlotLayout::getSlotStart(SlotIndexes), SlotLayout::getSlotEnd(SlotIndexes), SlotLayout::getSlotSize(SlotIndexes),
+      0, SlotLayout::getNbrOfSectors(SlotIndexes), true }...
+  };
+  return slotTable;
+}
+
+} // namespace
+#endif
+
+CandidateApplications::CandidateApplications(FlashUpdater& flashUpdater, uint32_t storageAddress, uint32_t storageSize, uint32_t headerSize, uint32_t nbrOfSlots,
+                                             uint32_t verificationRecordAddress) :
   m_flashUpdater(flashUpdater),
   m_storageAddress(storageAddress),
   m_storageSize(storageSize),
-  m_nbrOfSlots(nbrOfSlots) {
+  m_nbrOfSlots(nbrOfSlots),
+  m_headerSize(headerSize),
+  m_verificationRecord(flashUpdater, verificationRecordAddress),
+  m_installBufferSize(MBED_CONF_UPDATE_CLIENT_INSTALL_BUFFER_SIZE) {
+  memset((void*) m_slotGeometryArray, 0, sizeof(m_slotGeometryArray));
+  memset((void*) m_candidateApplicationArray, 0, sizeof(m_candidateApplicationArray));
   // the number of slots must be equal or smaller than MBED_CONF_UPDATE_CLIENT_STORAGE_LOCATIONS
   if (nbrOfSlots <= MBED_CONF_UPDATE_CLIENT_STORAGE_LOCATIONS) {  
+    computeSlotGeometry();
     for (uint32_t slotIndex = 0; slotIndex < nbrOfSlots; slotIndex++) {
       uint32_t applicationAddress = 0;
       uint32_t slotSize = 0;
@@ -27,9 +62,8 @@ CandidateApplications::CandidateApplications(FlashUpdater& flashUpdater, uint32_
         continue;
       } 
 
-      tr_debug(" Slot %d: application header address: 0x%08x application address 0x%08x (slot size %d)", 
-               slotIndex, applicationAddress, applicationAddress + headerSize, slotSize);
       m_candidateApplicationArray[slotIndex] = new update_client::MbedApplication(m_flashUpdater, applicationAddress, applicationAddress + headerSize);
+      m_candidateApplicationArray[slotIndex]->setVerificationRecord(&m_verificationRecord);
     }
   }
 }
@@ -46,107 +80,239 @@ MbedApplication& CandidateApplications::getMbedApplication(uint32_t slotIndex) {
 }
 
 
-uint32_t CandidateApplications::getSlotForCandidate() { 
-  // TODO
-  uint32_t oldValidSlot = 0;
+VerificationRecord& CandidateApplications::getVerificationRecord() {
+  return m_verificationRecord;
+}
+
+void CandidateApplications::setInstallBufferSize(uint32_t installBufferSize) {
+  m_installBufferSize = installBufferSize;
+}
+
+uint32_t CandidateApplications::getInstallBufferSize() const {
+  return m_installBufferSize;
+}
 
-  for(uint32_t slotI = 0; slotI < m_nbrOfSlots; slotI++)
-  {
-      if (m_candidateApplicationArray[slotI]->isValid())
-      {
-        if(m_candidateApplicationArray[slotI]->isNewerThan(*m_candidateApplicationArray[oldValidSlot]))
-        {
-            oldValidSlot = slotI;
-        }
-      }
-      else 
-      {
-        return slotI;
-      }
+uint32_t CandidateApplications::getNbrOfSlots() const {
+  return m_nbrOfSlots;
+}
+
+uint32_t CandidateApplications::getSlotForCandidate() {
+  uint32_t oldValidSlot = m_nbrOfSlots;
+
+  // an empty slot is used first, otherwise the oldest application is replaced
+  // (the newest one may be running from its slot in direct boot mode). Only
+  // the headers are read, the images are not hashed for choosing the slot.
+  // m_nbrOfSlots is returned if no slot is usable
+  for (uint32_t slotIndex = 0; slotIndex < m_nbrOfSlots; slotIndex++) {
+    if (m_candidateApplicationArray[slotIndex] == NULL) {
+      continue;
+    }
+    if (! m_candidateApplicationArray[slotIndex]->hasValidHeader()) {
+      return slotIndex;
+    }
+    if (oldValidSlot == m_nbrOfSlots ||
+        m_candidateApplicationArray[oldValidSlot]->isNewerThan(*m_candidateApplicationArray[slotIndex])) {
+      oldValidSlot = slotIndex;
+    }
   }
   return oldValidSlot;
 }
 
 int32_t CandidateApplications::getApplicationAddress(uint32_t slotIndex, uint32_t& applicationAddress, uint32_t& slotSize) const {
-   tr_debug(" Slot %d: Storage address: 0x%08x Storage size: %d", slotIndex, m_storageAddress, m_storageSize);
-
-   // find the start address of the whole storage area. It needs to be aligned to
-   // sector boundary and we cannot go outside user defined storage area, hence
-   // rounding up to sector boundary
-   uint32_t storageStartAddr = m_flashUpdater.alignAddressToSector(m_storageAddress, false);
-   tr_debug(" Storage start address for all slots: 0x%08x", storageStartAddr);
-
-   // find the end address of the whole storage area. It needs to be aligned to
-   // sector boundary and we cannot go outside user defined storage area, hence
-   // rounding down to sector boundary 
-   uint32_t storageEndAddr = m_flashUpdater.alignAddressToSector(m_storageAddress + m_storageSize, true);
-   tr_debug(" Storage end addressfor all slots: 0x%08x", storageEndAddr);
-   
-   // find the maximum size each slot can have given the start and end, without
-   // considering the alignment of individual slots
-   uint32_t maxSlotSize = (storageEndAddr - storageStartAddr) / m_nbrOfSlots;
-   tr_debug(" maxSlotSize : %d", maxSlotSize);
-
-   // find the start address of slot. It needs to align to sector boundary. We
-   // choose here to round down at each slot boundary 
-   uint32_t slotStartAddr = m_flashUpdater.alignAddressToSector(storageStartAddr + slotIndex * maxSlotSize, true);
-   tr_debug(" Slot start address (slot %d): 0x%08x", slotIndex, slotStartAddr);
-   
-   // find the end address of the slot, rounding down to sector boundary same as
-   // the slot start address so that we make sure two slot don't overlap 
-   uint32_t slotEndAddr = m_flashUpdater.alignAddressToSector(slotStartAddr + maxSlotSize, true);
-   tr_debug(" Slot end address (slot %d): 0x%08x", slotIndex, slotEndAddr);
-   
-   applicationAddress = slotStartAddr;
-   slotSize = slotEndAddr - slotStartAddr;
-   
-   return UC_ERR_NONE;
-}
-
-bool CandidateApplications::hasValidNewerApplication(MbedApplication& activeApplication, uint32_t& newestSlotIndex) const {
+  if (slotIndex >= m_nbrOfSlots || ! m_slotGeometryArray[slotIndex].valid) {
+    return UC_ERR_INVALID_SLOT;
+  }
+
+  applicationAddress = m_slotGeometryArray[slotIndex].startAddress;
+  slotSize = m_slotGeometryArray[slotIndex].size;
+
+  return UC_ERR_NONE;
+}
+
+const SlotGeometry& CandidateApplications::getSlotGeometry(uint32_t slotIndex) const {
+  return m_slotGeometryArray[slotIndex];
+}
+
+void CandidateApplications::computeSlotGeometry() {
+  tr_debug(" Storage address: 0x%08x Storage size: %d", m_storageAddress, m_storageSize);
+  if (m_nbrOfSlots == 0) {
+    return;
+  }
+
+#if defined(MBED_CONF_UPDATE_CLIENT_SECTOR_MAP)
+  // the configured storage uses the table computed at build time
+  if (m_storageAddress == MBED_CONF_UPDATE_CLIENT_STORAGE_ADDRESS &&
+      m_storageSize == MBED_CONF_UPDATE_CLIENT_STORAGE_SIZE &&
+      m_nbrOfSlots == MBED_CONF_UPDATE_CLIENT_STORAGE_LOCATIONS) {
+    const SlotGeometry* pSlotTable = getStaticSlotTable(std::make_index_sequence<MBED_CONF_UPDATE_CLIENT_STORAGE_LOCATIONS>());
+    for (uint32_t slotIndex = 0; slotIndex < m_nbrOfSlots; slotIndex++) {
+      m_slotGeometryArray[slotIndex] = pSlotTable[slotIndex];
+      m_slotGeometryArray[slotIndex].usableSize = (pSlotTable[slotIndex].size > m_headerSize) ? pSlotTable[slotIndex].size - m_headerSize : 0;
+      m_slotGeometryArray[slotIndex].valid = m_slotGeometryArray[slotIndex].usableSize > 0;
+    }
+    return;
+  }
+#endif
+
+  // find the start address of the whole storage area. It needs to be aligned to
+  // sector boundary and we cannot go outside user defined storage area, hence
+  // rounding up to sector boundary
+  const uint32_t storageStartAddr = m_flashUpdater.alignAddressToSector(m_storageAddress, false);
+
+  // find the end address of the whole storage area. It needs to be aligned to
+  // sector boundary and we cannot go outside user defined storage area, hence
+  // rounding down to sector boundary
+  const uint32_t storageEndAddr = m_flashUpdater.alignAddressToSector(m_storageAddress + m_storageSize, true);
+  tr_debug(" Storage area for all slots: 0x%08x - 0x%08x", storageStartAddr, storageEndAddr);
+  if (storageEndAddr <= storageStartAddr) {
+    tr_error("Storage area does not contain any sector");
+    return;
+  }
+
+  // find the maximum size each slot can have given the start and end, without
+  // considering the alignment of individual slots
+  const uint32_t maxSlotSize = (storageEndAddr - storageStartAddr) / m_nbrOfSlots;
+
+  uint32_t previousEndAddr = storageStartAddr;
+  for (uint32_t slotIndex = 0; slotIndex < m_nbrOfSlots; slotIndex++) {
+    SlotGeometry& slotGeometry = m_slotGeometryArray[slotIndex];
+
+    // the start address of the slot needs to align to a sector boundary. We
+    // choose here to round down at each slot boundary, and the end address of
+    // the slot is rounded down the same way so that two slots don't overlap
+    slotGeometry.startAddress = m_flashUpdater.alignAddressToSector(storageStartAddr + slotIndex * maxSlotSize, true);
+    slotGeometry.endAddress = m_flashUpdater.alignAddressToSector(slotGeometry.startAddress + maxSlotSize, true);
+    slotGeometry.size = slotGeometry.endAddress - slotGeometry.startAddress;
+    slotGeometry.usableSize = (slotGeometry.size > m_headerSize) ? slotGeometry.size - m_headerSize : 0;
+    slotGeometry.nbrOfSectors = 0;
+    for (uint32_t address = slotGeometry.startAddress; address < slotGeometry.endAddress; ) {
+      const uint32_t sectorSize = m_flashUpdater.getSectorSize(address);
+      if (sectorSize == 0) {
+        break;
+      }
+      address += sectorSize;
+      slotGeometry.nbrOfSectors++;
+    }
+
+    // the slot must span at least one sector, have room for an application after
+    // the header and must not overlap with the previous slot
+    slotGeometry.valid = slotGeometry.startAddress >= previousEndAddr &&
+                         slotGeometry.endAddress <= storageEndAddr &&
+                         slotGeometry.nbrOfSectors > 0 &&
+                         slotGeometry.usableSize > 0;
+    if (slotGeometry.valid) {
+      previousEndAddr = slotGeometry.endAddress;
+      tr_debug(" Slot %d: 0x%08x - 0x%08x (size %d, %d sectors)", slotIndex,
+               slotGeometry.startAddress, slotGeometry.endAddress, slotGeometry.size, slotGeometry.nbrOfSectors);
+    }
+    else {
+      tr_error(" Slot %d (0x%08x - 0x%08x) is too small or overlaps another slot", slotIndex,
+               slotGeometry.startAddress, slotGeometry.endAddress);
+    }
+  }
+}
+
+uint32_t CandidateApplications::sortNewerSlots(MbedApplication& activeApplication, uint32_t* pSlotIndexes) const {
+  // only the headers are read here. The slots are inserted by descending version,
+  // slots with the same version keep their order
+  uint32_t nbrOfNewerSlots = 0;
+  for (uint32_t slotIndex = 0; slotIndex < m_nbrOfSlots; slotIndex++) {
+    if (m_candidateApplicationArray[slotIndex] == NULL) {
+      continue;
+    }
+    MbedApplication& candidateApplication = *m_candidateApplicationArray[slotIndex];
+    if (! candidateApplication.hasValidHeader() || ! candidateApplication.isNewerThan(activeApplication)) {
+      tr_debug(" Application on slot %d is not newer than the active application", slotIndex);
+      continue;
+    }
+    uint32_t position = nbrOfNewerSlots;
+    while (position > 0 && candidateApplication.isNewerThan(*m_candidateApplicationArray[pSlotIndexes[position - 1]])) {
+      pSlotIndexes[position] = pSlotIndexes[position - 1];
+      position--;
+    }
+    pSlotIndexes[position] = slotIndex;
+    nbrOfNewerSlots++;
+  }
+
+  return nbrOfNewerSlots;
+}
+
+bool CandidateApplications::hasValidNewerApplication(MbedApplication& activeApplication, uint32_t& newestSlotIndex, bool bootableOnly) const {
   tr_debug(" Checking for newer applications on %d slots", m_nbrOfSlots);
   newestSlotIndex = m_nbrOfSlots;
-  for (uint32_t slotIndex = 0; slotIndex < m_nbrOfSlots; slotIndex++) {    
-    // Only hash check firmwares with higher version number than the
-    // active image and with a different hash. This prevents rollbacks
-    // and hash checks of old images. If the active image is not valid,
-    // bestStoredFirmwareImageDetails.version equals 0
-    tr_debug(" Checking application at slot %d", slotIndex);
-    MbedApplication& newestApplication = newestSlotIndex == m_nbrOfSlots ? activeApplication : *m_candidateApplicationArray[newestSlotIndex];
-    if (m_candidateApplicationArray[slotIndex]->isNewerThan(newestApplication)) {
-#if MBED_CONF_MBED_TRACE_ENABLE
-      if (newestSlotIndex == m_nbrOfSlots)
-        tr_debug(" Candidate application at slot %d is newer than the active one", slotIndex);
-      else
-        tr_debug(" Candidate application at slot %d is newer than application at slot %d", slotIndex, newestSlotIndex);
-#endif      
-      int32_t result = m_candidateApplicationArray[slotIndex]->checkApplication();
+
+  // Only hash check firmwares with higher version number than the active
+  // image. This prevents rollbacks and hash checks of old images. The newest
+  // candidate is checked first and the scan stops at the first valid one, so
+  // that usually a single image is hashed
+  uint32_t slotIndexes[MBED_CONF_UPDATE_CLIENT_STORAGE_LOCATIONS];
+  const uint32_t nbrOfNewerSlots = sortNewerSlots(activeApplication, slotIndexes);
+  for (uint32_t position = 0; position < nbrOfNewerSlots; position++) {
+    const uint32_t slotIndex = slotIndexes[position];
+    tr_debug(" Checking application at slot %d (version %llu)", slotIndex,
+             m_candidateApplicationArray[slotIndex]->getFirmwareVersion());
+    int32_t result = m_candidateApplicationArray[slotIndex]->checkApplication();
+    if (result != UC_ERR_NONE) {
+      tr_error(" Candidate application at slot %d is not valid: %d", slotIndex, result);
+      continue;
+    }
+    tr_debug(" Candidate application at slot %d is valid", slotIndex);
+    if (bootableOnly) {
+      result = m_candidateApplicationArray[slotIndex]->checkBootable();
       if (result != UC_ERR_NONE) {
-        tr_error(" Candidate application at slot %d is not valid: %d", slotIndex, result);
+        tr_error(" Candidate application at slot %d cannot be started in its slot: %d", slotIndex, result);
         continue;
       }
-      tr_debug(" Candidate application at slot %d is valid", slotIndex);
-
-      // update the newest slot index
-      newestSlotIndex = slotIndex;
     }
-    else {
-    tr_debug(" Application on slot %d is older than current application", slotIndex);
+
+    newestSlotIndex = slotIndex;
+    return true;
+  }
+  return false;
+}
+
+bool CandidateApplications::hasNewerApplication(MbedApplication& activeApplication, uint32_t& newestSlotIndex) const {
+  tr_debug(" Looking for newer applications on %d slots", m_nbrOfSlots);
+  uint32_t slotIndexes[MBED_CONF_UPDATE_CLIENT_STORAGE_LOCATIONS];
+  if (sortNewerSlots(activeApplication, slotIndexes) == 0) {
+    newestSlotIndex = m_nbrOfSlots;
+    return false;
+  }
+  newestSlotIndex = slotIndexes[0];
+  return true;
+}
+
+int32_t CandidateApplications::getBootAddress(MbedApplication& activeApplication, uint32_t& bootAddress) const {
+  uint32_t newestSlotIndex = m_nbrOfSlots;
+  if (hasValidNewerApplication(activeApplication, newestSlotIndex, true)) {
+    bootAddress = m_candidateApplicationArray[newestSlotIndex]->getApplicationAddress();
+    tr_debug(" Booting candidate application at slot %d (address 0x%08x)", newestSlotIndex, bootAddress);
+    return UC_ERR_NONE;
+  }
+
+  bootAddress = activeApplication.getApplicationAddress();
+  tr_debug(" Booting active application (address 0x%08x)", bootAddress);
+  return UC_ERR_NONE;
+}
+
+bool CandidateApplications::findApplication(MbedApplication& application, uint32_t& slotIndex) const {
+  // the headers are compared first, the image of a matching slot is then checked so
+  // that a corrupted copy (bit rot, bad erase) is transferred again. Slots already
+  // found not valid never match, and the check is free with a verification record
+  for (slotIndex = 0; slotIndex < m_nbrOfSlots; slotIndex++) {
+    if (m_candidateApplicationArray[slotIndex] != NULL &&
+        m_candidateApplicationArray[slotIndex]->hasSameImage(application) &&
+        m_candidateApplicationArray[slotIndex]->checkApplication() == UC_ERR_NONE) {
+      return true;
     }
   }
-  return newestSlotIndex != m_nbrOfSlots;
+  return false;
 }
 
 #ifdef POST_APPLICATION_ADDR
 int32_t CandidateApplications::installApplication(uint32_t slotIndex, uint32_t destHeaderAddress) {  
   tr_debug(" Installing candidate application at slot %d as active application", slotIndex);
-  const uint32_t pageSize = m_flashUpdater.get_page_size();
-  tr_debug("Flash page size is %d", pageSize);
 
-  std::unique_ptr<char> writePageBuffer = std::unique_ptr<char>(new char[pageSize]);
-  std::unique_ptr<char> readPageBuffer = std::unique_ptr<char>(new char[pageSize]);
-
-  uint32_t destAddr = destHeaderAddress;
   uint32_t sourceAddr = 0;
   uint32_t slotSize = 0;
   int32_t result = getApplicationAddress(slotIndex, sourceAddr, slotSize);
@@ -155,43 +321,210 @@ int32_t CandidateApplications::installApplication(uint32_t slotIndex, uint32_t d
     return result;
   }
 
-  const uint32_t destSectorSize = m_flashUpdater.get_sector_size(destAddr);      
-  uint32_t nextDestSectorAddress = destAddr + destSectorSize;
-  bool destSectorErased = false;
-  size_t destPagesFlashed = 0;  
-  
+  // nothing is erased for a candidate without a valid header
+  MbedApplication& candidateApplication = *m_candidateApplicationArray[slotIndex];
+  if (candidateApplication.getFirmwareSize() == 0) {
+    tr_error("Candidate application at slot %d is empty or has an invalid header", slotIndex);
+    return UC_ERR_FIRMWARE_EMPTY;
+  }
+
   // add the header size to the firmware size
   const uint32_t headerSize = POST_APPLICATION_ADDR - HEADER_ADDR;
   tr_debug(" Header size is %d", headerSize);  
-  const uint64_t copySize = m_candidateApplicationArray[slotIndex]->getFirmwareSize() + headerSize;
-
-  uint32_t nbrOfBytes = 0;
-  tr_debug(" Starting to copy application from address 0x%08x to address 0x%08x", sourceAddr, destAddr);
-  
-  while (nbrOfBytes < copySize) {
-    // TODO: read a page from the candidate location and write it to the active application
-    result = m_flashUpdater.readPage(pageSize, writePageBuffer.get(), sourceAddr);
-    if(result != UC_ERR_NONE){
-        tr_err("Problème read");
-        return result;
-    }
-    result = m_flashUpdater.writePage(pageSize, writePageBuffer.get(), readPageBuffer.get(), destAddr, destSectorErased, destPagesFlashed, nextDestSectorAddress);
-    if(result != UC_ERR_NONE){
-        tr_err("Problème write ");
-        return result;
-    }
-    // update progress
-    nbrOfBytes += pageSize;    
-#if MBED_CONF_MBED_TRACE_ENABLE
-    // tr_debug("Copied %05d bytes", nbrOfBytes);
-#endif
+  const uint64_t copySize = candidateApplication.getFirmwareSize() + headerSize;
+  // the header is written last from the staging buffer
+  if (headerSize > m_installBufferSize) {
+    tr_error("Install buffer of %d bytes is smaller than the header", m_installBufferSize);
+    return UC_ERR_WRITE_FAILED;
+  }
+
+  // the active application is about to change, its recorded verification does not apply anymore
+  result = m_verificationRecord.invalidate(destHeaderAddress);
+  if (result != UC_ERR_NONE) {
+    tr_error("Cannot invalidate the verification record: %d", result);
+    return result;
+  }
+
+  // the application body is programmed first, in chunks of up to a sector through a single
+  // staging buffer, and the candidate is hashed while it is copied
+  tr_debug(" Starting to copy application from address 0x%08x to address 0x%08x", sourceAddr, destHeaderAddress);
+  std::unique_ptr<uint8_t[]> stagingBuffer(new uint8_t[m_installBufferSize]);
+  ImageHasher imageHasher;
+  imageHasher.start();
+  const bool compressed = (candidateApplication.getCompression() != COMPRESSION_NONE);
+  if (compressed) {
+    result = decompressApplication(candidateApplication, destHeaderAddress + headerSize, stagingBuffer.get(), imageHasher);
+  }
+  else {
+    result = m_flashUpdater.copyRegion(sourceAddr, destHeaderAddress, copySize,
+                                       stagingBuffer.get(), m_installBufferSize, INSTALL_VERIFY_CHUNKS,
+                                       headerSize, &imageHasher);
+  }
+  uint8_t hash[ImageHasher::HASH_SIZE] = { 0 };
+  imageHasher.finish(hash);
+  if (result != UC_ERR_NONE) {
+    tr_error("Cannot copy application: %d", result);
+    return result;
+  }
+  tr_debug(" Copied %lld bytes", copySize);
+
+  // the header is only written if the candidate is valid, so that an aborted
+  // install never looks like a valid application
+  result = candidateApplication.checkApplicationHash(hash);
+  if (result != UC_ERR_NONE) {
+    tr_error("Candidate application at slot %d is not valid: %d", slotIndex, result);
+    return result;
+  }
+  if (compressed) {
+    // the installed application is described by an uncompressed header
+    result = candidateApplication.getInstalledHeader(stagingBuffer.get(), headerSize, m_flashUpdater.get_erase_value());
+  }
+  else {
+    result = m_flashUpdater.read(stagingBuffer.get(), sourceAddr, headerSize);
+  }
+  if (result == UC_ERR_NONE) {
+    result = m_flashUpdater.programRegion(destHeaderAddress, stagingBuffer.get(), headerSize);
+  }
+  stagingBuffer = NULL;
+  if (result != UC_ERR_NONE) {
+    tr_error("Cannot write the application header: %d", result);
+    return result;
+  }
+
+  // the copy is verified once, by hashing the installed application. The result is
+  // recorded so that the application is not hashed again at the next boot
+  MbedApplication installedApplication(m_flashUpdater, destHeaderAddress, POST_APPLICATION_ADDR);
+  installedApplication.setVerificationRecord(&m_verificationRecord);
+  result = installedApplication.checkApplication();
+  if (result != UC_ERR_NONE) {
+    tr_error("Installed application is not valid: %d", result);
+    return result;
   }
-  tr_debug(" Copied %d bytes", nbrOfBytes);
-  writePageBuffer = NULL;
-  readPageBuffer = NULL;
 
   return UC_ERR_NONE;
 }
 
+namespace {
+
+// writes the decompressed application to flash through the staging buffer
+// and hashes it, the application cannot exceed its firmware size
+class FlashSink :
+  public DecompressorSink {
+public:
+  FlashSink(FlashUpdater& flashUpdater, uint32_t address, uint64_t firmwareSize,
+            uint8_t* pStagingBuffer, uint32_t stagingBufferSize, ImageHasher& imageHasher) :
+    m_flashUpdater(flashUpdater),
+    m_imageHasher(imageHasher),
+    m_pStagingBuffer(pStagingBuffer),
+    m_stagingBufferSize(stagingBufferSize),
+    m_nbrOfStagedBytes(0),
+    m_address(address),
+    m_sectorErased(false),
+    m_nextSectorAddress(flashUpdater.alignAddressToSector(address, true) + flashUpdater.getSectorSize(address)),
+    m_remainingSize(firmwareSize) {
+  }
+
+  virtual int32_t write(const uint8_t* pData, uint32_t size) {
+    if (size > m_remainingSize) {
+      tr_error("Decompressed application exceeds its size");
+      return UC_ERR_DECOMPRESSION_FAILED;
+    }
+    m_remainingSize -= size;
+    m_imageHasher.update(pData, size);
+
+    while (size > 0) {
+      uint32_t copySize = m_stagingBufferSize - m_nbrOfStagedBytes;
+      if (copySize > size) {
+        copySize = size;
+      }
+      memcpy(m_pStagingBuffer + m_nbrOfStagedBytes, pData, copySize);
+      m_nbrOfStagedBytes += copySize;
+      pData += copySize;
+      size -= copySize;
+
+      if (m_nbrOfStagedBytes == m_stagingBufferSize) {
+        int32_t result = writeStagedBytes();
+        if (result != UC_ERR_NONE) {
+          return result;
+        }
+      }
+    }
+    return UC_ERR_NONE;
+  }
+
+  // writes the last bytes, padded to the flash page
+  int32_t finish() {
+    if (m_remainingSize != 0) {
+      tr_error("Decompressed application is incomplete");
+      return UC_ERR_DECOMPRESSION_FAILED;
+    }
+    const uint32_t pageSize = m_flashUpdater.get_page_size();
+    while (m_nbrOfStagedBytes % pageSize != 0) {
+      m_pStagingBuffer[m_nbrOfStagedBytes++] = m_flashUpdater.get_erase_value();
+    }
+    return writeStagedBytes();
+  }
+
+private:
+  int32_t writeStagedBytes() {
+    uint8_t compareBuffer[COMPARE_BUFFER_SIZE];
+    int32_t result = m_flashUpdater.writeRegion(m_address, m_pStagingBuffer, m_nbrOfStagedBytes,
+                                                m_sectorErased, m_nextSectorAddress,
+                                                compareBuffer, sizeof(compareBuffer));
+    m_nbrOfStagedBytes = 0;
+    return result;
+  }
+
+  static const uint32_t COMPARE_BUFFER_SIZE = 64;
+
+  FlashUpdater& m_flashUpdater;
+  ImageHasher& m_imageHasher;
+  uint8_t* m_pStagingBuffer;
+  uint32_t m_stagingBufferSize;
+  uint32_t m_nbrOfStagedBytes;
+  uint32_t m_address;
+  bool m_sectorErased;
+  uint32_t m_nextSectorAddress;
+  uint64_t m_remainingSize;
+};
+
+} // namespace
+
+int32_t CandidateApplications::decompressApplication(MbedApplication& candidateApplication, uint32_t destAddress,
+                                                     uint8_t* pStagingBuffer, ImageHasher& imageHasher) {
+  // the memory used is the decompression window and the staging buffer, the
+  // compressed payload is read in place when the flash is memory mapped
+  Decompressor decompressor;
+  int32_t result = decompressor.start(candidateApplication.getCompression());
+  if (result != UC_ERR_NONE) {
+    tr_error("Cannot decompress application: %d", result);
+    return result;
+  }
+  FlashSink flashSink(m_flashUpdater, destAddress, candidateApplication.getFirmwareSize(),
+                      pStagingBuffer, m_installBufferSize, imageHasher);
+
+  uint8_t readBuffer[DECOMPRESSION_READ_BUFFER_SIZE];
+  uint32_t address = candidateApplication.getApplicationAddress();
+  uint64_t remaining = candidateApplication.getPayloadSize();
+  while (remaining > 0) {
+    uint32_t readSize = (remaining < UINT32_MAX) ? (uint32_t) remaining : UINT32_MAX;
+    const uint8_t* pData = m_flashUpdater.readRegion(address, readSize, readBuffer, sizeof(readBuffer));
+    if (pData == NULL) {
+      tr_error("Error while reading flash at address 0x%08x", address);
+      return UC_ERR_READING_FLASH;
+    }
+    result = decompressor.update(pData, readSize, flashSink);
+    if (result != UC_ERR_NONE) {
+      tr_error("Cannot decompress application: %d", result);
+      return result;
+    }
+    address += readSize;
+    remaining -= readSize;
+  }
+  tr_debug(" Decompressed %lld bytes", decompressor.getNbrOfDecompressedBytes());
+
+  return flashSink.finish();
+}
+
 #endif
 } // namespace
@@ -1,12 +1,23 @@
 #pragma once
 
+#if !defined(UPDATE_CLIENT_FLASH_SIMULATOR)
 #include "mbed.h"
+#endif
 #include <cstdint>
 
 #include "MbedApplication.h"
 #include "FlashUpdater.h"
+#include "VerificationRecord.h"
 
-
+// size of the staging buffer used for installing applications, the chunks
+// programmed are limited by this size and by the sectors
+#ifndef MBED_CONF_UPDATE_CLIENT_INSTALL_BUFFER_SIZE
+#define MBED_CONF_UPDATE_CLIENT_INSTALL_BUFFER_SIZE 4096
+#endif
+// read back each chunk programmed during an install, in addition to the final hash check
+#ifndef MBED_CONF_UPDATE_CLIENT_INSTALL_VERIFY_CHUNKS
+#define MBED_CONF_UPDATE_CLIENT_INSTALL_VERIFY_CHUNKS 0
+#endif
 
 namespace update_client {
 
@@ -16,28 +27,95 @@ struct APP_INFO{
   uint64_t firmwareVersion;
 };
 
+// geometry of a candidate slot, computed once from the storage area and the sectors
+struct SlotGeometry {
+  // start of the slot (where its header is stored), sector aligned
+  uint32_t startAddress;
+  // end of the slot (excluded), sector aligned
+  uint32_t endAddress;
+  // size of the slot, header included
+  uint32_t size;
+  // size left for the application after the header
+  uint32_t usableSize;
+  uint32_t nbrOfSectors;
+  // set if the slot is usable (at least one sector, larger than the header, no overlap)
+  bool valid;
+};
+
 
 class CandidateApplications {
 public:
-  CandidateApplications(FlashUpdater& flashUpdater, uint32_t storageAddress, uint32_t storageSize, uint32_t headerSize, uint32_t nbrOfSlots);
+  // the verification record is kept at verificationRecordAddress (0 disables it)
+  CandidateApplications(FlashUpdater& flashUpdater, uint32_t storageAddress, uint32_t storageSize, uint32_t headerSize, uint32_t nbrOfSlots,
+                        uint32_t verificationRecordAddress = MBED_CONF_UPDATE_CLIENT_VERIFICATION_RECORD_ADDRESS);
   ~CandidateApplications();
 
   MbedApplication& getMbedApplication(uint32_t slotIndex);
+  uint32_t getNbrOfSlots() const;
   uint32_t getSlotForCandidate();
+  // returns the start address (of the header) and the size of the slot
   int32_t getApplicationAddress(uint32_t slotIndex, uint32_t& applicationAddress, uint32_t& slotSize) const;
-  bool hasValidNewerApplication(MbedApplication& activeApplication, uint32_t& newestSlotIndex) const;
+  // the slot table computed at construction, e.g. for tools or telemetry
+  const SlotGeometry& getSlotGeometry(uint32_t slotIndex) const;
+  // returns the slot of the newest valid candidate newer than the active application. The
+  // candidates are hashed by descending version until a valid one is found,
+  // when bootableOnly is set, candidates that cannot be started in their slot are ignored
+  bool hasValidNewerApplication(MbedApplication& activeApplication, uint32_t& newestSlotIndex, bool bootableOnly = false) const;
+  // same as hasValidNewerApplication, based on the headers only: the candidate is
+  // validated by installApplication while it is copied. A candidate found not valid
+  // during the install is not selected anymore
+  bool hasNewerApplication(MbedApplication& activeApplication, uint32_t& newestSlotIndex) const;
+  // looks for a valid candidate with the same image as the given application: only
+  // the slots with a matching header are hashed (or looked up in the verification record)
+  bool findApplication(MbedApplication& application, uint32_t& slotIndex) const;
   // the installApplication method is used by the bootloader application
-  // (for which the POST_APPLICATION_ADDR symbol is defined)
+  // (for which the POST_APPLICATION_ADDR symbol is defined). The candidate is hashed
+  // while it is copied and the header is written last, only if the candidate is valid.
+  // A compressed candidate is decompressed while it is copied and installed with
+  // an uncompressed header
 
   int32_t installApplication(uint32_t slotIndex, uint32_t destHeaderAddress);
 
+  // direct boot (A/B) mode: instead of installing the newest candidate, the bootloader
+  // starts it in its slot, e.g. with mbed_start_application(bootAddress). Applications
+  // must be linked for the slot they are stored in. Returns the address of the newest
+  // valid candidate that can be started in place, or of the active application
+  int32_t getBootAddress(MbedApplication& activeApplication, uint32_t& bootAddress) const;
+
+  // the verification record shared by the candidate applications, it can also
+  // be set on the active application
+  VerificationRecord& getVerificationRecord();
+
+  // size of the staging buffer of the installs, MBED_CONF_UPDATE_CLIENT_INSTALL_BUFFER_SIZE
+  // by default. It must hold the header, e.g. for comparing chunk sizes on a target
+  void setInstallBufferSize(uint32_t installBufferSize);
+  uint32_t getInstallBufferSize() const;
+
 
 private:
+  // computes the slot table and checks that the slots are usable and do not overlap
+  void computeSlotGeometry();
+  // fills pSlotIndexes with the slots holding a valid header newer than the active
+  // application, by descending version, and returns their number
+  uint32_t sortNewerSlots(MbedApplication& activeApplication, uint32_t* pSlotIndexes) const;
+  // decompresses the payload of the candidate to the destination address,
+  // through the staging buffer (m_installBufferSize bytes)
+  int32_t decompressApplication(MbedApplication& candidateApplication, uint32_t destAddress,
+                                uint8_t* pStagingBuffer, ImageHasher& imageHasher);
+
   FlashUpdater& m_flashUpdater;
   uint32_t m_storageAddress;
   uint32_t m_storageSize;
   uint32_t m_nbrOfSlots;
+  uint32_t m_headerSize;
+  SlotGeometry m_slotGeometryArray[MBED_CONF_UPDATE_CLIENT_STORAGE_LOCATIONS];
+  VerificationRecord m_verificationRecord;
   MbedApplication* m_candidateApplicationArray[MBED_CONF_UPDATE_CLIENT_STORAGE_LOCATIONS];
+  uint32_t m_installBufferSize;
+
+  static const bool INSTALL_VERIFY_CHUNKS = MBED_CONF_UPDATE_CLIENT_INSTALL_VERIFY_CHUNKS;
+  // size of the buffer used when the flash cannot be read directly while decompressing
+  static const uint32_t DECOMPRESSION_READ_BUFFER_SIZE = 256;
 };
 
 }
@@ -0,0 +1,174 @@
+#include "Crc32.h"
+
+#if (MBED_CONF_UPDATE_CLIENT_CRC32_ENGINE == UPDATE_CLIENT_CRC32_HARDWARE) && DEVICE_CRC
+#include "mbed.h"
+#endif
+
+namespace update_client {
+
+static const uint32_t CRC32_POLYNOMIAL = 0xEDB88320;
+
+// the engines built: the configured one, and all of them on the host
+#if (MBED_CONF_UPDATE_CLIENT_CRC32_ENGINE == UPDATE_CLIENT_CRC32_SLICING8) || defined(UPDATE_CLIENT_FLASH_SIMULATOR)
+#define CRC32_WITH_SLICING8 1
+#endif
+#if (MBED_CONF_UPDATE_CLIENT_CRC32_ENGINE != UPDATE_CLIENT_CRC32_BITWISE) || defined(UPDATE_CLIENT_FLASH_SIMULATOR)
+#define CRC32_WITH_TABLE 1
+#endif
+
+#if CRC32_WITH_TABLE
+// lookup tables, table[0] is the classic byte table and table[n] gives the
+// contribution of a byte that is followed by n other bytes
+template <uint32_t NBR_OF_TABLES>
+struct Crc32Tables {
+  uint32_t table[NBR_OF_TABLES][256];
+
+  constexpr Crc32Tables() : table() {
+    for (uint32_t index = 0; index < 256; index++) {
+      uint32_t crc = index;
+      for (uint32_t counter = 0; counter < 8; counter++) {
+        crc = (crc & 1) ? ((crc >> 1) ^ CRC32_POLYNOMIAL) : (crc >> 1);
+      }
+      table[0][index] = crc;
+    }
+    for (uint32_t slice = 1; slice < NBR_OF_TABLES; slice++) {
+      for (uint32_t index = 0; index < 256; index++) {
+        uint32_t previous = table[slice - 1][index];
+        table[slice][index] = (previous >> 8) ^ table[0][previous & 0xFF];
+      }
+    }
+  }
+};
+
+#if CRC32_WITH_SLICING8
+static constexpr Crc32Tables<8> CRC32_TABLES;
+#else
+static constexpr Crc32Tables<1> CRC32_TABLES;
+#endif
+#endif
+
+Crc32::Crc32() :
+  m_crc(INITIAL_VALUE) {
+}
+
+void Crc32::reset() {
+  m_crc = INITIAL_VALUE;
+}
+
+void Crc32::update(const uint8_t* pBuffer, uint32_t length) {
+  m_crc = updateSoftware(m_crc, pBuffer, length);
+}
+
+uint32_t Crc32::getValue() const {
+  return m_crc ^ FINAL_XOR;
+}
+
+uint32_t Crc32::compute(const uint8_t* pBuffer, uint32_t length) {
+#if (MBED_CONF_UPDATE_CLIENT_CRC32_ENGINE == UPDATE_CLIENT_CRC32_HARDWARE) && DEVICE_CRC
+  // the hardware is used by MbedCRC when it supports the polynomial
+  mbed::MbedCRC<POLY_32BIT_ANSI, 32> hardwareCrc;
+  uint32_t crc = 0;
+  if (hardwareCrc.compute(pBuffer, length, &crc) == 0) {
+    return crc;
+  }
+#endif
+  return updateSoftware(INITIAL_VALUE, pBuffer, length) ^ FINAL_XOR;
+}
+
+#if defined(UPDATE_CLIENT_FLASH_SIMULATOR)
+uint32_t Crc32::computeWithEngine(uint32_t engine, const uint8_t* pBuffer, uint32_t length) {
+  // there is no CRC peripheral on the host, the hardware engine falls back to the table
+  switch (engine) {
+    case UPDATE_CLIENT_CRC32_BITWISE:
+      return updateBitwise(INITIAL_VALUE, pBuffer, length) ^ FINAL_XOR;
+    case UPDATE_CLIENT_CRC32_SLICING8:
+      return updateSlicing8(INITIAL_VALUE, pBuffer, length) ^ FINAL_XOR;
+    default:
+      return updateTable(INITIAL_VALUE, pBuffer, length) ^ FINAL_XOR;
+  }
+}
+
+const char* Crc32::getEngineName(uint32_t engine) {
+  switch (engine) {
+    case UPDATE_CLIENT_CRC32_BITWISE:
+      return "bitwise";
+    case UPDATE_CLIENT_CRC32_TABLE:
+      return "table";
+    case UPDATE_CLIENT_CRC32_SLICING8:
+      return "slicing8";
+    default:
+      return "hardware";
+  }
+}
+#endif
+
+uint32_t Crc32::updateSoftware(uint32_t crc, const uint8_t* pBuffer, uint32_t length) {
+#if (MBED_CONF_UPDATE_CLIENT_CRC32_ENGINE == UPDATE_CLIENT_CRC32_BITWISE)
+  return updateBitwise(crc, pBuffer, length);
+#elif (MBED_CONF_UPDATE_CLIENT_CRC32_ENGINE == UPDATE_CLIENT_CRC32_SLICING8)
+  return updateSlicing8(crc, pBuffer, length);
+#else
+  return updateTable(crc, pBuffer, length);
+#endif
+}
+
+uint32_t Crc32::updateBitwise(uint32_t crc, const uint8_t* pBuffer, uint32_t length) {
+  const uint8_t *pCurrent = pBuffer;
+
+  while (length--) {
+    crc ^= *pCurrent;
+    pCurrent++;
+
+    for (uint32_t counter = 0; counter < 8; counter++) {
+      if (crc & 1) {
+        crc = (crc >> 1) ^ CRC32_POLYNOMIAL;
+      }
+      else {
+        crc = crc >> 1;
+      }
+    }
+  }
+
+  return crc;
+}
+
+#if CRC32_WITH_TABLE
+uint32_t Crc32::updateTable(uint32_t crc, const uint8_t* pBuffer, uint32_t length) {
+  const uint8_t *pCurrent = pBuffer;
+
+  while (length--) {
+    crc = (crc >> 8) ^ CRC32_TABLES.table[0][(crc ^ *pCurrent) & 0xFF];
+    pCurrent++;
+  }
+
+  return crc;
+}
+#endif
+
+#if CRC32_WITH_SLICING8
+uint32_t Crc32::updateSlicing8(uint32_t crc, const uint8_t* pBuffer, uint32_t length) {
+  const uint8_t *pCurrent = pBuffer;
+
+  // process 8 bytes per iteration, bytes are assembled explicitly so that
+  // the buffer does not need to be aligned and endianness does not matter
+  while (length >= 8) {
+    uint32_t low = crc ^ (pCurrent[0] | (pCurrent[1] << 8) | (pCurrent[2] << 16) | ((uint32_t) pCurrent[3] << 24));
+    uint32_t high = pCurrent[4] | (pCurrent[5] << 8) | (pCurrent[6] << 16) | ((uint32_t) pCurrent[7] << 24);
+    crc = CRC32_TABLES.table[7][low & 0xFF] ^
+          CRC32_TABLES.table[6][(low >> 8) & 0xFF] ^
+          CRC32_TABLES.table[5][(low >> 16) & 0xFF] ^
+          CRC32_TABLES.table[4][low >> 24] ^
+          CRC32_TABLES.table[3][high & 0xFF] ^
+          CRC32_TABLES.table[2][(high >> 8) & 0xFF] ^
+          CRC32_TABLES.table[1][(high >> 16) & 0xFF] ^
+          CRC32_TABLES.table[0][high >> 24];
+    pCurrent += 8;
+    length -= 8;
+  }
+
+  // remaining bytes
+  return updateTable(crc, pCurrent, length);
+}
+#endif
+
+} // namespace
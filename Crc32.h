@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+
+// CRC32 implementations that can be selected with the update-client.crc32-engine configuration
+#define UPDATE_CLIENT_CRC32_BITWISE  0
+#define UPDATE_CLIENT_CRC32_TABLE    1
+#define UPDATE_CLIENT_CRC32_SLICING8 2
+#define UPDATE_CLIENT_CRC32_HARDWARE 3
+
+#ifndef MBED_CONF_UPDATE_CLIENT_CRC32_ENGINE
+#define MBED_CONF_UPDATE_CLIENT_CRC32_ENGINE UPDATE_CLIENT_CRC32_TABLE
+#endif
+
+namespace update_client {
+
+// Crc32 computes the CRC32 (IEEE 802.3, reflected, polynomial 0xEDB88320) used
+// by the application header and for transfer checksums.
+// - bitwise: 8 shift/xor per byte, no table
+// - table: one lookup per byte in a 1 KB table
+// - slicing8: 8 bytes per iteration using 8 KB of tables
+// - hardware: CRC peripheral through MbedCRC for one-shot computations on
+//   targets with DEVICE_CRC. Incremental computations use the table since
+//   the peripheral cannot be shared between several running checksums.
+// Tables are computed at compile time and live in ROM.
+
+class Crc32 {
+public:
+  Crc32();
+
+  // restart a new checksum
+  void reset();
+  // add data to the running checksum
+  void update(const uint8_t* pBuffer, uint32_t length);
+  // returns the checksum of the data added since the last reset
+  uint32_t getValue() const;
+
+  // one-shot computation
+  static uint32_t compute(const uint8_t* pBuffer, uint32_t length);
+
+#if defined(UPDATE_CLIENT_FLASH_SIMULATOR)
+  // one-shot computation with the given software engine, all of them are built on the
+  // host so that the benchmark can compare them side by side
+  static uint32_t computeWithEngine(uint32_t engine, const uint8_t* pBuffer, uint32_t length);
+  static const char* getEngineName(uint32_t engine);
+#endif
+
+private:
+  static uint32_t updateBitwise(uint32_t crc, const uint8_t* pBuffer, uint32_t length);
+  static uint32_t updateTable(uint32_t crc, const uint8_t* pBuffer, uint32_t length);
+  static uint32_t updateSlicing8(uint32_t crc, const uint8_t* pBuffer, uint32_t length);
+  static uint32_t updateSoftware(uint32_t crc, const uint8_t* pBuffer, uint32_t length);
+
+  static const uint32_t INITIAL_VALUE = 0xFFFFFFFF;
+  static const uint32_t FINAL_XOR = 0xFFFFFFFF;
+
+  // data members
+  uint32_t m_crc;
+};
+
+} // namespace
@@ -0,0 +1,153 @@
+#include "Decompressor.h"
+#include "UCErrorCodes.h"
+#include <cstring>
+
+namespace update_client {
+
+Decompressor::Decompressor() :
+  m_windowBits(0),
+  m_lookaheadBits(0),
+  m_state(TAG),
+  m_bits(0),
+  m_nbrOfBits(0),
+  m_backrefOffset(0),
+  m_windowIndex(0),
+  m_flushIndex(0),
+  m_nbrOfPendingBytes(0),
+  m_nbrOfDecompressedBytes(0) {
+}
+
+bool Decompressor::isSupported(uint32_t compression) {
+  const uint32_t windowBits = (compression >> 8) & 0xFF;
+  const uint32_t lookaheadBits = (compression >> 16) & 0xFF;
+  return (compression & 0xFF) == COMPRESSION_HEATSHRINK && (compression >> 24) == 0 &&
+         windowBits >= MIN_WINDOW_BITS && windowBits <= MAX_WINDOW_BITS &&
+         lookaheadBits >= MIN_LOOKAHEAD_BITS && lookaheadBits < windowBits;
+}
+
+int32_t Decompressor::start(uint32_t compression) {
+  if (! isSupported(compression)) {
+    return UC_ERR_DECOMPRESSION_FAILED;
+  }
+  m_windowBits = (compression >> 8) & 0xFF;
+  m_lookaheadBits = (compression >> 16) & 0xFF;
+
+  // back references before the start of the stream refer to zeros
+  const uint32_t windowSize = 1UL << m_windowBits;
+  m_window.reset(new uint8_t[windowSize]);
+  memset(m_window.get(), 0, windowSize);
+
+  m_state = TAG;
+  m_bits = 0;
+  m_nbrOfBits = 0;
+  m_backrefOffset = 0;
+  m_windowIndex = 0;
+  m_flushIndex = 0;
+  m_nbrOfPendingBytes = 0;
+  m_nbrOfDecompressedBytes = 0;
+
+  return UC_ERR_NONE;
+}
+
+int32_t Decompressor::update(const uint8_t* pData, uint32_t size, DecompressorSink& sink) {
+  if (m_window == NULL) {
+    return UC_ERR_DECOMPRESSION_FAILED;
+  }
+
+  for (uint32_t index = 0; index < size; index++) {
+    // at most 15 bits are pending, so that the byte always fits
+    m_bits = (m_bits << 8) | pData[index];
+    m_nbrOfBits += 8;
+
+    while (true) {
+      uint32_t nbrOfBits = 1;
+      switch (m_state) {
+        case TAG:
+          nbrOfBits = 1;
+          break;
+        case LITERAL:
+          nbrOfBits = 8;
+          break;
+        case BACKREF_OFFSET:
+          nbrOfBits = m_windowBits;
+          break;
+        case BACKREF_COUNT:
+          nbrOfBits = m_lookaheadBits;
+          break;
+      }
+      if (m_nbrOfBits < nbrOfBits) {
+        break;
+      }
+      m_nbrOfBits -= nbrOfBits;
+      int32_t result = decodeBits((m_bits >> m_nbrOfBits) & ((1UL << nbrOfBits) - 1), sink);
+      if (result != UC_ERR_NONE) {
+        return result;
+      }
+    }
+  }
+
+  // pass what was decompressed from this block
+  return flush(sink);
+}
+
+uint64_t Decompressor::getNbrOfDecompressedBytes() const {
+  return m_nbrOfDecompressedBytes;
+}
+
+int32_t Decompressor::decodeBits(uint32_t value, DecompressorSink& sink) {
+  switch (m_state) {
+    case TAG:
+      m_state = (value != 0) ? LITERAL : BACKREF_OFFSET;
+      break;
+
+    case LITERAL:
+      m_state = TAG;
+      return outputByte((uint8_t) value, sink);
+
+    case BACKREF_OFFSET:
+      m_backrefOffset = value + 1;
+      m_state = BACKREF_COUNT;
+      break;
+
+    case BACKREF_COUNT: {
+      m_state = TAG;
+      const uint32_t windowMask = (1UL << m_windowBits) - 1;
+      for (uint32_t count = value + 1; count > 0; count--) {
+        int32_t result = outputByte(m_window[(m_windowIndex - m_backrefOffset) & windowMask], sink);
+        if (result != UC_ERR_NONE) {
+          return result;
+        }
+      }
+      break;
+    }
+  }
+
+  return UC_ERR_NONE;
+}
+
+int32_t Decompressor::outputByte(uint8_t value, DecompressorSink& sink) {
+  m_window[m_windowIndex] = value;
+  m_windowIndex = (m_windowIndex + 1) & ((1UL << m_windowBits) - 1);
+  m_nbrOfPendingBytes++;
+  m_nbrOfDecompressedBytes++;
+
+  // the end of the window is passed before it is overwritten
+  if (m_windowIndex == 0) {
+    return flush(sink);
+  }
+  return UC_ERR_NONE;
+}
+
+int32_t Decompressor::flush(DecompressorSink& sink) {
+  if (m_nbrOfPendingBytes == 0) {
+    return UC_ERR_NONE;
+  }
+  // the pending bytes never wrap around the end of the window
+  int32_t result = sink.write(&m_window[m_flushIndex], m_nbrOfPendingBytes);
+  m_flushIndex = m_windowIndex;
+  m_nbrOfPendingBytes = 0;
+
+  return result;
+}
+
+} // namespace
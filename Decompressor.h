@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+
+// largest decompression window accepted, the window is the only buffer of the decompressor
+#ifndef MBED_CONF_UPDATE_CLIENT_DECOMPRESSION_MAX_WINDOW_BITS
+#define MBED_CONF_UPDATE_CLIENT_DECOMPRESSION_MAX_WINDOW_BITS 12
+#endif
+
+namespace update_client {
+
+// compression of the application payload, as stored in the application header:
+// the algorithm in bits 0-7 and its parameters in the next bytes
+enum COMPRESSION_TYPES {
+  COMPRESSION_NONE = 0,
+  // heatshrink (LZSS), window size (bits) in bits 8-15, lookahead size (bits) in bits 16-23
+  COMPRESSION_HEATSHRINK = 1,
+  // the payload is a delta patch against the active application (see DeltaPatcher.h),
+  // compressed as described by the other bits
+  COMPRESSION_DELTA = 0x01000000
+};
+
+// receives the decompressed data
+class DecompressorSink {
+public:
+  virtual int32_t write(const uint8_t* pData, uint32_t size) = 0;
+
+protected:
+  ~DecompressorSink() {}
+};
+
+// Decompressor decompresses a stream fed in blocks of any size. The data is
+// decompressed in the window, which is passed to the sink as it fills up, so
+// that the memory used is the window only (2^window bits bytes).
+// The format is the one of heatshrink: a tag bit followed by either a literal
+// byte (tag 1) or a back reference made of an offset and a count (tag 0),
+// all stored most significant bit first.
+
+class Decompressor {
+public:
+  Decompressor();
+
+  static bool isSupported(uint32_t compression);
+  // starts a new stream, allocates the window
+  int32_t start(uint32_t compression);
+  // decompresses the data and passes the result to the sink
+  int32_t update(const uint8_t* pData, uint32_t size, DecompressorSink& sink);
+  uint64_t getNbrOfDecompressedBytes() const;
+
+private:
+  int32_t decodeBits(uint32_t value, DecompressorSink& sink);
+  int32_t outputByte(uint8_t value, DecompressorSink& sink);
+  int32_t flush(DecompressorSink& sink);
+
+  static const uint32_t MIN_WINDOW_BITS = 4;
+  static const uint32_t MAX_WINDOW_BITS = MBED_CONF_UPDATE_CLIENT_DECOMPRESSION_MAX_WINDOW_BITS;
+  static const uint32_t MIN_LOOKAHEAD_BITS = 3;
+
+  enum State {
+    TAG,
+    LITERAL,
+    BACKREF_OFFSET,
+    BACKREF_COUNT
+  };
+
+  // data members
+  std::unique_ptr<uint8_t[]> m_window;
+  uint32_t m_windowBits;
+  uint32_t m_lookaheadBits;
+  State m_state;
+  // bits received and not decoded yet
+  uint32_t m_bits;
+  uint32_t m_nbrOfBits;
+  uint32_t m_backrefOffset;
+  // position of the next byte in the window and of the bytes not passed to the sink yet
+  uint32_t m_windowIndex;
+  uint32_t m_flushIndex;
+  uint32_t m_nbrOfPendingBytes;
+  uint64_t m_nbrOfDecompressedBytes;
+};
+
+} // namespace
@@ -0,0 +1,208 @@
+#include "DeltaPatcher.h"
+#include "UCErrorCodes.h"
+#include <cstring>
+
+#if MBED_CONF_MBED_TRACE_ENABLE
+#include "mbed_trace.h"
+#define TRACE_GROUP "DeltaPatcher"
+#endif // MBED_CONF_MBED_TRACE_ENABLE
+
+namespace update_client {
+
+DeltaPatcher::DeltaPatcher(FlashUpdater& flashUpdater, MbedApplication& baseApplication) :
+  m_flashUpdater(flashUpdater),
+  m_baseApplication(baseApplication),
+  m_pSink(NULL),
+  m_state(PATCH_HEADER),
+  m_nbrOfHeaderBytes(0),
+  m_diffSize(0),
+  m_extraSize(0),
+  m_seek(0),
+  m_baseOffset(0),
+  m_baseSize(0),
+  m_nbrOfPatchedBytes(0) {
+}
+
+bool DeltaPatcher::isSupported(uint32_t compression) {
+  if ((compression & COMPRESSION_DELTA) == 0) {
+    return false;
+  }
+  const uint32_t patchCompression = compression & ~((uint32_t) COMPRESSION_DELTA);
+  return patchCompression == COMPRESSION_NONE || Decompressor::isSupported(patchCompression);
+}
+
+int32_t DeltaPatcher::start(DecompressorSink& sink) {
+  m_pSink = &sink;
+  m_state = PATCH_HEADER;
+  m_nbrOfHeaderBytes = 0;
+  m_diffSize = 0;
+  m_extraSize = 0;
+  m_seek = 0;
+  m_baseOffset = 0;
+  m_baseSize = 0;
+  m_nbrOfPatchedBytes = 0;
+
+  return UC_ERR_NONE;
+}
+
+int32_t DeltaPatcher::write(const uint8_t* pData, uint32_t size) {
+  if (m_pSink == NULL) {
+    return UC_ERR_INVALID_PATCH;
+  }
+
+  int32_t result = UC_ERR_NONE;
+  while (size > 0 && result == UC_ERR_NONE) {
+    uint32_t usedSize = 0;
+    switch (m_state) {
+      case PATCH_HEADER:
+      case RECORD_HEADER: {
+        const uint32_t headerSize = (m_state == PATCH_HEADER) ? PATCH_HEADER_SIZE : RECORD_HEADER_SIZE;
+        usedSize = headerSize - m_nbrOfHeaderBytes;
+        if (usedSize > size) {
+          usedSize = size;
+        }
+        memcpy(&m_headerBuffer[m_nbrOfHeaderBytes], pData, usedSize);
+        m_nbrOfHeaderBytes += usedSize;
+        if (m_nbrOfHeaderBytes < headerSize) {
+          break;
+        }
+        m_nbrOfHeaderBytes = 0;
+
+        if (m_state == PATCH_HEADER) {
+          result = checkBase();
+          m_state = RECORD_HEADER;
+        }
+        else {
+          m_diffSize = parseUint32(&m_headerBuffer[0]);
+          m_extraSize = parseUint32(&m_headerBuffer[4]);
+          m_seek = (int32_t) parseUint32(&m_headerBuffer[8]);
+          // the diff applies to the base only
+          if (m_diffSize > m_baseSize - m_baseOffset) {
+            tr_error("Patch record exceeds the base (offset %lld, size %d)", m_baseOffset, m_diffSize);
+            result = UC_ERR_INVALID_PATCH;
+          }
+          m_state = DIFF;
+        }
+        break;
+      }
+
+      case DIFF:
+        usedSize = (m_diffSize < size) ? m_diffSize : size;
+        result = applyDiff(pData, usedSize);
+        m_diffSize -= usedSize;
+        break;
+
+      case EXTRA:
+        usedSize = (m_extraSize < size) ? m_extraSize : size;
+        result = m_pSink->write(pData, usedSize);
+        m_nbrOfPatchedBytes += usedSize;
+        m_extraSize -= usedSize;
+        break;
+    }
+    pData += usedSize;
+    size -= usedSize;
+
+    // move to the next part of the record, also when parts are empty
+    if (m_state == DIFF && m_diffSize == 0) {
+      m_state = EXTRA;
+    }
+    if (m_state == EXTRA && m_extraSize == 0 && result == UC_ERR_NONE) {
+      result = seekBase(m_seek);
+      m_seek = 0;
+      m_state = RECORD_HEADER;
+    }
+  }
+
+  return result;
+}
+
+int32_t DeltaPatcher::finish() {
+  if (m_state != RECORD_HEADER || m_nbrOfHeaderBytes != 0) {
+    tr_error("Patch is incomplete");
+    return UC_ERR_INVALID_PATCH;
+  }
+  return UC_ERR_NONE;
+}
+
+uint64_t DeltaPatcher::getNbrOfPatchedBytes() const {
+  return m_nbrOfPatchedBytes;
+}
+
+int32_t DeltaPatcher::checkBase() {
+  if (parseUint32(&m_headerBuffer[0]) != PATCH_MAGIC) {
+    tr_error("Invalid patch header");
+    return UC_ERR_INVALID_PATCH;
+  }
+
+  // the patch must be made for the active application, which must be intact
+  m_baseSize = parseUint64(&m_headerBuffer[BASE_SIZE_OFFSET]);
+  if (! m_baseApplication.hasImage(m_baseSize, &m_headerBuffer[BASE_HASH_OFFSET])) {
+    tr_error("Patch does not apply to the active application");
+    return UC_ERR_BASE_MISMATCH;
+  }
+  int32_t result = m_baseApplication.checkApplication();
+  if (result != UC_ERR_NONE) {
+    tr_error("Active application is not valid: %d", result);
+    return UC_ERR_BASE_MISMATCH;
+  }
+  tr_debug("Applying patch to base of size %lld", m_baseSize);
+
+  return UC_ERR_NONE;
+}
+
+int32_t DeltaPatcher::applyDiff(const uint8_t* pData, uint32_t size) {
+  uint8_t readBuffer[PATCH_BUFFER_SIZE];
+  uint8_t patchedBuffer[PATCH_BUFFER_SIZE];
+  while (size > 0) {
+    uint32_t readSize = (size < PATCH_BUFFER_SIZE) ? size : PATCH_BUFFER_SIZE;
+    const uint32_t baseAddress = m_baseApplication.getApplicationAddress() + (uint32_t) m_baseOffset;
+    const uint8_t* pBaseData = m_flashUpdater.readRegion(baseAddress, readSize, readBuffer, sizeof(readBuffer));
+    if (pBaseData == NULL) {
+      tr_error("Error while reading flash at address 0x%08x", baseAddress);
+      return UC_ERR_READING_FLASH;
+    }
+
+    for (uint32_t index = 0; index < readSize; index++) {
+      patchedBuffer[index] = pBaseData[index] + pData[index];
+    }
+    int32_t result = m_pSink->write(patchedBuffer, readSize);
+    if (result != UC_ERR_NONE) {
+      return result;
+    }
+    m_baseOffset += readSize;
+    m_nbrOfPatchedBytes += readSize;
+    pData += readSize;
+    size -= readSize;
+  }
+
+  return UC_ERR_NONE;
+}
+
+int32_t DeltaPatcher::seekBase(int32_t seek) {
+  const int64_t baseOffset = (int64_t) m_baseOffset + seek;
+  if (baseOffset < 0 || (uint64_t) baseOffset > m_baseSize) {
+    tr_error("Patch seeks out of the base (offset %lld)", baseOffset);
+    return UC_ERR_INVALID_PATCH;
+  }
+  m_baseOffset = (uint64_t) baseOffset;
+
+  return UC_ERR_NONE;
+}
+
+uint32_t DeltaPatcher::parseUint32(const uint8_t* pBuffer) {
+  uint32_t result = pBuffer[0];
+  result = (result << 8) | pBuffer[1];
+  result = (result << 8) | pBuffer[2];
+  result = (result << 8) | pBuffer[3];
+
+  return result;
+}
+
+uint64_t DeltaPatcher::parseUint64(const uint8_t* pBuffer) {
+  uint64_t result = parseUint32(&pBuffer[0]);
+  result = (result << 32) | parseUint32(&pBuffer[4]);
+
+  return result;
+}
+
+} // namespace
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstdint>
+
+#include "Decompressor.h"
+#include "FlashUpdater.h"
+#include "MbedApplication.h"
+
+namespace update_client {
+
+// DeltaPatcher rebuilds an application from a delta patch against the active
+// application (the base), fed in blocks of any size. The base is read from flash
+// as needed and the rebuilt image is passed to the sink, so that the memory used
+// is a few small buffers only.
+// The patch (bsdiff-like, stored sequentially) starts with a header:
+//  - magic (4 bytes)
+//  - size of the base image (8 bytes)
+//  - SHA-256 of the base image (32 bytes)
+// followed by records made of:
+//  - diff size (4 bytes), extra size (4 bytes) and seek (4 bytes, signed)
+//  - diff size bytes, added to the base bytes at the current base offset
+//  - extra size bytes, copied as they are
+// after which the base offset is moved by seek. All values are big endian.
+// The base is checked against the patch header before anything is rebuilt.
+
+class DeltaPatcher :
+  public DecompressorSink {
+public:
+  DeltaPatcher(FlashUpdater& flashUpdater, MbedApplication& baseApplication);
+
+  // returns true for a delta payload whose patch compression is supported
+  static bool isSupported(uint32_t compression);
+  // starts a new patch, the rebuilt image is passed to the sink
+  int32_t start(DecompressorSink& sink);
+  // applies the patch data
+  virtual int32_t write(const uint8_t* pData, uint32_t size);
+  // checks that the patch ended after a complete record
+  int32_t finish();
+  uint64_t getNbrOfPatchedBytes() const;
+
+  static const uint32_t PATCH_MAGIC = 0x55434450;
+  static const uint32_t PATCH_HEADER_SIZE = 44;
+  static const uint32_t RECORD_HEADER_SIZE = 12;
+
+private:
+  int32_t checkBase();
+  int32_t applyDiff(const uint8_t* pData, uint32_t size);
+  int32_t seekBase(int32_t seek);
+
+  static uint32_t parseUint32(const uint8_t *pBuffer);
+  static uint64_t parseUint64(const uint8_t *pBuffer);
+
+  // size of the buffers used for reading the base and for adding the diff
+  static const uint32_t PATCH_BUFFER_SIZE = 64;
+  static const uint32_t BASE_SIZE_OFFSET = 4;
+  static const uint32_t BASE_HASH_OFFSET = 12;
+
+  enum State {
+    PATCH_HEADER,
+    RECORD_HEADER,
+    DIFF,
+    EXTRA
+  };
+
+  // data members
+  FlashUpdater& m_flashUpdater;
+  MbedApplication& m_baseApplication;
+  DecompressorSink* m_pSink;
+  State m_state;
+  // patch and record headers are collected here, as they may be split between blocks
+  uint8_t m_headerBuffer[PATCH_HEADER_SIZE];
+  uint32_t m_nbrOfHeaderBytes;
+  uint32_t m_diffSize;
+  uint32_t m_extraSize;
+  int32_t m_seek;
+  uint64_t m_baseOffset;
+  uint64_t m_baseSize;
+  uint64_t m_nbrOfPatchedBytes;
+};
+
+} // namespace
@@ -0,0 +1,99 @@
+#include "DownloadJournal.h"
+#include "UCErrorCodes.h"
+
+#if MBED_CONF_MBED_TRACE_ENABLE
+#include "mbed_trace.h"
+#define TRACE_GROUP "DownloadJournal"
+#endif // MBED_CONF_MBED_TRACE_ENABLE
+
+namespace update_client {
+
+DownloadJournal::DownloadJournal(FlashUpdater& flashUpdater, uint32_t journalAddress) :
+  m_sectorLog(flashUpdater, journalAddress, JOURNAL_MAGIC, sizeof(Entry)),
+  m_loaded(false) {
+  memset((void*) &m_entry, 0, sizeof(m_entry));
+}
+
+bool DownloadJournal::isEnabled() const {
+  return m_sectorLog.isEnabled();
+}
+
+uint32_t DownloadJournal::getSlotAddress() {
+  if (! isEnabled() || load() != UC_ERR_NONE) {
+    return 0;
+  }
+
+  return m_entry.slotAddress;
+}
+
+uint32_t DownloadJournal::getResumeOffset(uint32_t slotAddress, const uint8_t* pHeaderHash) {
+  if (! isEnabled() || load() != UC_ERR_NONE) {
+    return 0;
+  }
+
+  // the progress only applies to the same image in the same slot
+  if (m_entry.slotAddress != slotAddress ||
+      memcmp(m_entry.headerHash, pHeaderHash, HEADER_HASH_SIZE) != 0) {
+    return 0;
+  }
+
+  return m_entry.offset;
+}
+
+int32_t DownloadJournal::setProgress(uint32_t slotAddress, const uint8_t* pHeaderHash, uint32_t offset) {
+  if (! isEnabled()) {
+    return UC_ERR_NONE;
+  }
+  int32_t result = load();
+  if (result != UC_ERR_NONE) {
+    return result;
+  }
+
+  m_entry.slotAddress = slotAddress;
+  memcpy(m_entry.headerHash, pHeaderHash, HEADER_HASH_SIZE);
+  m_entry.offset = offset;
+  tr_debug(" Recording download progress 0x%08x for slot at 0x%08x", offset, slotAddress);
+
+  return store();
+}
+
+int32_t DownloadJournal::clear() {
+  if (! isEnabled()) {
+    return UC_ERR_NONE;
+  }
+  int32_t result = load();
+  if (result != UC_ERR_NONE) {
+    return result;
+  }
+
+  // nothing in progress, avoid writing the flash
+  if (m_entry.slotAddress == 0 && m_entry.offset == 0) {
+    return UC_ERR_NONE;
+  }
+  memset((void*) &m_entry, 0, sizeof(m_entry));
+
+  return store();
+}
+
+int32_t DownloadJournal::load() {
+  if (m_loaded) {
+    return UC_ERR_NONE;
+  }
+
+  // start with no download in progress, then keep the last valid entry found in the sector
+  memset((void*) &m_entry, 0, sizeof(m_entry));
+  bool found = false;
+  int32_t result = m_sectorLog.load(&m_entry, found);
+  if (result != UC_ERR_NONE) {
+    return result;
+  }
+  m_loaded = true;
+
+  return UC_ERR_NONE;
+}
+
+int32_t DownloadJournal::store() {
+  return m_sectorLog.append(&m_entry);
+}
+
+} // namespace
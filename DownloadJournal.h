@@ -0,0 +1,59 @@
+#pragma once
+
+#if !defined(UPDATE_CLIENT_FLASH_SIMULATOR)
+#include "mbed.h"
+#endif
+#include <cstdint>
+
+#include "FlashUpdater.h"
+#include "SectorLog.h"
+
+// address of the flash sector reserved for the download journal, 0 to disable it
+#ifndef MBED_CONF_UPDATE_CLIENT_DOWNLOAD_JOURNAL_ADDRESS
+#define MBED_CONF_UPDATE_CLIENT_DOWNLOAD_JOURNAL_ADDRESS 0
+#endif
+
+namespace update_client {
+
+// DownloadJournal keeps, in a reserved flash sector, the progress of the download
+// in progress: the slot, the hash of the header of the image received and the
+// offset (in the slot) up to which the image is programmed and verified. A download
+// interrupted (e.g. by a lost connection) can be resumed from that offset when the
+// same image is sent again.
+// Entries are appended to the sector through a SectorLog.
+
+class DownloadJournal {
+public:
+  static const uint32_t HEADER_HASH_SIZE = 32;
+
+  DownloadJournal(FlashUpdater& flashUpdater, uint32_t journalAddress);
+
+  bool isEnabled() const;
+  // returns the address of the slot with a download in progress, 0 if none
+  uint32_t getSlotAddress();
+  // returns the offset recorded for the image with the given header in the slot, 0 if none
+  uint32_t getResumeOffset(uint32_t slotAddress, const uint8_t* pHeaderHash);
+  // records the offset up to which the image with the given header is written in the slot
+  int32_t setProgress(uint32_t slotAddress, const uint8_t* pHeaderHash, uint32_t offset);
+  // forgets the download in progress (e.g. once it is complete)
+  int32_t clear();
+
+private:
+  int32_t load();
+  int32_t store();
+
+  static const uint32_t JOURNAL_MAGIC = 0x444A524EUL;
+
+  struct Entry {
+    uint32_t slotAddress;
+    uint8_t headerHash[HEADER_HASH_SIZE];
+    uint32_t offset;
+  };
+
+  // data members
+  SectorLog m_sectorLog;
+  Entry m_entry;
+  bool m_loaded;
+};
+
+} // namespace
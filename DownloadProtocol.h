@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+
+namespace update_client {
+
+// Framed download protocol
+//
+// Every frame, in both directions, is made of
+//   type (1 byte) | payload size (2 bytes) | payload | CRC32 of type, size and payload (4 bytes)
+// multi-byte values are big endian, as in the application header.
+//
+// The host sends the application header (HEADER frame), then the image in DATA
+// frames and finally an END frame. The device answers:
+// - to the HEADER frame: ACK with the maximum DATA payload size, once the slot is
+//   ready to be written, SKIP with the number of bytes saved when the device
+//   already has the application (active or valid candidate with the same
+//   version, size and hash), in which case the transfer ends there, or NACK
+//   with an error code. When an interrupted download of the same image to the same
+//   slot can be resumed, the device answers RESUME with the number of payload bytes
+//   it already has, and the host sends the payload from that offset
+// - to the END frame: ACK with the number of image bytes received, once the image
+//   is written and verified, or NACK with an error code
+// DATA frames are not acknowledged, an invalid DATA frame is answered with a
+// NACK and ends the transfer.
+
+// frame types
+enum DOWNLOAD_FRAME_TYPES {
+  DOWNLOAD_FRAME_HEADER = 0x01,
+  DOWNLOAD_FRAME_DATA = 0x02,
+  DOWNLOAD_FRAME_END = 0x03,
+  DOWNLOAD_FRAME_ACK = 0x80,
+  DOWNLOAD_FRAME_NACK = 0x81,
+  DOWNLOAD_FRAME_SKIP = 0x82,
+  DOWNLOAD_FRAME_RESUME = 0x83
+};
+
+// size of the frame fields
+static const uint32_t DOWNLOAD_FRAME_PREFIX_SIZE = 3;
+static const uint32_t DOWNLOAD_FRAME_CRC_SIZE = 4;
+// size of the ACK and NACK payloads
+static const uint32_t DOWNLOAD_RESPONSE_SIZE = 4;
+// maximum payload of DATA frames
+static const uint32_t DOWNLOAD_MAX_DATA_SIZE = 4096;
+
+} // namespace
@@ -0,0 +1,709 @@
+#include "DownloadSession.h"
+#include <chrono>
+
+#if MBED_CONF_MBED_TRACE_ENABLE
+#include "mbed_trace.h"
+#define TRACE_GROUP "DownloadSession"
+#endif // MBED_CONF_MBED_TRACE_ENABLE
+
+#include "CandidateApplications.h"
+#include "Crc32.h"
+#include "Decompressor.h"
+#include "DeltaPatcher.h"
+#include "DownloadJournal.h"
+#include "DownloadProtocol.h"
+#include "FlashUpdater.h"
+#include "FlashWritePipeline.h"
+#include "ImageHasher.h"
+#include "UCErrorCodes.h"
+
+#if defined(UPDATE_DOWNLOAD)
+// the active application, compared with the downloaded ones and the base of delta
+// updates: the header and application addresses of applications built with a
+// bootloader, otherwise the header offset of the target
+#if defined(HEADER_ADDR) && defined(APPLICATION_ADDR)
+#define ACTIVE_APPLICATION_HEADER_ADDR HEADER_ADDR
+#define ACTIVE_APPLICATION_ADDR APPLICATION_ADDR
+#elif defined(MBED_ROM_START) && defined(MBED_CONF_TARGET_HEADER_OFFSET)
+#define ACTIVE_APPLICATION_HEADER_ADDR (MBED_ROM_START + MBED_CONF_TARGET_HEADER_OFFSET)
+#define ACTIVE_APPLICATION_ADDR (ACTIVE_APPLICATION_HEADER_ADDR + DownloadSession::SLOT_HEADER_SIZE)
+#else
+#error "The active application is needed for downloads: define HEADER_ADDR and APPLICATION_ADDR or target.header_offset"
+#endif
+#endif
+
+namespace update_client {
+
+
+#if defined(UPDATE_DOWNLOAD)
+
+namespace {
+
+// the progress is shown on the console of the device, on the host the session
+// is run by tools that print their own results
+void printProgress(uint64_t nbrOfBytes) {
+#if !defined(UPDATE_CLIENT_FLASH_SIMULATOR)
+  printf("Received %05u bytes\r", (uint32_t) nbrOfBytes);
+#else
+  (void) nbrOfBytes;
+#endif
+}
+
+// passes an image rebuilt from a delta patch to the download buffers and hashes
+// it, the image cannot exceed its firmware size
+class PipelineSink :
+  public DecompressorSink {
+public:
+  PipelineSink(FlashWritePipeline& writePipeline, char*& pBuffer, uint32_t& bufferFill,
+               uint64_t firmwareSize, ImageHasher& imageHasher) :
+    m_writePipeline(writePipeline),
+    m_pBuffer(pBuffer),
+    m_bufferFill(bufferFill),
+    m_remainingSize(firmwareSize),
+    m_imageHasher(imageHasher) {
+  }
+
+  virtual int32_t write(const uint8_t* pData, uint32_t size) {
+    if (size > m_remainingSize) {
+      tr_error("Patched application exceeds its size");
+      return UC_ERR_INVALID_PATCH;
+    }
+    m_remainingSize -= size;
+    m_imageHasher.update(pData, size);
+
+    const uint32_t bufferSize = m_writePipeline.getBufferSize();
+    while (size > 0) {
+      if (m_pBuffer == NULL) {
+        m_pBuffer = m_writePipeline.acquireBuffer();
+        m_bufferFill = 0;
+      }
+      uint32_t copySize = (size < bufferSize - m_bufferFill) ? size : bufferSize - m_bufferFill;
+      memcpy(m_pBuffer + m_bufferFill, pData, copySize);
+      m_bufferFill += copySize;
+      pData += copySize;
+      size -= copySize;
+
+      if (m_bufferFill == bufferSize) {
+        int32_t result = m_writePipeline.submitBuffer(m_pBuffer, m_bufferFill);
+        m_pBuffer = NULL;
+        if (result != UC_ERR_NONE) {
+          tr_error("Cannot write to flash: %d", result);
+          return result;
+        }
+      }
+    }
+    return UC_ERR_NONE;
+  }
+
+  uint64_t getRemainingSize() const {
+    return m_remainingSize;
+  }
+
+private:
+  FlashWritePipeline& m_writePipeline;
+  char*& m_pBuffer;
+  uint32_t& m_bufferFill;
+  uint64_t m_remainingSize;
+  ImageHasher& m_imageHasher;
+};
+
+} // namespace
+
+DownloadSession::DownloadSession(DownloadTransport& transport) :
+  m_transport(transport),
+  m_stopRequested(false),
+  m_nbrOfSkippedBytes(0),
+  m_firstByteReceived(false),
+  m_timeToFirstByte(0) {
+}
+
+void DownloadSession::run() {
+  tr_debug("Waiting for connection");
+  while (! isStopRequested()) {
+    // a download starts with the data sent by a connected host, on a timeout or a stop
+    // request the stop and the connection state are checked again
+    if (! m_transport.waitForData(MBED_CONF_UPDATE_CLIENT_CONNECTION_POLL_INTERVAL) ||
+        isStopRequested() || ! m_transport.connected()) {
+      continue;
+    }
+
+    // initialize internal Flash
+    FlashUpdater flashUpdater;
+    int err = flashUpdater.init();
+    if (0 != err) {
+      tr_error("Init flash failed: %d", err);
+      return;
+    }
+
+    int32_t result = download(flashUpdater);
+    if (result == UC_ERR_NONE) {
+      tr_debug("Downloaded application is valid");
+    }
+    else {
+      tr_error("Download failed: %d", result);
+    }
+
+    flashUpdater.deinit();
+    tr_debug("Waiting for connection");
+  }
+}
+
+int32_t DownloadSession::download(FlashUpdater& flashUpdater) {
+  m_sessionStartTime = Kernel::Clock::now();
+  m_firstByteReceived = false;
+
+  tr_debug(" Header size is %d", SLOT_HEADER_SIZE);  
+  update_client::CandidateApplications candidateApplications(flashUpdater, 
+                                                             MBED_CONF_UPDATE_CLIENT_STORAGE_ADDRESS,
+                                                             MBED_CONF_UPDATE_CLIENT_STORAGE_SIZE,
+                                                             SLOT_HEADER_SIZE,
+                                                             MBED_CONF_UPDATE_CLIENT_STORAGE_LOCATIONS);
+  
+  DownloadJournal downloadJournal(flashUpdater, MBED_CONF_UPDATE_CLIENT_DOWNLOAD_JOURNAL_ADDRESS);
+  uint32_t slotIndex = getSlotForDownload(candidateApplications, downloadJournal);
+
+  tr_debug("Please send the update file");
+  return receiveFirmware(flashUpdater, candidateApplications, downloadJournal, slotIndex);
+}
+
+void DownloadSession::requestStop() {
+  m_stopRequested = true;
+  m_transport.interrupt();
+}
+
+void DownloadSession::clearStopRequest() {
+  // the interrupt of a stop requested while the session was not waiting is still pending
+  m_stopRequested = false;
+  m_transport.clearInterrupt();
+}
+
+bool DownloadSession::isStopRequested() const {
+  return m_stopRequested;
+}
+
+uint32_t DownloadSession::getNbrOfSkippedBytes() const {
+  return m_nbrOfSkippedBytes;
+}
+
+uint32_t DownloadSession::getTimeToFirstByte() const {
+  return m_timeToFirstByte;
+}
+
+uint32_t DownloadSession::receiveBuffer(char* pBuffer, uint32_t size) {
+  // read the data as it is received by the transport, until the buffer is full,
+  // the connection is lost or the session is stopped
+  uint32_t receivedSize = 0;
+  while (receivedSize < size && m_transport.connected()) {
+    uint32_t readSize = m_transport.read((uint8_t*) pBuffer + receivedSize, size - receivedSize);
+    if (readSize == 0) {
+      if (isStopRequested()) {
+        break;
+      }
+      m_transport.waitForData(MBED_CONF_UPDATE_CLIENT_CONNECTION_POLL_INTERVAL);
+      continue;
+    }
+    if (! m_firstByteReceived) {
+      m_firstByteReceived = true;
+      m_timeToFirstByte = (uint32_t) std::chrono::duration_cast<std::chrono::milliseconds>(Kernel::Clock::now() - m_sessionStartTime).count();
+      tr_debug("First byte received after %d ms", m_timeToFirstByte);
+    }
+    receivedSize += readSize;
+  }
+
+  return receivedSize;
+}
+
+uint32_t DownloadSession::getSlotForDownload(CandidateApplications& candidateApplications, DownloadJournal& downloadJournal) {
+  // an interrupted download continues in its slot
+  const uint32_t journalSlotAddress = downloadJournal.getSlotAddress();
+  if (journalSlotAddress != 0) {
+    for (uint32_t slotIndex = 0; slotIndex < candidateApplications.getNbrOfSlots(); slotIndex++) {
+      uint32_t applicationAddress = 0;
+      uint32_t slotSize = 0;
+      if (candidateApplications.getApplicationAddress(slotIndex, applicationAddress, slotSize) == UC_ERR_NONE &&
+          applicationAddress == journalSlotAddress) {
+        tr_debug("Download in progress in slot %d", slotIndex);
+        return slotIndex;
+      }
+    }
+  }
+
+  return candidateApplications.getSlotForCandidate();
+}
+
+int32_t DownloadSession::receiveFirmware(FlashUpdater& flashUpdater, CandidateApplications& candidateApplications,
+                                     DownloadJournal& downloadJournal, uint32_t slotIndex) {
+  uint32_t candidateApplicationAddress = 0;
+  uint32_t slotSize = 0;
+  int32_t result = candidateApplications.getApplicationAddress(slotIndex, candidateApplicationAddress, slotSize);
+  if (result != UC_ERR_NONE) {
+    return result;
+  }
+  update_client::MbedApplication candidateApplication(flashUpdater, candidateApplicationAddress, candidateApplicationAddress + SLOT_HEADER_SIZE);
+  candidateApplication.setVerificationRecord(&candidateApplications.getVerificationRecord());
+
+  // the transfer starts with the application header
+  uint8_t frameType = 0;
+  uint32_t payloadSize = 0;
+  result = receiveFrame(frameType, payloadSize);
+  if (result != UC_ERR_NONE) {
+    return result;
+  }
+  if (frameType != DOWNLOAD_FRAME_HEADER || payloadSize > SLOT_HEADER_SIZE) {
+    tr_error("Expected a header frame (type %d, size %d)", frameType, payloadSize);
+    sendResponse(DOWNLOAD_FRAME_NACK, (uint32_t) UC_ERR_INVALID_FRAME);
+    return UC_ERR_INVALID_FRAME;
+  }
+  // the header area is padded with the erase value
+  uint8_t headerBuffer[SLOT_HEADER_SIZE];
+  memset(headerBuffer, flashUpdater.get_erase_value(), sizeof(headerBuffer));
+  result = receivePayload(headerBuffer, payloadSize);
+  if (result == UC_ERR_NONE) {
+    result = checkFrameCrc();
+  }
+  if (result == UC_ERR_NONE) {
+    result = candidateApplication.parseApplicationHeader(headerBuffer, payloadSize);
+  }
+  if (result != UC_ERR_NONE) {
+    tr_error("Invalid header frame: %d", result);
+    sendResponse(DOWNLOAD_FRAME_NACK, (uint32_t) result);
+    return result;
+  }
+
+  // nothing to transfer if the device already has this image
+  if (hasIdenticalApplication(flashUpdater, candidateApplications, candidateApplication)) {
+    const uint32_t nbrOfSkippedBytes = (uint32_t) candidateApplication.getPayloadSize();
+    m_nbrOfSkippedBytes += nbrOfSkippedBytes;
+    tr_debug("Application already present, skipping %d bytes (%d in total)", nbrOfSkippedBytes, m_nbrOfSkippedBytes);
+    sendResponse(DOWNLOAD_FRAME_SKIP, nbrOfSkippedBytes);
+    return UC_ERR_NONE;
+  }
+
+  // the image must fit in the slot, a compressed payload is stored as received
+  // and the image rebuilt from a delta patch is stored with an uncompressed header
+  const uint64_t firmwareSize = candidateApplication.getFirmwareSize();
+  const uint64_t transferSize = candidateApplication.getPayloadSize();
+  const bool delta = (candidateApplication.getCompression() & COMPRESSION_DELTA) != 0;
+  const uint64_t storedSize = delta ? firmwareSize : transferSize;
+  const uint64_t imageSize = SLOT_HEADER_SIZE + storedSize;
+  tr_debug("Firmware size is %lld (%lld bytes stored)", firmwareSize, storedSize);
+  if (delta) {
+    result = candidateApplication.getInstalledHeader(headerBuffer, SLOT_HEADER_SIZE, flashUpdater.get_erase_value());
+    if (result != UC_ERR_NONE) {
+      sendResponse(DOWNLOAD_FRAME_NACK, (uint32_t) result);
+      return result;
+    }
+  }
+  if (firmwareSize == 0 || imageSize > slotSize) {
+    result = (firmwareSize == 0) ? UC_ERR_FIRMWARE_EMPTY : UC_ERR_FIRMWARE_TOO_LARGE;
+    tr_error("Cannot store firmware of size %lld in slot of size %d", storedSize, slotSize);
+    sendResponse(DOWNLOAD_FRAME_NACK, (uint32_t) result);
+    return result;
+  }
+
+  // an interrupted download of the same image to the same slot is resumed
+  // from the last sector written, a delta patch cannot be resumed
+  uint8_t headerHash[DownloadJournal::HEADER_HASH_SIZE] = { 0 };
+  ImageHasher headerHasher;
+  headerHasher.start();
+  headerHasher.update(headerBuffer, SLOT_HEADER_SIZE);
+  headerHasher.finish(headerHash);
+  uint32_t resumeOffset = delta ? 0 : getResumeOffset(flashUpdater, downloadJournal, candidateApplicationAddress,
+                                                      headerHash, (uint32_t) imageSize);
+  if (resumeOffset == 0) {
+    // the slot is erased below, any progress recorded does not apply anymore
+    result = downloadJournal.clear();
+    if (result != UC_ERR_NONE) {
+      sendResponse(DOWNLOAD_FRAME_NACK, (uint32_t) result);
+      return result;
+    }
+  }
+
+  // write the buffers while the next ones are received, the sectors needed for
+  // the image are erased as the buffers reach them
+  FlashWritePipeline writePipeline(flashUpdater, MBED_CONF_UPDATE_CLIENT_DOWNLOAD_BUFFER_SIZE);
+  const uint32_t bufferSize = writePipeline.getBufferSize();
+  if (bufferSize < SLOT_HEADER_SIZE) {
+    tr_error("Download buffer size %d is smaller than the header", bufferSize);
+    sendResponse(DOWNLOAD_FRAME_NACK, (uint32_t) UC_ERR_WRITE_FAILED);
+    return UC_ERR_WRITE_FAILED;
+  }
+  // the slot is about to be overwritten, its recorded verification does not apply anymore.
+  // The header is written last, once the image is complete and valid, so that the slot
+  // of an interrupted download is never taken for a candidate
+  result = candidateApplications.getVerificationRecord().invalidate(candidateApplicationAddress);
+  if (result == UC_ERR_NONE) {
+    result = writePipeline.start(candidateApplicationAddress + resumeOffset, imageSize - resumeOffset,
+                                 (resumeOffset == 0) ? SLOT_HEADER_SIZE : 0);
+  }
+  if (result != UC_ERR_NONE) {
+    sendResponse(DOWNLOAD_FRAME_NACK, (uint32_t) result);
+    return result;
+  }
+
+  // the header is at the start of the first buffer, the pipeline defers it
+  char* pBuffer = writePipeline.acquireBuffer();
+  uint32_t bufferFill = 0;
+  if (resumeOffset == 0) {
+    memcpy(pBuffer, headerBuffer, SLOT_HEADER_SIZE);
+    bufferFill = SLOT_HEADER_SIZE;
+  }
+
+  // the image is hashed while it is received, so that the candidate can be
+  // validated without reading it back from flash once the download is done.
+  // The hash covers the decompressed image, a compressed payload is decompressed
+  // for hashing only
+  ImageHasher imageHasher;
+  imageHasher.start();
+  Decompressor decompressor;
+  const uint32_t payloadCompression = candidateApplication.getCompression() & ~((uint32_t) COMPRESSION_DELTA);
+  const bool compressed = (payloadCompression != COMPRESSION_NONE);
+  if (compressed) {
+    result = decompressor.start(payloadCompression);
+  }
+
+  // a delta patch is applied to the active application while it is received
+  update_client::MbedApplication activeApplication(flashUpdater, ACTIVE_APPLICATION_HEADER_ADDR, ACTIVE_APPLICATION_ADDR);
+  activeApplication.setVerificationRecord(&candidateApplications.getVerificationRecord());
+  DeltaPatcher deltaPatcher(flashUpdater, activeApplication);
+  PipelineSink pipelineSink(writePipeline, pBuffer, bufferFill, firmwareSize, imageHasher);
+  if (delta && result == UC_ERR_NONE) {
+    result = deltaPatcher.start(pipelineSink);
+  }
+  uint64_t nbrOfBytes = 0;
+
+  // when resuming, the part of the payload already written is hashed from the slot
+  if (resumeOffset > 0 && result == UC_ERR_NONE) {
+    nbrOfBytes = resumeOffset - SLOT_HEADER_SIZE;
+    result = hashStoredPayload(flashUpdater, candidateApplicationAddress + SLOT_HEADER_SIZE, (uint32_t) nbrOfBytes,
+                               (uint8_t*) pBuffer, bufferSize, compressed ? &decompressor : NULL, imageHasher);
+  }
+  uint32_t journalOffset = resumeOffset;
+
+  // the slot is ready, the host can send the image (from the resume offset)
+  if (result != UC_ERR_NONE) {
+    writePipeline.releaseBuffer(pBuffer);
+    writePipeline.finish();
+    sendResponse(DOWNLOAD_FRAME_NACK, (uint32_t) result);
+    return result;
+  }
+  if (resumeOffset > 0) {
+    tr_debug("Resuming download after %lld bytes", nbrOfBytes);
+    sendResponse(DOWNLOAD_FRAME_RESUME, (uint32_t) nbrOfBytes);
+  }
+  else {
+    sendResponse(DOWNLOAD_FRAME_ACK, DOWNLOAD_MAX_DATA_SIZE);
+  }
+
+  while (result == UC_ERR_NONE) {
+    // the download stops between frames, it resumes from the last sector recorded
+    if (isStopRequested()) {
+      tr_debug("Download stopped after %lld bytes", nbrOfBytes);
+      result = UC_ERR_DOWNLOAD_STOPPED;
+      break;
+    }
+    result = receiveFrame(frameType, payloadSize);
+    if (result != UC_ERR_NONE) {
+      break;
+    }
+    if (frameType == DOWNLOAD_FRAME_END && payloadSize == 0) {
+      result = checkFrameCrc();
+      break;
+    }
+    if (frameType != DOWNLOAD_FRAME_DATA || payloadSize > DOWNLOAD_MAX_DATA_SIZE ||
+        nbrOfBytes + payloadSize > transferSize) {
+      tr_error("Unexpected frame (type %d, size %d) after %lld bytes", frameType, payloadSize, nbrOfBytes);
+      result = UC_ERR_INVALID_FRAME;
+      break;
+    }
+
+    // the patch is received in small blocks, the image rebuilt goes to the download buffers
+    if (delta) {
+      uint8_t patchBuffer[DELTA_RECEIVE_SIZE];
+      uint32_t remainingSize = payloadSize;
+      while (remainingSize > 0 && result == UC_ERR_NONE) {
+        uint32_t readSize = (remainingSize < sizeof(patchBuffer)) ? remainingSize : sizeof(patchBuffer);
+        result = receivePayload(patchBuffer, readSize);
+        if (result == UC_ERR_NONE && compressed) {
+          result = decompressor.update(patchBuffer, readSize, deltaPatcher);
+        }
+        else if (result == UC_ERR_NONE) {
+          result = deltaPatcher.write(patchBuffer, readSize);
+        }
+        remainingSize -= readSize;
+        nbrOfBytes += readSize;
+      }
+      if (result == UC_ERR_NONE) {
+        result = checkFrameCrc();
+      }
+      printProgress(nbrOfBytes);
+      continue;
+    }
+
+    // receive the payload directly in the download buffers
+    uint32_t remainingSize = payloadSize;
+    while (remainingSize > 0) {
+      if (pBuffer == NULL) {
+        pBuffer = writePipeline.acquireBuffer();
+        bufferFill = 0;
+      }
+      uint32_t readSize = (remainingSize < bufferSize - bufferFill) ? remainingSize : bufferSize - bufferFill;
+      result = receivePayload((uint8_t*) pBuffer + bufferFill, readSize);
+      if (result != UC_ERR_NONE) {
+        break;
+      }
+      if (compressed) {
+        result = decompressor.update((const uint8_t*) pBuffer + bufferFill, readSize, imageHasher);
+      }
+      else {
+        imageHasher.update((const uint8_t*) pBuffer + bufferFill, readSize);
+      }
+      if (result != UC_ERR_NONE) {
+        tr_error("Cannot decompress the payload: %d", result);
+        break;
+      }
+      bufferFill += readSize;
+      remainingSize -= readSize;
+      nbrOfBytes += readSize;
+
+      // write the buffer to the flash, while the next one is received
+      if (bufferFill == bufferSize) {
+        result = writePipeline.submitBuffer(pBuffer, bufferFill);
+        pBuffer = NULL;
+        if (result != UC_ERR_NONE) {
+          tr_error("Cannot write to flash: %d", result);
+          break;
+        }
+      }
+    }
+    if (result == UC_ERR_NONE) {
+      result = checkFrameCrc();
+    }
+    if (result == UC_ERR_NONE) {
+      recordProgress(flashUpdater, downloadJournal, candidateApplicationAddress, headerHash,
+                     candidateApplicationAddress + resumeOffset + writePipeline.getNbrOfWrittenBytes(), journalOffset);
+    }
+    printProgress(nbrOfBytes);
+  }
+
+  // write the end of the image, nothing is written past it
+  if (pBuffer != NULL) {
+    if (result == UC_ERR_NONE) {
+      result = writePipeline.submitBuffer(pBuffer, bufferFill);
+    }
+    else {
+      writePipeline.releaseBuffer(pBuffer);
+    }
+  }
+  int32_t writeResult = writePipeline.finish();
+  if (result == UC_ERR_NONE) {
+    result = writeResult;
+  }
+  // the reception also ends when the thread is stopped
+  if (result == UC_ERR_TRANSFER_INCOMPLETE && isStopRequested()) {
+    result = UC_ERR_DOWNLOAD_STOPPED;
+  }
+  const bool interrupted = (result == UC_ERR_TRANSFER_INCOMPLETE || result == UC_ERR_DOWNLOAD_STOPPED);
+  // the buffers that were in flight are now written, they are part of the progress
+  if (interrupted && writeResult == UC_ERR_NONE && ! delta) {
+    recordProgress(flashUpdater, downloadJournal, candidateApplicationAddress, headerHash,
+                   candidateApplicationAddress + resumeOffset + writePipeline.getNbrOfWrittenBytes(), journalOffset);
+  }
+  tr_debug("Nbr of bytes received %lld", nbrOfBytes);
+
+  // validate the downloaded application with the hash calculated on the fly
+  if (result == UC_ERR_NONE && nbrOfBytes != transferSize) {
+    tr_error("Incomplete download (%lld bytes of %lld)", nbrOfBytes, transferSize);
+    result = UC_ERR_TRANSFER_INCOMPLETE;
+  }
+  if (result == UC_ERR_NONE && delta) {
+    result = deltaPatcher.finish();
+    if (result == UC_ERR_NONE && pipelineSink.getRemainingSize() != 0) {
+      tr_error("Patched %lld bytes instead of %lld", deltaPatcher.getNbrOfPatchedBytes(), firmwareSize);
+      result = UC_ERR_INVALID_PATCH;
+    }
+  }
+  if (result == UC_ERR_NONE && compressed && ! delta && decompressor.getNbrOfDecompressedBytes() != firmwareSize) {
+    tr_error("Decompressed %lld bytes instead of %lld", decompressor.getNbrOfDecompressedBytes(), firmwareSize);
+    result = UC_ERR_DECOMPRESSION_FAILED;
+  }
+  // the image is compared with the header received, the header is then written and
+  // the hash checked against it, which records the verification of the candidate
+  uint8_t hash[ImageHasher::HASH_SIZE] = { 0 };
+  if (result == UC_ERR_NONE) {
+    imageHasher.finish(hash);
+    if (! candidateApplication.hasImage(firmwareSize, hash)) {
+      tr_error("Downloaded application does not match its header");
+      result = UC_ERR_HASH_INVALID;
+    }
+  }
+  if (result == UC_ERR_NONE) {
+    result = (resumeOffset == 0) ? writePipeline.writeDeferred() :
+             flashUpdater.programRegion(candidateApplicationAddress, headerBuffer, SLOT_HEADER_SIZE);
+    if (result != UC_ERR_NONE) {
+      tr_error("Cannot write the application header: %d", result);
+    }
+  }
+  if (result == UC_ERR_NONE) {
+    result = candidateApplication.checkApplicationHash(hash);
+  }
+
+  // an interrupted transfer can be resumed, otherwise the download is over
+  if (! interrupted) {
+    downloadJournal.clear();
+  }
+
+  if (result == UC_ERR_NONE) {
+    sendResponse(DOWNLOAD_FRAME_ACK, (uint32_t) nbrOfBytes);
+  }
+  else {
+    sendResponse(DOWNLOAD_FRAME_NACK, (uint32_t) result);
+  }
+
+  return result;
+}
+
+uint32_t DownloadSession::getResumeOffset(FlashUpdater& flashUpdater, DownloadJournal& downloadJournal, uint32_t slotAddress,
+                                      const uint8_t* pHeaderHash, uint32_t imageSize) {
+  const uint32_t resumeOffset = downloadJournal.getResumeOffset(slotAddress, pHeaderHash);
+  if (resumeOffset == 0) {
+    return 0;
+  }
+  // the offset must be a sector boundary within the image, after the header
+  if (resumeOffset <= SLOT_HEADER_SIZE || resumeOffset >= imageSize ||
+      flashUpdater.alignAddressToSector(slotAddress + resumeOffset, true) != slotAddress + resumeOffset) {
+    tr_error("Invalid resume offset 0x%08x", resumeOffset);
+    return 0;
+  }
+  // the header is written last: when resuming, it is written alone, which needs it to fill
+  // whole flash pages, and the slot must not have been written since (its header is erased)
+  if ((SLOT_HEADER_SIZE % flashUpdater.get_page_size()) != 0) {
+    return 0;
+  }
+  uint8_t slotHeader[SLOT_HEADER_SIZE];
+  if (flashUpdater.read(slotHeader, slotAddress, SLOT_HEADER_SIZE) != 0) {
+    return 0;
+  }
+  for (uint32_t index = 0; index < SLOT_HEADER_SIZE; index++) {
+    if (slotHeader[index] != flashUpdater.get_erase_value()) {
+      return 0;
+    }
+  }
+
+  return resumeOffset;
+}
+
+int32_t DownloadSession::hashStoredPayload(FlashUpdater& flashUpdater, uint32_t address, uint32_t size,
+                                       uint8_t* pBuffer, uint32_t bufferSize,
+                                       Decompressor* pDecompressor, ImageHasher& imageHasher) {
+  int32_t result = UC_ERR_NONE;
+  while (size > 0 && result == UC_ERR_NONE) {
+    uint32_t readSize = size;
+    const uint8_t* pData = flashUpdater.readRegion(address, readSize, pBuffer, bufferSize);
+    if (pData == NULL) {
+      tr_error("Error while reading flash at address 0x%08x", address);
+      return UC_ERR_READING_FLASH;
+    }
+    if (pDecompressor != NULL) {
+      result = pDecompressor->update(pData, readSize, imageHasher);
+    }
+    else {
+      imageHasher.update(pData, readSize);
+    }
+    address += readSize;
+    size -= readSize;
+  }
+
+  return result;
+}
+
+void DownloadSession::recordProgress(FlashUpdater& flashUpdater, DownloadJournal& downloadJournal, uint32_t slotAddress,
+                                 const uint8_t* pHeaderHash, uint32_t writtenAddress, uint32_t& journalOffset) {
+  // the sectors before the one being written are programmed and verified
+  const uint32_t completedOffset = flashUpdater.alignAddressToSector(writtenAddress, true) - slotAddress;
+  if (downloadJournal.isEnabled() && completedOffset > journalOffset) {
+    if (downloadJournal.setProgress(slotAddress, pHeaderHash, completedOffset) == UC_ERR_NONE) {
+      journalOffset = completedOffset;
+    }
+  }
+}
+
+bool DownloadSession::hasIdenticalApplication(FlashUpdater& flashUpdater, CandidateApplications& candidateApplications,
+                                          MbedApplication& application) {
+  // the active application is running, so its header is enough
+  update_client::MbedApplication activeApplication(flashUpdater, ACTIVE_APPLICATION_HEADER_ADDR, ACTIVE_APPLICATION_ADDR);
+  if (application.hasSameImage(activeApplication)) {
+    tr_debug("Application is the active application");
+    return true;
+  }
+
+  uint32_t slotIndex = 0;
+  if (candidateApplications.findApplication(application, slotIndex)) {
+    tr_debug("Application is the candidate application at slot %d", slotIndex);
+    return true;
+  }
+
+  return false;
+}
+
+int32_t DownloadSession::receiveFrame(uint8_t& frameType, uint32_t& payloadSize) {
+  uint8_t prefix[DOWNLOAD_FRAME_PREFIX_SIZE] = { 0 };
+  if (receiveBuffer((char*) prefix, sizeof(prefix)) != sizeof(prefix)) {
+    return UC_ERR_TRANSFER_INCOMPLETE;
+  }
+  frameType = prefix[0];
+  payloadSize = (prefix[1] << 8) | prefix[2];
+
+  // the CRC covers the prefix and the payload
+  m_frameCrc.reset();
+  m_frameCrc.update(prefix, sizeof(prefix));
+
+  return UC_ERR_NONE;
+}
+
+int32_t DownloadSession::receivePayload(uint8_t* pBuffer, uint32_t size) {
+  if (receiveBuffer((char*) pBuffer, size) != size) {
+    return UC_ERR_TRANSFER_INCOMPLETE;
+  }
+  m_frameCrc.update(pBuffer, size);
+
+  return UC_ERR_NONE;
+}
+
+int32_t DownloadSession::checkFrameCrc() {
+  uint8_t crcBuffer[DOWNLOAD_FRAME_CRC_SIZE] = { 0 };
+  if (receiveBuffer((char*) crcBuffer, sizeof(crcBuffer)) != sizeof(crcBuffer)) {
+    return UC_ERR_TRANSFER_INCOMPLETE;
+  }
+  uint32_t crc = ((uint32_t) crcBuffer[0] << 24) | (crcBuffer[1] << 16) | (crcBuffer[2] << 8) | crcBuffer[3];
+  if (crc != m_frameCrc.getValue()) {
+    tr_error("Invalid frame CRC");
+    return UC_ERR_INVALID_FRAME;
+  }
+
+  return UC_ERR_NONE;
+}
+
+void DownloadSession::sendResponse(uint8_t frameType, uint32_t value) {
+  uint8_t frame[DOWNLOAD_FRAME_PREFIX_SIZE + DOWNLOAD_RESPONSE_SIZE + DOWNLOAD_FRAME_CRC_SIZE] = { 0 };
+  frame[0] = frameType;
+  frame[1] = 0;
+  frame[2] = DOWNLOAD_RESPONSE_SIZE;
+  frame[3] = value >> 24;
+  frame[4] = value >> 16;
+  frame[5] = value >> 8;
+  frame[6] = value;
+  uint32_t crc = Crc32::compute(frame, DOWNLOAD_FRAME_PREFIX_SIZE + DOWNLOAD_RESPONSE_SIZE);
+  frame[7] = crc >> 24;
+  frame[8] = crc >> 16;
+  frame[9] = crc >> 8;
+  frame[10] = crc;
+
+  if (m_transport.connected() && ! m_transport.write(frame, sizeof(frame))) {
+    tr_error("Cannot send the response");
+  }
+}
+
+#endif
+
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#if defined(UPDATE_CLIENT_FLASH_SIMULATOR)
+#include "HostRtos.h"
+#else
+#include "mbed.h"
+#endif
+
+#include "CandidateApplications.h"
+#include "Crc32.h"
+#include "Decompressor.h"
+#include "DownloadJournal.h"
+#include "DownloadTransport.h"
+#include "FlashUpdater.h"
+#include "ImageHasher.h"
+#include "MbedApplication.h"
+
+// interval (in ms) at which the connection state is checked while waiting for data,
+// it bounds the time taken by stopping a session when no data is received
+#ifndef MBED_CONF_UPDATE_CLIENT_CONNECTION_POLL_INTERVAL
+#define MBED_CONF_UPDATE_CLIENT_CONNECTION_POLL_INTERVAL 100
+#endif
+
+namespace update_client {
+
+#if defined(UPDATE_DOWNLOAD)
+
+// DownloadSession runs the download protocol (see DownloadProtocol.h) over a
+// transport: it chooses the slot for the candidate, writes the image received
+// to the flash through the write pipeline, hashes it on the fly and records the
+// progress in the download journal. The transport only moves bytes, so the same
+// session runs over USB, a UART or, on the host, a socket.
+
+class DownloadSession {
+public:
+  explicit DownloadSession(DownloadTransport& transport);
+
+  // waits for the host and receives update files until a stop is requested
+  void run();
+  // receives one update file in the slot for the candidate
+  int32_t download(FlashUpdater& flashUpdater);
+  // makes run() and download() return after the frame being received, from any thread
+  void requestStop();
+  // to be called before running the session again after a stop
+  void clearStopRequest();
+  bool isStopRequested() const;
+
+  // number of bytes that were not transferred because the device already had the application
+  uint32_t getNbrOfSkippedBytes() const;
+  // time from the start of the last download to its first byte received, in ms
+  uint32_t getTimeToFirstByte() const;
+
+  // size of the application header area in the candidate slots
+  static const uint32_t SLOT_HEADER_SIZE = 0x80;
+
+private:
+  // runs the download protocol for writing the candidate application
+  int32_t receiveFirmware(FlashUpdater& flashUpdater, CandidateApplications& candidateApplications,
+                          DownloadJournal& downloadJournal, uint32_t slotIndex);
+  // returns the slot of the interrupted download, if any, or the slot for a new candidate
+  uint32_t getSlotForDownload(CandidateApplications& candidateApplications, DownloadJournal& downloadJournal);
+  // checks whether the active application or a valid candidate is the same as the given one
+  bool hasIdenticalApplication(FlashUpdater& flashUpdater, CandidateApplications& candidateApplications,
+                               MbedApplication& application);
+  // returns the offset in the slot from which an interrupted download of the image with
+  // the given header (hash) can be resumed, 0 if it must start over
+  uint32_t getResumeOffset(FlashUpdater& flashUpdater, DownloadJournal& downloadJournal, uint32_t slotAddress,
+                           const uint8_t* pHeaderHash, uint32_t imageSize);
+  // hashes (and decompresses if needed) the payload already stored in the slot
+  int32_t hashStoredPayload(FlashUpdater& flashUpdater, uint32_t address, uint32_t size,
+                            uint8_t* pBuffer, uint32_t bufferSize,
+                            Decompressor* pDecompressor, ImageHasher& imageHasher);
+  // records the sectors of the slot completely written in the download journal
+  void recordProgress(FlashUpdater& flashUpdater, DownloadJournal& downloadJournal, uint32_t slotAddress,
+                      const uint8_t* pHeaderHash, uint32_t writtenAddress, uint32_t& journalOffset);
+  // receives up to size bytes, returns the number of bytes received
+  uint32_t receiveBuffer(char* pBuffer, uint32_t size);
+  // frame reception: prefix, payload (possibly in several parts) and CRC
+  int32_t receiveFrame(uint8_t& frameType, uint32_t& payloadSize);
+  int32_t receivePayload(uint8_t* pBuffer, uint32_t size);
+  int32_t checkFrameCrc();
+  // sends an ACK or NACK frame with a 32 bit value
+  void sendResponse(uint8_t frameType, uint32_t value);
+
+  // size of the blocks in which a delta patch is received
+  static const uint32_t DELTA_RECEIVE_SIZE = 256;
+
+  // data members
+  DownloadTransport& m_transport;
+  volatile bool m_stopRequested;
+  // CRC of the frame being received
+  Crc32 m_frameCrc;
+  // written by the session thread only
+  volatile uint32_t m_nbrOfSkippedBytes;
+  // start of the download, for measuring the time to the first byte
+  Kernel::Clock::time_point m_sessionStartTime;
+  bool m_firstByteReceived;
+  volatile uint32_t m_timeToFirstByte;
+};
+
+#endif
+
+} // namespace
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstdint>
+
+namespace update_client {
+
+// DownloadTransport is the link on which a DownloadSession talks to the host.
+// Reads never block: the session waits for data with waitForData(), which can
+// be interrupted when the session is stopped from another thread.
+
+class DownloadTransport {
+public:
+  virtual ~DownloadTransport() {}
+
+  // whether the host is connected (a link without connection state is always connected)
+  virtual bool connected() = 0;
+  // waits at most timeout ms for data to be received, returns false on timeout or when interrupted
+  virtual bool waitForData(uint32_t timeout) = 0;
+  // reads up to size bytes of the data received, returns the number of bytes read
+  virtual uint32_t read(uint8_t* pBuffer, uint32_t size) = 0;
+  // writes all the data, returns false if it cannot be sent
+  virtual bool write(const uint8_t* pData, uint32_t size) = 0;
+  // makes a pending (or the next) waitForData() return, can be called from any thread
+  virtual void interrupt() = 0;
+  // forgets an interrupt that did not end a wait, e.g. before a stopped session runs again
+  virtual void clearInterrupt() = 0;
+};
+
+} // namespace
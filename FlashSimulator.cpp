@@ -0,0 +1,187 @@
+#include "FlashSimulator.h"
+
+namespace update_client {
+
+#if defined(UPDATE_CLIENT_FLASH_SIMULATOR)
+
+// sector map of a STM32F4 1 MB bank (non-uniform sectors)
+static const SectorRegion DEFAULT_SECTOR_REGIONS[] = {
+  { 16 * 1024, 4 },
+  { 64 * 1024, 1 },
+  { 128 * 1024, 7 }
+};
+
+static const FlashSimulatorConfig DEFAULT_CONFIG = {
+  0x08000000,                   // flashStart
+  8,                            // pageSize
+  0xFF,                         // eraseValue
+  DEFAULT_SECTOR_REGIONS,
+  sizeof(DEFAULT_SECTOR_REGIONS) / sizeof(DEFAULT_SECTOR_REGIONS[0]),
+  { 2, 8000, 32, 30 }           // timing: overhead, erase/KB, program/page, read/byte
+};
+
+FlashSimulator::FlashSimulator() :
+  m_flashStart(0),
+  m_flashSize(0),
+  m_pageSize(0),
+  m_eraseValue(0xFF),
+  m_initialized(false) {
+  configure(DEFAULT_CONFIG);
+}
+
+void FlashSimulator::configure(const FlashSimulatorConfig& config) {
+  m_sectorRegions.assign(config.pSectorRegions, config.pSectorRegions + config.nbrOfSectorRegions);
+  m_flashStart = config.flashStart;
+  m_pageSize = config.pageSize;
+  m_eraseValue = config.eraseValue;
+  m_timing = config.timing;
+
+  m_flashSize = 0;
+  for (const SectorRegion& region : m_sectorRegions) {
+    m_flashSize += region.sectorSize * region.nbrOfSectors;
+  }
+  // a blank part reads as erased
+  m_memory.assign(m_flashSize, m_eraseValue);
+  resetStats();
+}
+
+int FlashSimulator::init() {
+  m_initialized = true;
+  return 0;
+}
+
+int FlashSimulator::deinit() {
+  m_initialized = false;
+  return 0;
+}
+
+int FlashSimulator::read(void* buffer, uint32_t addr, uint32_t size) {
+  if (!isInFlash(addr, size)) {
+    return -1;
+  }
+  memcpy(buffer, &m_memory[addr - m_flashStart], size);
+
+  m_stats.nbrOfReads++;
+  m_stats.bytesRead += size;
+  m_stats.elapsedUs += m_timing.callOverheadUs + ((uint64_t) size * m_timing.readNsPerByte) / 1000;
+  return 0;
+}
+
+int FlashSimulator::program(const void* buffer, uint32_t addr, uint32_t size) {
+  // same constraints as FlashIAP: page aligned address and size, within flash
+  if (!m_initialized || !isInFlash(addr, size) ||
+      (addr % m_pageSize) != 0 || (size % m_pageSize) != 0) {
+    return -1;
+  }
+
+  // NOR flash semantics: programming can only move bits away from the erased
+  // value, so that programming a non-erased location is visible on read-back
+  const uint8_t* pData = static_cast<const uint8_t*>(buffer);
+  uint8_t* pMemory = &m_memory[addr - m_flashStart];
+  for (uint32_t i = 0; i < size; i++) {
+    if (m_eraseValue == 0xFF) {
+      pMemory[i] &= pData[i];
+    }
+    else {
+      pMemory[i] |= pData[i];
+    }
+  }
+
+  m_stats.nbrOfPrograms++;
+  m_stats.bytesProgrammed += size;
+  m_stats.elapsedUs += m_timing.callOverheadUs + (uint64_t) (size / m_pageSize) * m_timing.programUsPerPage;
+  return 0;
+}
+
+int FlashSimulator::erase(uint32_t addr, uint32_t size) {
+  // same constraints as FlashIAP: sector aligned start and end, within flash
+  if (!m_initialized || !isInFlash(addr, size) ||
+      !isSectorAligned(addr) || !isSectorAligned(addr + size)) {
+    return -1;
+  }
+
+  memset(&m_memory[addr - m_flashStart], m_eraseValue, size);
+
+  m_stats.nbrOfErases++;
+  m_stats.bytesErased += size;
+  m_stats.elapsedUs += m_timing.callOverheadUs + (uint64_t) (size / 1024) * m_timing.eraseUsPerKB;
+  return 0;
+}
+
+uint32_t FlashSimulator::get_page_size() const {
+  return m_pageSize;
+}
+
+uint32_t FlashSimulator::get_sector_size(uint32_t addr) const {
+  // same as FlashIAP: addresses outside of the flash have no sector
+  if (addr < m_flashStart) {
+    return 0;
+  }
+  uint32_t regionStart = m_flashStart;
+  for (const SectorRegion& region : m_sectorRegions) {
+    uint32_t regionEnd = regionStart + region.sectorSize * region.nbrOfSectors;
+    if (addr < regionEnd) {
+      return region.sectorSize;
+    }
+    regionStart = regionEnd;
+  }
+  return 0;
+}
+
+uint32_t FlashSimulator::get_flash_start() const {
+  return m_flashStart;
+}
+
+uint32_t FlashSimulator::get_flash_size() const {
+  return m_flashSize;
+}
+
+uint8_t FlashSimulator::get_erase_value() const {
+  return m_eraseValue;
+}
+
+const FlashSimulatorStats& FlashSimulator::getStats() const {
+  return m_stats;
+}
+
+void FlashSimulator::resetStats() {
+  memset(&m_stats, 0, sizeof(m_stats));
+}
+
+const uint8_t* FlashSimulator::mapMemory(uint32_t addr, uint32_t size) {
+  if (!isInFlash(addr, size)) {
+    return NULL;
+  }
+
+  // no call overhead, the bus is read directly
+  m_stats.nbrOfReads++;
+  m_stats.bytesRead += size;
+  m_stats.elapsedUs += ((uint64_t) size * m_timing.readNsPerByte) / 1000;
+  return &m_memory[addr - m_flashStart];
+}
+
+uint8_t* FlashSimulator::getMemory() {
+  return m_memory.data();
+}
+
+bool FlashSimulator::isInFlash(uint32_t addr, uint32_t size) const {
+  return addr >= m_flashStart &&
+         size <= m_flashSize &&
+         (addr - m_flashStart) <= (m_flashSize - size);
+}
+
+bool FlashSimulator::isSectorAligned(uint32_t addr) const {
+  uint32_t sectorAddress = m_flashStart;
+  for (const SectorRegion& region : m_sectorRegions) {
+    uint32_t regionEnd = sectorAddress + region.sectorSize * region.nbrOfSectors;
+    if (addr <= regionEnd) {
+      return ((addr - sectorAddress) % region.sectorSize) == 0;
+    }
+    sectorAddress = regionEnd;
+  }
+  return false;
+}
+
+#endif // UPDATE_CLIENT_FLASH_SIMULATOR
+
+} // namespace
@@ -0,0 +1,126 @@
+#pragma once
+
+#if defined(UPDATE_CLIENT_FLASH_SIMULATOR)
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+// host builds do not have mbed-trace, make the trace macros no-ops
+#if !MBED_CONF_MBED_TRACE_ENABLE
+#ifndef tr_debug
+#define tr_debug(...)
+#endif
+#ifndef tr_info
+#define tr_info(...)
+#endif
+#ifndef tr_warn
+#define tr_warn(...)
+#endif
+#ifndef tr_error
+#define tr_error(...)
+#endif
+#ifndef tr_err
+#define tr_err(...)
+#endif
+#endif // MBED_CONF_MBED_TRACE_ENABLE
+
+namespace update_client {
+
+// FlashSimulator is a host-side stand-in for mbed::FlashIAP. It exposes the same
+// API (so that FlashUpdater can derive from it when UPDATE_CLIENT_FLASH_SIMULATOR
+// is defined), keeps the flash content in RAM and models the cost of each operation.
+// Time is not spent for real but accumulated on a simulated clock, so that update
+// paths can be timed deterministically off-target.
+
+// a run of consecutive sectors of the same size
+struct SectorRegion {
+  uint32_t sectorSize;
+  uint32_t nbrOfSectors;
+};
+
+// cost of flash operations on the simulated clock
+struct FlashTiming {
+  // fixed cost of every call to read, program or erase
+  uint32_t callOverheadUs;
+  // erase cost per KB of erased sector
+  uint32_t eraseUsPerKB;
+  // program cost per flash page
+  uint32_t programUsPerPage;
+  // read cost per byte
+  uint32_t readNsPerByte;
+};
+
+struct FlashSimulatorConfig {
+  uint32_t flashStart;
+  uint32_t pageSize;
+  uint8_t eraseValue;
+  // sector map, in address order starting at flashStart
+  const SectorRegion* pSectorRegions;
+  uint32_t nbrOfSectorRegions;
+  FlashTiming timing;
+};
+
+struct FlashSimulatorStats {
+  uint32_t nbrOfErases;
+  uint32_t nbrOfPrograms;
+  uint32_t nbrOfReads;
+  uint64_t bytesErased;
+  uint64_t bytesProgrammed;
+  uint64_t bytesRead;
+  // simulated time spent in flash operations
+  uint64_t elapsedUs;
+};
+
+class FlashSimulator {
+public:
+  // the default geometry is the one of a STM32F4 1 MB bank
+  FlashSimulator();
+
+  // change the geometry and the timing, must be called before init()
+  void configure(const FlashSimulatorConfig& config);
+
+  // FlashIAP API
+  int init();
+  int deinit();
+  int read(void* buffer, uint32_t addr, uint32_t size);
+  int program(const void* buffer, uint32_t addr, uint32_t size);
+  int erase(uint32_t addr, uint32_t size);
+  uint32_t get_page_size() const;
+  uint32_t get_sector_size(uint32_t addr) const;
+  uint32_t get_flash_start() const;
+  uint32_t get_flash_size() const;
+  uint8_t get_erase_value() const;
+
+  // statistics on the operations executed since the last reset
+  const FlashSimulatorStats& getStats() const;
+  void resetStats();
+
+  // simulates reading memory mapped flash: returns a pointer to the simulated
+  // flash content (NULL if outside of the flash) and accounts for it as a read
+  const uint8_t* mapMemory(uint32_t addr, uint32_t size);
+
+  // direct access to the simulated flash content (e.g. for preloading images),
+  // does not count as flash operations
+  uint8_t* getMemory();
+
+private:
+  bool isInFlash(uint32_t addr, uint32_t size) const;
+  bool isSectorAligned(uint32_t addr) const;
+
+  // data members
+  std::vector<SectorRegion> m_sectorRegions;
+  uint32_t m_flashStart;
+  uint32_t m_flashSize;
+  uint32_t m_pageSize;
+  uint8_t m_eraseValue;
+  FlashTiming m_timing;
+  FlashSimulatorStats m_stats;
+  std::vector<uint8_t> m_memory;
+  bool m_initialized;
+};
+
+} // namespace
+
+#endif // UPDATE_CLIENT_FLASH_SIMULATOR
@@ -1,4 +1,6 @@
 #include "FlashUpdater.h"
+#include "ImageHasher.h"
+#include "StaticSlotLayout.h"
 #include "UCErrorCodes.h"
 
 #if MBED_CONF_MBED_TRACE_ENABLE
@@ -8,8 +10,24 @@
 
 namespace update_client {
   
-FlashUpdater::FlashUpdater() {
+FlashUpdater::FlashUpdater() :
+  m_nbrOfSectorRuns(0),
+  m_flashStartAddress(0),
+  m_flashEndAddress(0) {
+  resetWriteStats();
+#if MBED_CONF_UPDATE_CLIENT_FLASH_INSTRUMENTATION
+  resetOperationStats();
+#endif
+}
+
+int FlashUpdater::init() {
+  int err = FlashBackend::init();
+  if (0 != err) {
+    return err;
+  }
+  buildSectorIndex();
 
+  return err;
 }
 
 int32_t FlashUpdater::readPage(uint32_t pageSize, char* readPageBuffer, uint32_t& addr) {
@@ -25,89 +43,593 @@ int32_t FlashUpdater::readPage(uint32_t pageSize, char* readPageBuffer, uint32_t
   return err;
 }  
 
+bool FlashUpdater::isDirectReadable(uint32_t address, uint32_t size) const {
+#if MBED_CONF_UPDATE_CLIENT_DIRECT_READ
+  // internal flash is memory mapped
+  uint32_t flashStartAddress = get_flash_start();
+  uint32_t flashSize = get_flash_size();
+  return address >= flashStartAddress &&
+         size <= flashSize &&
+         (address - flashStartAddress) <= (flashSize - size);
+#else
+  return false;
+#endif
+}
+
+const uint8_t* FlashUpdater::readRegion(uint32_t address, uint32_t& size, uint8_t* pBuffer, uint32_t bufferSize) {
+  if (isDirectReadable(address, size)) {
+#if defined(UPDATE_CLIENT_FLASH_SIMULATOR)
+    return mapMemory(address, size);
+#else
+    return reinterpret_cast<const uint8_t*>(address);
+#endif
+  }
+
+  // buffered read
+  if (pBuffer == NULL || bufferSize == 0) {
+    return NULL;
+  }
+  if (size > bufferSize) {
+    size = bufferSize;
+  }
+  int32_t err = read(pBuffer, address, size);
+  if (0 != err) {
+    tr_error("Flash read failed: %d", err);
+    return NULL;
+  }
+
+  return pBuffer;
+}
+
 int32_t FlashUpdater::writePage(uint32_t pageSize, char* writePageBuffer, char* readPageBuffer, 
                                 uint32_t& addr, bool& sectorErased, size_t& pagesFlashed, uint32_t& nextSectorAddress) {
   //tr_debug(" Writing page of size %d at address 0x%08x", pageSize, addr);
+#if MBED_CONF_MBED_TRACE_ENABLE
+  //if (pagesFlashed == 0) {
+  //  tr_debug("%01x %01x %01x %01x %01x %01x %01x %01x", writePageBuffer[0], writePageBuffer[1], writePageBuffer[2],
+  //           writePageBuffer[3], writePageBuffer[4], writePageBuffer[5], writePageBuffer[6], writePageBuffer[7]);
+  //}
+#endif
+  int32_t err = writeRegion(addr, (const uint8_t*) writePageBuffer, pageSize, sectorErased, nextSectorAddress,
+                            (uint8_t*) readPageBuffer, pageSize);
+  if (0 != err) {
+    return err;
+  }
+
+  // update next sector
+  pagesFlashed++;
+  if (addr >= nextSectorAddress) {
+    nextSectorAddress = addr + getSectorSize(addr);
+    sectorErased = false;
+  }
+
+  return err;
+}
+
+int32_t FlashUpdater::writeRegion(uint32_t& addr, const uint8_t* pData, uint32_t size,
+                                  bool& sectorErased, uint32_t& nextSectorAddress, uint8_t* pBuffer, uint32_t bufferSize) {
   int32_t err = UC_ERR_NONE;
 
-  // Erase this page if it hasn't been erased
-  if (!sectorErased) {
-    // tr_debug("Erasing sector of size %d at address 0x%08x", get_sector_size(addr), addr);
-    err = erase(addr, get_sector_size(addr));
+  // data larger than a page of the flash may extend over the next sectors,
+  // it is written sector by sector
+  uint32_t offset = 0;
+  while (offset < size) {
+    if (addr >= nextSectorAddress) {
+      uint32_t sectorSize = getSectorSize(addr);
+      if (sectorSize == 0) {
+        tr_error("Page at address 0x%08x exceeds the flash", addr);
+        return UC_ERR_WRITE_FAILED;
+      }
+      nextSectorAddress = addr + sectorSize;
+      sectorErased = false;
+    }
+    uint32_t chunkSize = (size - offset < nextSectorAddress - addr) ? size - offset : nextSectorAddress - addr;
+    const uint8_t* pChunk = pData + offset;
+
+    // Erase this sector if it hasn't been erased
+    if (!sectorErased) {
+      const uint32_t sectorAddress = alignAddressToSector(addr, true);
+      const uint32_t sectorSize = nextSectorAddress - sectorAddress;
+#if MBED_CONF_UPDATE_CLIENT_DIFFERENTIAL_WRITE
+      // a sector that is written completely and already holds the data is left as is
+      if (sectorAddress == addr && chunkSize == sectorSize &&
+          isEqual(addr, pChunk, chunkSize, pBuffer, bufferSize)) {
+        m_writeStats.nbrOfSkippedErases++;
+        m_writeStats.nbrOfSkippedPrograms++;
+        m_writeStats.bytesSkipped += chunkSize;
+        addr += chunkSize;
+        offset += chunkSize;
+        continue;
+      }
+#endif
+      err = eraseSector(sectorAddress, sectorSize, pBuffer, bufferSize);
+      if (0 != err) {
+        return err;
+      }
+      sectorErased = true;
+    }
+
+    // program and check that was written is correct
+    err = programChunk(addr, pChunk, chunkSize, true, pBuffer, bufferSize);
+    if (0 != err) {
+      return err;
+    }
+
+    addr += chunkSize;
+    offset += chunkSize;
+  }
+
+  return err;
+}
+
+int32_t FlashUpdater::eraseRange(uint32_t address, uint32_t size) {
+  if (alignAddressToSector(address, true) != address) {
+    tr_error("Erase address 0x%08x is not sector aligned", address);
+    return UC_ERR_WRITE_FAILED;
+  }
+
+  // the end of the range is rounded up to the end of its sector
+  uint32_t endAddress = alignAddressToSector(address + size, false);
+  tr_debug("Erasing from address 0x%08x to 0x%08x", address, endAddress);
+  uint8_t readBuffer[COMPARE_BUFFER_SIZE];
+  while (address < endAddress) {
+    uint32_t sectorSize = getSectorSize(address);
+    int32_t err = eraseSector(address, sectorSize, readBuffer, sizeof(readBuffer));
     if (0 != err) {
-      tr_error("Flash erase failed: %d", err);
       return err;
     }
-    sectorErased = true;
+    address += sectorSize;
   }
 
+  return UC_ERR_NONE;
+}
+
+int32_t FlashUpdater::copyRegion(uint32_t sourceAddress, uint32_t destAddress, uint32_t size,
+                                 uint8_t* pBuffer, uint32_t bufferSize, bool verifyChunks,
+                                 uint32_t deferredSize, ImageHasher* pImageHasher) {
+  const uint32_t pageSize = get_page_size();
+  // chunks are programmed in full pages
+  bufferSize = (bufferSize / pageSize) * pageSize;
+  if (pBuffer == NULL || bufferSize == 0 || alignAddressToSector(destAddress, true) != destAddress ||
+      (deferredSize % pageSize) != 0 || deferredSize > size || deferredSize > getSectorSize(destAddress)) {
+    tr_error("Cannot copy to address 0x%08x (buffer of %d bytes)", destAddress, bufferSize);
+    return UC_ERR_WRITE_FAILED;
+  }
+  uint8_t compareBuffer[COMPARE_BUFFER_SIZE];
+
+  // offset of the data to copy in the current sector, only the first sector has deferred bytes
+  uint32_t sectorOffset = deferredSize;
+  while (size > 0) {
+    const uint32_t sectorSize = getSectorSize(destAddress);
+    if (sectorSize == 0) {
+      tr_error("Copy at address 0x%08x exceeds the flash", destAddress);
+      return UC_ERR_WRITE_FAILED;
+    }
+    // part of the data copied in this sector
+    const uint32_t sectorCopySize = (size < sectorSize) ? size : sectorSize;
+
+#if MBED_CONF_UPDATE_CLIENT_DIFFERENTIAL_WRITE
+    // a sector that already holds the data (deferred bytes included) is left as is,
+    // the comparison only needs the source to be directly readable
+    if (isDirectReadable(sourceAddress, sectorCopySize)) {
+      uint32_t readSize = sectorCopySize;
+      const uint8_t* pSourceData = readRegion(sourceAddress, readSize, NULL, 0);
+      if (pSourceData != NULL && isEqual(destAddress, pSourceData, sectorCopySize, compareBuffer, sizeof(compareBuffer))) {
+        if (pImageHasher != NULL) {
+          pImageHasher->update(pSourceData + sectorOffset, sectorCopySize - sectorOffset);
+        }
+        m_writeStats.nbrOfSkippedErases++;
+        m_writeStats.nbrOfSkippedPrograms++;
+        m_writeStats.bytesSkipped += sectorCopySize;
+        sourceAddress += sectorCopySize;
+        destAddress += sectorCopySize;
+        size -= sectorCopySize;
+        sectorOffset = 0;
+        continue;
+      }
+    }
+#endif
+    int32_t err = eraseSector(destAddress, sectorSize, compareBuffer, sizeof(compareBuffer));
+    if (0 != err) {
+      return err;
+    }
+
+    // program the sector with chunks as large as the staging buffer
+    uint32_t chunkAddress = destAddress + sectorOffset;
+    uint32_t chunkSourceAddress = sourceAddress + sectorOffset;
+    uint32_t remaining = sectorCopySize - sectorOffset;
+    while (remaining > 0) {
+      uint32_t chunkSize = (remaining < bufferSize) ? remaining : bufferSize;
+      // the last chunk is completed up to the page with the bytes following the source
+      const uint32_t programSize = ((chunkSize + pageSize - 1) / pageSize) * pageSize;
+      err = read(pBuffer, chunkSourceAddress, programSize);
+      if (0 != err) {
+        tr_error("Flash read failed: %d", err);
+        return err;
+      }
+      if (pImageHasher != NULL) {
+        pImageHasher->update(pBuffer, chunkSize);
+      }
+      err = programChunk(chunkAddress, pBuffer, programSize, verifyChunks, compareBuffer, sizeof(compareBuffer));
+      if (0 != err) {
+        return err;
+      }
+      chunkSourceAddress += chunkSize;
+      chunkAddress += chunkSize;
+      remaining -= chunkSize;
+    }
+    sourceAddress += sectorCopySize;
+    destAddress += sectorCopySize;
+    size -= sectorCopySize;
+    sectorOffset = 0;
+  }
+
+  return UC_ERR_NONE;
+}
+
+int32_t FlashUpdater::programRegion(uint32_t address, const uint8_t* pData, uint32_t size) {
+  uint8_t compareBuffer[COMPARE_BUFFER_SIZE];
+  return programChunk(address, pData, size, false, compareBuffer, sizeof(compareBuffer));
+}
+
+const FlashWriteStats& FlashUpdater::getWriteStats() const {
+  return m_writeStats;
+}
+
+void FlashUpdater::resetWriteStats() {
+  memset(&m_writeStats, 0, sizeof(m_writeStats));
+}
+
+#if MBED_CONF_UPDATE_CLIENT_FLASH_INSTRUMENTATION
+int FlashUpdater::read(void* buffer, uint32_t addr, uint32_t size) {
+  const uint32_t startUs = getTimeUs();
+  int err = FlashBackend::read(buffer, addr, size);
+  recordOperation(FLASH_OPERATION_READ, addr, size, startUs);
+  return err;
+}
+
+int FlashUpdater::program(const void* buffer, uint32_t addr, uint32_t size) {
+  const uint32_t startUs = getTimeUs();
+  int err = FlashBackend::program(buffer, addr, size);
+  recordOperation(FLASH_OPERATION_PROGRAM, addr, size, startUs);
+  return err;
+}
+
+int FlashUpdater::erase(uint32_t addr, uint32_t size) {
+  const uint32_t startUs = getTimeUs();
+  int err = FlashBackend::erase(addr, size);
+  recordOperation(FLASH_OPERATION_ERASE, addr, size, startUs);
+  return err;
+}
+
+const FlashOperationStats* FlashUpdater::getOperationStats(FlashOperation operation) const {
+  return m_operationStats[operation];
+}
+
+void FlashUpdater::resetOperationStats() {
+  memset((void*) m_operationStats, 0, sizeof(m_operationStats));
+}
+
+void FlashUpdater::traceOperationStats() {
 #if MBED_CONF_MBED_TRACE_ENABLE
-  //if (pagesFlashed == 0) {
-  //  tr_debug("%01x %01x %01x %01x %01x %01x %01x %01x", writePageBuffer[0], writePageBuffer[1], writePageBuffer[2],
-  //           writePageBuffer[3], writePageBuffer[4], writePageBuffer[5], writePageBuffer[6], writePageBuffer[7]);
-  //}
+  static const char* const operationNames[NBR_OF_FLASH_OPERATIONS] = { "erase", "program", "read", "verify" };
+  for (uint32_t operation = 0; operation < NBR_OF_FLASH_OPERATIONS; operation++) {
+    for (uint32_t entry = 0; entry < MAX_SECTOR_SIZES; entry++) {
+      const FlashOperationStats& stats = m_operationStats[operation][entry];
+      if (stats.sectorSize == 0) {
+        break;
+      }
+      tr_info("%s %dK: n %d bytes %lld us min %d mean %d max %d", operationNames[operation],
+              stats.sectorSize / 1024, stats.nbrOfOperations, stats.bytes,
+              stats.minUs, (uint32_t) (stats.totalUs / stats.nbrOfOperations), stats.maxUs);
+      // the histogram is traced in hexadecimal, one digit per bucket (saturated at 0xf)
+      char histogram[FlashOperationStats::NBR_OF_LATENCY_BUCKETS + 1];
+      for (uint32_t bucket = 0; bucket < FlashOperationStats::NBR_OF_LATENCY_BUCKETS; bucket++) {
+        const uint16_t count = stats.latencyHistogram[bucket];
+        histogram[bucket] = "0123456789abcdef"[count < 0xf ? count : 0xf];
+      }
+      histogram[FlashOperationStats::NBR_OF_LATENCY_BUCKETS] = 0;
+      tr_info("%s %dK: latency %s", operationNames[operation], stats.sectorSize / 1024, histogram);
+    }
+  }
+#endif // MBED_CONF_MBED_TRACE_ENABLE
+}
+
+uint32_t FlashUpdater::getTimeUs() {
+#if defined(UPDATE_CLIENT_FLASH_SIMULATOR)
+  return (uint32_t) getStats().elapsedUs;
+#else
+  return us_ticker_read();
 #endif
+}
+
+void FlashUpdater::recordOperation(FlashOperation operation, uint32_t address, uint32_t size, uint32_t startUs) {
+  const uint32_t durationUs = getTimeUs() - startUs;
+
+  // find the entry of the sector size, the last entry is shared by the sizes that do not fit
+  const uint32_t sectorSize = getSectorSize(address);
+  FlashOperationStats* pStats = m_operationStats[operation];
+  uint32_t entry = 0;
+  while (entry < MAX_SECTOR_SIZES - 1 && pStats[entry].sectorSize != 0 && pStats[entry].sectorSize != sectorSize) {
+    entry++;
+  }
+  FlashOperationStats& stats = pStats[entry];
+  if (stats.sectorSize == 0) {
+    stats.sectorSize = sectorSize;
+    stats.minUs = durationUs;
+  }
+
+  stats.nbrOfOperations++;
+  stats.bytes += size;
+  stats.totalUs += durationUs;
+  if (durationUs < stats.minUs) {
+    stats.minUs = durationUs;
+  }
+  if (durationUs > stats.maxUs) {
+    stats.maxUs = durationUs;
+  }
+  uint32_t bucket = 0;
+  while (bucket < FlashOperationStats::NBR_OF_LATENCY_BUCKETS - 1 && durationUs >= (32UL << bucket)) {
+    bucket++;
+  }
+  if (stats.latencyHistogram[bucket] != UINT16_MAX) {
+    stats.latencyHistogram[bucket]++;
+  }
+}
+#endif // MBED_CONF_UPDATE_CLIENT_FLASH_INSTRUMENTATION
+
+uint32_t FlashUpdater::alignAddressToSector(uint32_t address, bool roundDown) {
+  // without sector index, step through the sector map
+  if (m_nbrOfSectorRuns == 0) {
+    // default to returning the beginning of the flash 
+    uint32_t sectorAlignedAddress = get_flash_start();
+    uint32_t flashEndAddress = sectorAlignedAddress + get_flash_size();
+
+    // addresses out of bounds are pinned to the flash boundaries
+    if (address >= flashEndAddress) {
+      sectorAlignedAddress = flashEndAddress;    
+    } 
+    else if (address > sectorAlignedAddress) {
+      // for addresses within bounds step through the sector map
+      uint32_t sectorSize = 0;
+
+      // add sectors from start of flash until we exceed the required address
+      // we cannot assume uniform sector size as in some mcu sectors have
+      // drastically different sizes
+      while (sectorAlignedAddress < address) {
+        sectorSize = get_sector_size(sectorAlignedAddress);
+        sectorAlignedAddress += sectorSize;
+      }
+
+      // if round down to nearest sector, remove the last sector from address
+      // if not already aligned
+      if (roundDown && (sectorAlignedAddress != address)) {
+        sectorAlignedAddress -= sectorSize;
+      }
+    }
+
+    return sectorAlignedAddress;
+  }
+
+  // addresses out of bounds are pinned to the flash boundaries
+  if (address <= m_flashStartAddress) {
+    return m_flashStartAddress;
+  }
+  if (address >= m_flashEndAddress) {
+    return m_flashEndAddress;
+  }
+
+  // align within the run containing the address
+  const SectorRun& run = m_sectorRuns[findSectorRun(address)];
+  uint32_t sectorAlignedAddress = run.startAddress + ((address - run.startAddress) / run.sectorSize) * run.sectorSize;
+  if (!roundDown && (sectorAlignedAddress != address)) {
+    sectorAlignedAddress += run.sectorSize;
+  }
+
+  return sectorAlignedAddress;
+}
+
+uint32_t FlashUpdater::getSectorSize(uint32_t address) {
+  if (m_nbrOfSectorRuns == 0) {
+    return get_sector_size(address);
+  }
+
+  uint32_t runIndex = findSectorRun(address);
+  if (runIndex == m_nbrOfSectorRuns) {
+    return 0;
+  }
+  return m_sectorRuns[runIndex].sectorSize;
+}
 
-  // Program page
-  err = program(writePageBuffer, addr, pageSize);
+uint32_t FlashUpdater::getSectorIndex(uint32_t address) {
+  if (m_nbrOfSectorRuns == 0) {
+    // count sectors from the start of the flash
+    uint32_t sectorIndex = 0;
+    uint32_t sectorAddress = get_flash_start();
+    uint32_t sectorSize = get_sector_size(sectorAddress);
+    while (sectorSize != 0 && sectorAddress + sectorSize <= address) {
+      sectorAddress += sectorSize;
+      sectorSize = get_sector_size(sectorAddress);
+      sectorIndex++;
+    }
+    return sectorIndex;
+  }
+
+  if (address < m_flashStartAddress) {
+    return 0;
+  }
+  if (address >= m_flashEndAddress) {
+    // index of the end of the flash, i.e. number of sectors
+    const SectorRun& lastRun = m_sectorRuns[m_nbrOfSectorRuns - 1];
+    return lastRun.firstSectorIndex + lastRun.nbrOfSectors;
+  }
+  const SectorRun& run = m_sectorRuns[findSectorRun(address)];
+  return run.firstSectorIndex + (address - run.startAddress) / run.sectorSize;
+}
+
+int32_t FlashUpdater::eraseSector(uint32_t sectorAddress, uint32_t sectorSize, uint8_t* pBuffer, uint32_t bufferSize) {
+#if MBED_CONF_UPDATE_CLIENT_DIFFERENTIAL_WRITE
+  // erasing a blank sector only costs time and endurance
+  if (isErased(sectorAddress, sectorSize, pBuffer, bufferSize)) {
+    m_writeStats.nbrOfSkippedErases++;
+    return UC_ERR_NONE;
+  }
+#endif
+  // tr_debug("Erasing sector of size %d at address 0x%08x", sectorSize, sectorAddress);
+  int32_t err = erase(sectorAddress, sectorSize);
   if (0 != err) {
-    tr_error("Flash program failed: %d (for %d bytes)", err, pageSize);
+    tr_error("Flash erase failed: %d", err);
     return err;
   }
-  //tr_debug("Program %d bytes at address 0x%08x", actual, addr);
+  m_writeStats.nbrOfErases++;
 
-  // check that was written is correct
-  memset(readPageBuffer, 0, sizeof(char) * pageSize);
-  err = read(readPageBuffer, addr, pageSize);
+  return UC_ERR_NONE;
+}
+
+int32_t FlashUpdater::programChunk(uint32_t address, const uint8_t* pData, uint32_t size, bool verify,
+                                   uint8_t* pBuffer, uint32_t bufferSize) {
+#if MBED_CONF_UPDATE_CLIENT_DIFFERENTIAL_WRITE
+  // the flash is erased, only erase-valued data matches and needs no program
+  if (isEqual(address, pData, size, pBuffer, bufferSize)) {
+    m_writeStats.nbrOfSkippedPrograms++;
+    m_writeStats.bytesSkipped += size;
+    return UC_ERR_NONE;
+  }
+#endif
+  int32_t err = program(pData, address, size);
   if (0 != err) {
-    tr_error("Flash read failed: %d", err);
+    tr_error("Flash program failed: %d (for %d bytes)", err, size);
     return err;
   }
-  if (memcmp(writePageBuffer, readPageBuffer, pageSize) != 0) {
-    tr_error("Write and read differ");
-    return UC_ERR_WRITE_FAILED;
+  m_writeStats.nbrOfPrograms++;
+  m_writeStats.bytesProgrammed += size;
+
+  if (verify) {
+#if MBED_CONF_UPDATE_CLIENT_FLASH_INSTRUMENTATION
+    const uint32_t startUs = getTimeUs();
+#endif
+    const bool equal = isEqual(address, pData, size, pBuffer, bufferSize);
+#if MBED_CONF_UPDATE_CLIENT_FLASH_INSTRUMENTATION
+    recordOperation(FLASH_OPERATION_VERIFY, address, size, startUs);
+#endif
+    if (! equal) {
+      tr_error("Write and read differ at address 0x%08x", address);
+      return UC_ERR_WRITE_FAILED;
+    }
   }
 
-  // update address and next sector
-  pagesFlashed++;
-  addr += pageSize;
-  if (addr >= nextSectorAddress) {
-    nextSectorAddress = addr + get_sector_size(addr);
-    sectorErased = false;
+  return UC_ERR_NONE;
+}
+
+bool FlashUpdater::isErased(uint32_t address, uint32_t size, uint8_t* pBuffer, uint32_t bufferSize) {
+  const uint8_t eraseValue = get_erase_value();
+  while (size > 0) {
+    uint32_t readSize = size;
+    const uint8_t* pData = readRegion(address, readSize, pBuffer, bufferSize);
+    if (pData == NULL) {
+      return false;
+    }
+    for (uint32_t index = 0; index < readSize; index++) {
+      if (pData[index] != eraseValue) {
+        return false;
+      }
+    }
+    address += readSize;
+    size -= readSize;
   }
+  return true;
+}
 
-  return err;
+bool FlashUpdater::isEqual(uint32_t address, const uint8_t* pData, uint32_t size, uint8_t* pBuffer, uint32_t bufferSize) {
+  while (size > 0) {
+    uint32_t readSize = size;
+    const uint8_t* pFlashData = readRegion(address, readSize, pBuffer, bufferSize);
+    if (pFlashData == NULL || memcmp(pFlashData, pData, readSize) != 0) {
+      return false;
+    }
+    address += readSize;
+    pData += readSize;
+    size -= readSize;
+  }
+  return true;
 }
 
-uint32_t FlashUpdater::alignAddressToSector(uint32_t address, bool roundDown) {
-  // default to returning the beginning of the flash 
-  uint32_t sectorAlignedAddress = get_flash_start();
-  uint32_t flashEndAddress = sectorAlignedAddress + get_flash_size();
-    
-  // addresses out of bounds are pinned to the flash boundaries
-  if (address >= flashEndAddress) {
-    sectorAlignedAddress = flashEndAddress;    
-  } 
-  else if (address > sectorAlignedAddress) {
-    // for addresses within bounds step through the sector map
-    uint32_t sectorSize = 0;
+void FlashUpdater::buildSectorIndex() {
+  m_nbrOfSectorRuns = 0;
+  m_flashStartAddress = get_flash_start();
+  m_flashEndAddress = m_flashStartAddress + get_flash_size();
+
+#if defined(MBED_CONF_UPDATE_CLIENT_SECTOR_MAP)
+  // the sector map is known at build time, it is only checked against the flash bounds
+  typedef MBED_CONF_UPDATE_CLIENT_SECTOR_MAP SectorMap;
+  static_assert(SectorMap::NBR_OF_RUNS <= MAX_SECTOR_RUNS, "Too many sector runs in the sector map");
+  if (SectorMap::FLASH_START == m_flashStartAddress && SectorMap::getFlashEnd() == m_flashEndAddress) {
+    uint32_t runAddress = SectorMap::FLASH_START;
+    uint32_t runSectorIndex = 0;
+    for (uint32_t runIndex = 0; runIndex < SectorMap::NBR_OF_RUNS; runIndex++) {
+      SectorRun& run = m_sectorRuns[m_nbrOfSectorRuns++];
+      run.startAddress = runAddress;
+      run.sectorSize = SectorMap::getRunSectorSize(runIndex);
+      run.nbrOfSectors = SectorMap::getRunNbrOfSectors(runIndex);
+      run.firstSectorIndex = runSectorIndex;
+      runAddress += run.sectorSize * run.nbrOfSectors;
+      runSectorIndex += run.nbrOfSectors;
+    }
+    return;
+  }
+  tr_error("Sector map does not match the flash (0x%08x - 0x%08x)", m_flashStartAddress, m_flashEndAddress);
+#endif
 
-    // add sectors from start of flash until we exceed the required address
-    // we cannot assume uniform sector size as in some mcu sectors have
-    // drastically different sizes
-    while (sectorAlignedAddress < address) {
-      sectorSize = get_sector_size(sectorAlignedAddress);
-      sectorAlignedAddress += sectorSize;
+  // walk the sector map once and merge consecutive sectors of the same size
+  uint32_t sectorAddress = m_flashStartAddress;
+  uint32_t sectorIndex = 0;
+  while (sectorAddress < m_flashEndAddress) {
+    uint32_t sectorSize = get_sector_size(sectorAddress);
+    if (sectorSize == 0) {
+      tr_error("Invalid sector map at address 0x%08x", sectorAddress);
+      m_nbrOfSectorRuns = 0;
+      return;
     }
 
-    // if round down to nearest sector, remove the last sector from address
-    // if not already aligned
-    if (roundDown && (sectorAlignedAddress != address)) {
-      sectorAlignedAddress -= sectorSize;
+    if (m_nbrOfSectorRuns > 0 && m_sectorRuns[m_nbrOfSectorRuns - 1].sectorSize == sectorSize) {
+      m_sectorRuns[m_nbrOfSectorRuns - 1].nbrOfSectors++;
     }
+    else {
+      if (m_nbrOfSectorRuns == MAX_SECTOR_RUNS) {
+        tr_error("Too many sector runs, using the sector map");
+        m_nbrOfSectorRuns = 0;
+        return;
+      }
+      SectorRun& run = m_sectorRuns[m_nbrOfSectorRuns++];
+      run.startAddress = sectorAddress;
+      run.sectorSize = sectorSize;
+      run.nbrOfSectors = 1;
+      run.firstSectorIndex = sectorIndex;
+    }
+    sectorAddress += sectorSize;
+    sectorIndex++;
   }
+  tr_debug("Sector index built: %d sectors in %d runs", sectorIndex, m_nbrOfSectorRuns);
+}
 
-  return sectorAlignedAddress;
+uint32_t FlashUpdater::findSectorRun(uint32_t address) const {
+  if (address < m_flashStartAddress || address >= m_flashEndAddress) {
+    return m_nbrOfSectorRuns;
+  }
+
+  // binary search for the last run starting at or before the address
+  uint32_t low = 0;
+  uint32_t high = m_nbrOfSectorRuns - 1;
+  while (low < high) {
+    uint32_t middle = (low + high + 1) / 2;
+    if (m_sectorRuns[middle].startAddress <= address) {
+      low = middle;
+    }
+    else {
+      high = middle - 1;
+    }
+  }
+  return low;
 }
 
 } // namespace
@@ -1,23 +1,190 @@
 #pragma once
 
+#if defined(UPDATE_CLIENT_FLASH_SIMULATOR)
+#include "FlashSimulator.h"
+#else
 #include "mbed.h"
+#endif
+
+// read flash through memory mapped pointers when possible
+#ifndef MBED_CONF_UPDATE_CLIENT_DIRECT_READ
+#define MBED_CONF_UPDATE_CLIENT_DIRECT_READ 1
+#endif
+// size of the buffer used when flash cannot be read directly
+#ifndef MBED_CONF_UPDATE_CLIENT_READ_BUFFER_SIZE
+#define MBED_CONF_UPDATE_CLIENT_READ_BUFFER_SIZE 2048
+#endif
+
+// skip the erase of blank sectors and the erase and program of sectors
+// and pages that already hold the data to be written
+#ifndef MBED_CONF_UPDATE_CLIENT_DIFFERENTIAL_WRITE
+#define MBED_CONF_UPDATE_CLIENT_DIFFERENTIAL_WRITE 1
+#endif
+
+// count and time the flash operations (see FlashOperationStats), compiled out when disabled
+#ifndef MBED_CONF_UPDATE_CLIENT_FLASH_INSTRUMENTATION
+#define MBED_CONF_UPDATE_CLIENT_FLASH_INSTRUMENTATION 0
+#endif
 
 namespace update_client {
 
+class ImageHasher;
+
 // FlashUpdater is an extension of FlashIAP for dealing with application updates stored on the internal Flash
+// On host builds (UPDATE_CLIENT_FLASH_SIMULATOR defined), it extends the FlashSimulator instead
+
+#if defined(UPDATE_CLIENT_FLASH_SIMULATOR)
+typedef FlashSimulator FlashBackend;
+#else
+typedef mbed::FlashIAP FlashBackend;
+#endif
+
+// counters of the flash operations done and avoided by FlashUpdater writes
+struct FlashWriteStats {
+  uint32_t nbrOfErases;
+  uint32_t nbrOfSkippedErases;
+  uint32_t nbrOfPrograms;
+  uint32_t nbrOfSkippedPrograms;
+  uint64_t bytesProgrammed;
+  // bytes that were already in flash and did not need to be programmed
+  uint64_t bytesSkipped;
+};
+
+#if MBED_CONF_UPDATE_CLIENT_FLASH_INSTRUMENTATION
+// flash operations measured by the instrumentation. Reads are the ones done through the
+// flash driver (memory mapped reads are not measured) and verify is the read back and
+// compare after programming, whose reads are also counted as reads
+enum FlashOperation {
+  FLASH_OPERATION_ERASE,
+  FLASH_OPERATION_PROGRAM,
+  FLASH_OPERATION_READ,
+  FLASH_OPERATION_VERIFY,
+  NBR_OF_FLASH_OPERATIONS
+};
+
+// statistics of an operation on the sectors of one size. The latency histogram
+// counts the operations that took [0, 32[ us in bucket 0, then [2^(i+4), 2^(i+5)[ us
+// in bucket i, the last bucket counting all the longer ones
+struct FlashOperationStats {
+  static const uint32_t NBR_OF_LATENCY_BUCKETS = 20;
+
+  // 0 for an entry that is not used yet
+  uint32_t sectorSize;
+  uint32_t nbrOfOperations;
+  uint64_t bytes;
+  uint32_t minUs;
+  uint32_t maxUs;
+  // the mean is totalUs / nbrOfOperations
+  uint64_t totalUs;
+  uint16_t latencyHistogram[NBR_OF_LATENCY_BUCKETS];
+};
+#endif // MBED_CONF_UPDATE_CLIENT_FLASH_INSTRUMENTATION
 
 class FlashUpdater :
-  public FlashIAP {
+  public FlashBackend {
 public:
   FlashUpdater();
 
+  // initializes the flash and builds the sector index
+  int init();
+
   // read a page at a specified address and updates the address to the next page
   int32_t readPage(uint32_t pageSize, char* readPageBuffer, uint32_t& addr);
+  // returns true if the region can be read through a pointer without copy (memory mapped flash)
+  bool isDirectReadable(uint32_t address, uint32_t size) const;
+  // returns a pointer to the flash content at the address, for at most size bytes.
+  // When the region is directly readable, the pointer refers to the flash itself and
+  // pBuffer is not used (it may be NULL). Otherwise the content is read into pBuffer
+  // (at most bufferSize bytes). size is updated with the number of bytes available
+  // at the returned pointer. Returns NULL if the flash cannot be read.
+  const uint8_t* readRegion(uint32_t address, uint32_t& size, uint8_t* pBuffer, uint32_t bufferSize);
   // write a page at a specified address and updates the parameters for writing the next page  
+  // the page size can be any multiple of the flash page size, sectors are erased as the page reaches them.
+  // With differential writes, blank sectors are not erased, data already in flash is not
+  // programmed and a sector covered by the page that already holds it is left untouched
   int32_t writePage(uint32_t pageSize, char* writePageBuffer, char* readPageBuffer, 
                     uint32_t& addr, bool& sectorErased, size_t& pagesFlashed, uint32_t& nextSectorAddress);
+  // same as writePage for data of any size (a multiple of the flash page size) with a compare
+  // buffer of bufferSize bytes, the data is read back and compared after programming
+  int32_t writeRegion(uint32_t& addr, const uint8_t* pData, uint32_t size,
+                      bool& sectorErased, uint32_t& nextSectorAddress, uint8_t* pBuffer, uint32_t bufferSize);
+  // erases the sectors covering size bytes from the (sector aligned) address
+  int32_t eraseRange(uint32_t address, uint32_t size);
+  // copies size bytes from the source address to the (sector aligned) destination address,
+  // sector by sector and in chunks of at most bufferSize bytes staged in pBuffer.
+  // Each chunk is read back and compared after programming only if verifyChunks is set.
+  // The first deferredSize bytes (e.g. a header) are left erased, for the caller to write them
+  // with programRegion once the copy is complete. The other bytes copied are added to the hash
+  // when pImageHasher is not NULL
+  int32_t copyRegion(uint32_t sourceAddress, uint32_t destAddress, uint32_t size,
+                     uint8_t* pBuffer, uint32_t bufferSize, bool verifyChunks,
+                     uint32_t deferredSize = 0, ImageHasher* pImageHasher = NULL);
+  // programs data in erased flash (size is a multiple of the page size), unless the flash already holds it
+  int32_t programRegion(uint32_t address, const uint8_t* pData, uint32_t size);
   // returns the address passed as parameter aligned to the flash sector
   uint32_t alignAddressToSector(uint32_t address, bool roundDown);
+  // returns the size of the sector containing the address (0 if outside of the flash)
+  uint32_t getSectorSize(uint32_t address);
+  // returns the index of the sector containing the address, counted from the start of the flash
+  uint32_t getSectorIndex(uint32_t address);
+  // counters of the erase and program operations done and skipped by writePage and eraseRange
+  const FlashWriteStats& getWriteStats() const;
+  void resetWriteStats();
+#if MBED_CONF_UPDATE_CLIENT_FLASH_INSTRUMENTATION
+  // flash driver operations, measured for all the users of the FlashUpdater
+  int read(void* buffer, uint32_t addr, uint32_t size);
+  int program(const void* buffer, uint32_t addr, uint32_t size);
+  int erase(uint32_t addr, uint32_t size);
+  // returns the statistics of the operation, one entry per sector size
+  // (MAX_SECTOR_SIZES entries, unused ones have a sector size of 0)
+  const FlashOperationStats* getOperationStats(FlashOperation operation) const;
+  void resetOperationStats();
+  // traces one line per operation and sector size
+  void traceOperationStats();
+
+  // sector sizes measured separately, operations on other sizes are added to the last entry
+  static const uint32_t MAX_SECTOR_SIZES = 4;
+#endif
+
+private:
+  // erases a sector, unless it is blank (differential writes)
+  int32_t eraseSector(uint32_t sectorAddress, uint32_t sectorSize, uint8_t* pBuffer, uint32_t bufferSize);
+  // programs erased flash, pBuffer is used for the comparisons
+  int32_t programChunk(uint32_t address, const uint8_t* pData, uint32_t size, bool verify,
+                       uint8_t* pBuffer, uint32_t bufferSize);
+  // compare the flash content, pBuffer is used when the flash cannot be read directly
+  bool isErased(uint32_t address, uint32_t size, uint8_t* pBuffer, uint32_t bufferSize);
+  bool isEqual(uint32_t address, const uint8_t* pData, uint32_t size, uint8_t* pBuffer, uint32_t bufferSize);
+#if MBED_CONF_UPDATE_CLIENT_FLASH_INSTRUMENTATION
+  // time on the clock of the simulator (host) or of the us ticker (target)
+  uint32_t getTimeUs();
+  void recordOperation(FlashOperation operation, uint32_t address, uint32_t size, uint32_t startUs);
+#endif
+  // builds the table of sector runs by walking the sector map once
+  void buildSectorIndex();
+  // returns the index of the run containing the address or m_nbrOfSectorRuns if none
+  uint32_t findSectorRun(uint32_t address) const;
+
+  // the sector map is stored as runs of consecutive sectors of the same size,
+  // so that lookups are done by binary search on the (few) runs
+  struct SectorRun {
+    uint32_t startAddress;
+    uint32_t sectorSize;
+    uint32_t nbrOfSectors;
+    uint32_t firstSectorIndex;
+  };
+  // flash parts have a handful of runs, parts with more fall back to the sector map walk
+  static const uint32_t MAX_SECTOR_RUNS = 16;
+  SectorRun m_sectorRuns[MAX_SECTOR_RUNS];
+  uint32_t m_nbrOfSectorRuns;
+  uint32_t m_flashStartAddress;
+  uint32_t m_flashEndAddress;
+  // size of the buffer used for comparing the flash when it cannot be read directly
+  static const uint32_t COMPARE_BUFFER_SIZE = 64;
+  FlashWriteStats m_writeStats;
+#if MBED_CONF_UPDATE_CLIENT_FLASH_INSTRUMENTATION
+  FlashOperationStats m_operationStats[NBR_OF_FLASH_OPERATIONS][MAX_SECTOR_SIZES];
+#endif
 };
 
 } // namespace
@@ -0,0 +1,194 @@
+#include "FlashWritePipeline.h"
+#include "UCErrorCodes.h"
+
+#if MBED_CONF_MBED_TRACE_ENABLE
+#include "mbed_trace.h"
+#define TRACE_GROUP "FlashWritePipeline"
+#endif // MBED_CONF_MBED_TRACE_ENABLE
+
+namespace update_client {
+
+#if defined(UPDATE_DOWNLOAD)
+
+FlashWritePipeline::FlashWritePipeline(FlashUpdater& flashUpdater, uint32_t bufferSize) :
+  m_flashUpdater(flashUpdater),
+  m_bufferSize(((bufferSize + flashUpdater.get_page_size() - 1) / flashUpdater.get_page_size()) * flashUpdater.get_page_size()),
+  m_started(false),
+  m_result(UC_ERR_NONE),
+  m_nbrOfWrittenBytes(0),
+  m_startAddress(0),
+  m_deferredSize(0),
+  m_nbrOfDeferredBytes(0),
+  m_address(0),
+  m_endAddress(0),
+  m_sectorErased(false),
+  m_pagesFlashed(0),
+  m_nextSectorAddress(0) {
+  for (uint32_t bufferIndex = 0; bufferIndex < PIPELINE_DEPTH; bufferIndex++) {
+    m_buffers[bufferIndex].pData.reset(new char[m_bufferSize]);
+    m_buffers[bufferIndex].size = 0;
+    m_freeBuffers.try_put(&m_buffers[bufferIndex]);
+  }
+  m_stopMarker.size = 0;
+  m_readBuffer.reset(new char[m_bufferSize]);
+}
+
+FlashWritePipeline::~FlashWritePipeline() {
+  finish();
+}
+
+int32_t FlashWritePipeline::start(uint32_t address, uint32_t size, uint32_t deferredSize) {
+  const uint32_t pageSize = m_flashUpdater.get_page_size();
+  m_startAddress = address;
+  m_deferredSize = ((deferredSize + pageSize - 1) / pageSize) * pageSize;
+  m_nbrOfDeferredBytes = 0;
+  m_deferredBuffer.reset((m_deferredSize > 0) ? new uint8_t[m_deferredSize] : NULL);
+  m_address = address;
+  m_endAddress = (size > 0) ? m_flashUpdater.alignAddressToSector(address + size, false) : 0;
+  m_pagesFlashed = 0;
+  m_result = UC_ERR_NONE;
+  // the sectors are erased as the buffers reach them, so that sectors already holding
+  // the data (a retried download) are left as is. The sectors of the deferred bytes are
+  // erased up front, the previous header of the slot does not outlive the start
+  m_sectorErased = false;
+  m_nextSectorAddress = m_flashUpdater.alignAddressToSector(address, true) + m_flashUpdater.getSectorSize(address);
+  if (m_deferredSize > 0) {
+    int32_t result = m_flashUpdater.eraseRange(address, m_deferredSize);
+    if (result != UC_ERR_NONE) {
+      tr_error("Cannot erase %d bytes at address 0x%08x: %d", m_deferredSize, address, result);
+      return result;
+    }
+    m_sectorErased = true;
+    m_nextSectorAddress = m_flashUpdater.alignAddressToSector(address + m_deferredSize, false);
+  }
+  m_nbrOfWrittenBytes = 0;
+  tr_debug("Starting to write at address 0x%08x (%d buffers of %d bytes)", address, PIPELINE_DEPTH, m_bufferSize);
+
+  osStatus status = m_writerThread.start(callback(this, &FlashWritePipeline::writeBuffers));
+  if (status != osOK) {
+    tr_error("Cannot start the writer thread: %d", status);
+    return UC_ERR_WRITE_FAILED;
+  }
+  m_started = true;
+
+  return UC_ERR_NONE;
+}
+
+uint32_t FlashWritePipeline::getBufferSize() const {
+  return m_bufferSize;
+}
+
+char* FlashWritePipeline::acquireBuffer() {
+  PipelineBuffer* pPipelineBuffer = NULL;
+  m_freeBuffers.try_get_for(Kernel::wait_for_u32_forever, &pPipelineBuffer);
+  return pPipelineBuffer->pData.get();
+}
+
+int32_t FlashWritePipeline::submitBuffer(char* pBuffer, uint32_t size) {
+  PipelineBuffer* pPipelineBuffer = findBuffer(pBuffer);
+  if (pPipelineBuffer == NULL || size > m_bufferSize) {
+    return UC_ERR_WRITE_FAILED;
+  }
+  // once a write failed, the remaining buffers are not written
+  if (m_result != UC_ERR_NONE) {
+    m_freeBuffers.try_put(pPipelineBuffer);
+    return m_result;
+  }
+
+  // pad the buffer up to the next page
+  const uint32_t pageSize = m_flashUpdater.get_page_size();
+  pPipelineBuffer->size = ((size + pageSize - 1) / pageSize) * pageSize;
+  memset(pBuffer + size, m_flashUpdater.get_erase_value(), pPipelineBuffer->size - size);
+
+  // the filled queue can hold all buffers and the stop marker, it cannot be full
+  m_filledBuffers.try_put(pPipelineBuffer);
+
+  return UC_ERR_NONE;
+}
+
+void FlashWritePipeline::releaseBuffer(char* pBuffer) {
+  PipelineBuffer* pPipelineBuffer = findBuffer(pBuffer);
+  if (pPipelineBuffer != NULL) {
+    m_freeBuffers.try_put(pPipelineBuffer);
+  }
+}
+
+int32_t FlashWritePipeline::finish() {
+  if (m_started) {
+    m_filledBuffers.try_put(&m_stopMarker);
+    m_writerThread.join();
+    m_started = false;
+  }
+
+  return m_result;
+}
+
+int32_t FlashWritePipeline::writeDeferred() {
+  if (m_deferredSize == 0) {
+    return UC_ERR_NONE;
+  }
+  if (m_started || m_result != UC_ERR_NONE || m_nbrOfDeferredBytes != m_deferredSize) {
+    tr_error("Cannot write the %d deferred bytes", m_deferredSize);
+    return UC_ERR_WRITE_FAILED;
+  }
+  return m_flashUpdater.programRegion(m_startAddress, m_deferredBuffer.get(), m_deferredSize);
+}
+
+uint32_t FlashWritePipeline::getNbrOfWrittenBytes() const {
+  return m_nbrOfWrittenBytes;
+}
+
+void FlashWritePipeline::writeBuffers() {
+  while (true) {
+    PipelineBuffer* pPipelineBuffer = NULL;
+    m_filledBuffers.try_get_for(Kernel::wait_for_u32_forever, &pPipelineBuffer);
+    if (pPipelineBuffer == &m_stopMarker) {
+      break;
+    }
+
+    // the deferred bytes at the start of the data are kept and skipped
+    char* pData = pPipelineBuffer->pData.get();
+    uint32_t size = pPipelineBuffer->size;
+    if (m_nbrOfDeferredBytes < m_deferredSize) {
+      const uint32_t deferredSize = (size < m_deferredSize - m_nbrOfDeferredBytes) ? size : m_deferredSize - m_nbrOfDeferredBytes;
+      memcpy(m_deferredBuffer.get() + m_nbrOfDeferredBytes, pData, deferredSize);
+      m_nbrOfDeferredBytes += deferredSize;
+      m_nbrOfWrittenBytes += deferredSize;
+      m_address += deferredSize;
+      pData += deferredSize;
+      size -= deferredSize;
+    }
+
+    if (m_result == UC_ERR_NONE && size > 0 && m_endAddress != 0 && m_address + size > m_endAddress) {
+      tr_error("Buffer at address 0x%08x exceeds the end address 0x%08x", m_address, m_endAddress);
+      m_result = UC_ERR_WRITE_FAILED;
+    }
+    if (m_result == UC_ERR_NONE && size > 0) {
+      int32_t result = m_flashUpdater.writePage(size, pData, m_readBuffer.get(),
+                                                m_address, m_sectorErased, m_pagesFlashed, m_nextSectorAddress);
+      if (result != UC_ERR_NONE) {
+        tr_error("Cannot write buffer at address 0x%08x: %d", m_address, result);
+        m_result = result;
+      }
+      else {
+        m_nbrOfWrittenBytes += size;
+      }
+    }
+
+    // the buffer can be filled again
+    m_freeBuffers.try_put(pPipelineBuffer);
+  }
+}
+
+FlashWritePipeline::PipelineBuffer* FlashWritePipeline::findBuffer(char* pBuffer) {
+  for (uint32_t bufferIndex = 0; bufferIndex < PIPELINE_DEPTH; bufferIndex++) {
+    if (m_buffers[bufferIndex].pData.get() == pBuffer) {
+      return &m_buffers[bufferIndex];
+    }
+  }
+  return NULL;
+}
+
+#endif
+
+} // namespace
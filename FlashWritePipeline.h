@@ -0,0 +1,101 @@
+#pragma once
+
+#if defined(UPDATE_CLIENT_FLASH_SIMULATOR)
+#include "HostRtos.h"
+#else
+#include "mbed.h"
+#endif
+#include <cstdint>
+
+#include "FlashUpdater.h"
+
+// size of the buffers in the download pipeline
+#ifndef MBED_CONF_UPDATE_CLIENT_DOWNLOAD_BUFFER_SIZE
+#define MBED_CONF_UPDATE_CLIENT_DOWNLOAD_BUFFER_SIZE 1024
+#endif
+// number of buffers in the download pipeline
+#ifndef MBED_CONF_UPDATE_CLIENT_DOWNLOAD_PIPELINE_DEPTH
+#define MBED_CONF_UPDATE_CLIENT_DOWNLOAD_PIPELINE_DEPTH 2
+#endif
+
+namespace update_client {
+
+#if defined(UPDATE_DOWNLOAD)
+
+// FlashWritePipeline writes consecutive buffers to the flash from a dedicated
+// thread, so that the next buffer can be received while the previous one is
+// erased, programmed and verified. Buffers are taken from a ring of
+// MBED_CONF_UPDATE_CLIENT_DOWNLOAD_PIPELINE_DEPTH buffers: acquireBuffer()
+// blocks while all of them are waiting to be written (back-pressure).
+
+class FlashWritePipeline {
+public:
+  // the buffer size is rounded up to a multiple of the flash page size
+  FlashWritePipeline(FlashUpdater& flashUpdater, uint32_t bufferSize);
+  ~FlashWritePipeline();
+
+  // starts writing at the given (sector aligned) address. Each sector is erased when
+  // the first buffer reaches it, a blank sector is not erased and a sector covered by a
+  // buffer that already holds its data is left as is. When the size of the data is
+  // known, nothing is written past the sectors covering it.
+  // The first deferredSize bytes (rounded up to the flash page size) are not
+  // programmed with the buffers but kept until writeDeferred()
+  int32_t start(uint32_t address, uint32_t size = 0, uint32_t deferredSize = 0);
+  uint32_t getBufferSize() const;
+  // returns a free buffer, blocks until one is available
+  char* acquireBuffer();
+  // queues an acquired buffer for writing. Only the last buffer may be partially
+  // filled (size is rounded up to the flash page size and the buffer padded with
+  // the erase value). Returns the first write error, if any.
+  int32_t submitBuffer(char* pBuffer, uint32_t size);
+  // gives back an acquired buffer without writing it
+  void releaseBuffer(char* pBuffer);
+  // waits until all submitted buffers are written and returns the first write error, if any
+  int32_t finish();
+  // programs the deferred bytes, once all the buffers are written
+  int32_t writeDeferred();
+  // number of bytes written to the flash
+  uint32_t getNbrOfWrittenBytes() const;
+
+private:
+  struct PipelineBuffer {
+    std::unique_ptr<char[]> pData;
+    uint32_t size;
+  };
+
+  void writeBuffers();
+  PipelineBuffer* findBuffer(char* pBuffer);
+
+  static const uint32_t PIPELINE_DEPTH = MBED_CONF_UPDATE_CLIENT_DOWNLOAD_PIPELINE_DEPTH;
+
+  // data members
+  FlashUpdater& m_flashUpdater;
+  const uint32_t m_bufferSize;
+  PipelineBuffer m_buffers[PIPELINE_DEPTH];
+  std::unique_ptr<char[]> m_readBuffer;
+  // buffers ready to be filled and buffers waiting to be written
+  Queue<PipelineBuffer, PIPELINE_DEPTH> m_freeBuffers;
+  Queue<PipelineBuffer, PIPELINE_DEPTH + 1> m_filledBuffers;
+  Thread m_writerThread;
+  bool m_started;
+  // written by the writer thread only
+  volatile int32_t m_result;
+  volatile uint32_t m_nbrOfWrittenBytes;
+  // start of the data and bytes kept until writeDeferred()
+  uint32_t m_startAddress;
+  std::unique_ptr<uint8_t[]> m_deferredBuffer;
+  uint32_t m_deferredSize;
+  uint32_t m_nbrOfDeferredBytes;
+  // write position
+  uint32_t m_address;
+  uint32_t m_endAddress;
+  bool m_sectorErased;
+  size_t m_pagesFlashed;
+  uint32_t m_nextSectorAddress;
+  // marker queued to stop the writer thread
+  PipelineBuffer m_stopMarker;
+};
+
+#endif
+
+} // namespace
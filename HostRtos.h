@@ -0,0 +1,120 @@
+#pragma once
+
+#if defined(UPDATE_CLIENT_FLASH_SIMULATOR)
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// HostRtos provides, on the host, the few mbed OS RTOS services used by the
+// download session and the write pipeline (threads, queues and the kernel clock)
+// on top of the C++ standard library, so that the download runs against the
+// flash simulator without mbed OS. Only the calls made by the update client
+// are provided, with the same semantics as their mbed OS counterparts.
+
+typedef int32_t osStatus;
+const osStatus osOK = 0;
+const osStatus osError = -1;
+
+namespace Kernel {
+
+typedef std::chrono::duration<uint32_t, std::milli> duration_u32;
+constexpr duration_u32 wait_for_u32_forever(UINT32_MAX);
+
+struct Clock {
+  typedef std::chrono::milliseconds duration;
+  typedef std::chrono::steady_clock::time_point time_point;
+
+  static time_point now() {
+    return std::chrono::steady_clock::now();
+  }
+};
+
+} // namespace Kernel
+
+namespace mbed {
+
+template <typename F>
+using Callback = std::function<F>;
+
+template <typename T, typename R>
+Callback<R()> callback(T* pObject, R (T::*pMethod)()) {
+  return [pObject, pMethod]() { return (pObject->*pMethod)(); };
+}
+
+} // namespace mbed
+
+namespace rtos {
+
+class Thread {
+public:
+  ~Thread() {
+    join();
+  }
+
+  osStatus start(mbed::Callback<void()> task) {
+    if (m_thread.joinable()) {
+      return osError;
+    }
+    m_thread = std::thread(task);
+    return osOK;
+  }
+
+  osStatus join() {
+    if (m_thread.joinable()) {
+      m_thread.join();
+    }
+    return osOK;
+  }
+
+private:
+  std::thread m_thread;
+};
+
+// queue of pointers holding up to queueSize messages
+template <typename T, uint32_t queueSize>
+class Queue {
+public:
+  bool try_put(T* pMessage) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_messages.size() >= queueSize) {
+      return false;
+    }
+    m_messages.push_back(pMessage);
+    m_condition.notify_all();
+    return true;
+  }
+
+  bool try_get_for(Kernel::duration_u32 timeout, T** ppMessage) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    auto hasMessage = [this]() { return ! m_messages.empty(); };
+    if (timeout == Kernel::wait_for_u32_forever) {
+      m_condition.wait(lock, hasMessage);
+    }
+    else if (! m_condition.wait_for(lock, timeout, hasMessage)) {
+      return false;
+    }
+    *ppMessage = m_messages.front();
+    m_messages.pop_front();
+    return true;
+  }
+
+private:
+  std::mutex m_mutex;
+  std::condition_variable m_condition;
+  std::deque<T*> m_messages;
+};
+
+} // namespace rtos
+
+using namespace mbed;
+using namespace rtos;
+
+#endif // UPDATE_CLIENT_FLASH_SIMULATOR
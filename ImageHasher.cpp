@@ -0,0 +1,44 @@
+#include "ImageHasher.h"
+#include "UCErrorCodes.h"
+
+namespace update_client {
+
+ImageHasher::ImageHasher() {
+  mbedtls_sha256_init(&m_context);
+}
+
+ImageHasher::~ImageHasher() {
+  mbedtls_sha256_free(&m_context);
+}
+
+void ImageHasher::start() {
+  // 0 selects SHA-256 (not SHA-224)
+  mbedtls_sha256_starts(&m_context, 0);
+}
+
+void ImageHasher::update(const uint8_t* pData, uint32_t size) {
+  mbedtls_sha256_update(&m_context, pData, size);
+}
+
+const char* ImageHasher::getEngineName() {
+#if defined(MBEDTLS_SHA256_ALT)
+  return "hardware";
+#elif defined(MBEDTLS_SHA256_USE_A64_CRYPTO_ONLY)
+  return "armv8";
+#elif defined(MBEDTLS_SHA256_SMALLER)
+  return "mbedtls_small";
+#else
+  return "mbedtls_unrolled";
+#endif
+}
+
+int32_t ImageHasher::write(const uint8_t* pData, uint32_t size) {
+  update(pData, size);
+  return UC_ERR_NONE;
+}
+
+void ImageHasher::finish(uint8_t hash[HASH_SIZE]) {
+  mbedtls_sha256_finish(&m_context, hash);
+}
+
+} // namespace
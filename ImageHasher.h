@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+
+#include "bootloader_mbedtls_user_config.h"
+
+#include "mbedtls/sha256.h"
+
+#include "Decompressor.h"
+
+namespace update_client {
+
+// ImageHasher computes the SHA-256 of an application image, incrementally so that
+// the image can be hashed while it is read, received or copied. It can receive
+// the output of a Decompressor for hashing compressed images.
+// The SHA-256 implementation is selected with update-client.sha256-engine
+// (see bootloader_mbedtls_user_config.h)
+
+class ImageHasher :
+  public DecompressorSink {
+public:
+  static const uint32_t HASH_SIZE = (256/8);
+
+  ImageHasher();
+  ~ImageHasher();
+
+  // starts a new hash
+  void start();
+  // adds data to the hash
+  void update(const uint8_t* pData, uint32_t size);
+  // finalizes the hash
+  void finish(uint8_t hash[HASH_SIZE]);
+
+  // returns the name of the SHA-256 implementation used (e.g. for traces and benchmarks)
+  static const char* getEngineName();
+
+  // DecompressorSink implementation
+  virtual int32_t write(const uint8_t* pData, uint32_t size);
+
+private:
+  // data members
+  mbedtls_sha256_context m_context;
+};
+
+} // namespace
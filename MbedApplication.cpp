@@ -1,22 +1,23 @@
 #include "MbedApplication.h"
 #include "UCErrorCodes.h"
+#include "Crc32.h"
 
 #if MBED_CONF_MBED_TRACE_ENABLE
 #include "mbed_trace.h"
 #define TRACE_GROUP "MbedApplication"
 #endif // MBED_CONF_MBED_TRACE_ENABLE
 
-#include "bootloader_mbedtls_user_config.h"
-
-#include "mbedtls/sha256.h"
+#include "Decompressor.h"
+#include "DeltaPatcher.h"
+#include "ImageHasher.h"
 
 namespace update_client {
   
 MbedApplication::MbedApplication(FlashUpdater& flashUpdater, uint32_t applicationHeaderAddress, uint32_t applicationAddress) :
   m_flashUpdater(flashUpdater),
   m_applicationHeaderAddress(applicationHeaderAddress),
-  m_applicationAddress(applicationAddress) {
-  memset(m_buffer, 0, sizeof(m_buffer));
+  m_applicationAddress(applicationAddress),
+  m_pVerificationRecord(NULL) {
   memset((void*) &m_applicationHeader, 0, sizeof(m_applicationHeader));
   m_applicationHeader.initialized = false;
   m_applicationHeader.state = NOT_CHECKED;
@@ -41,6 +42,36 @@ bool MbedApplication::isValid() {
   return m_applicationHeader.state != NOT_VALID;
 }
 
+bool MbedApplication::hasValidHeader() {
+  if (! m_applicationHeader.initialized) {
+    readApplicationHeader();
+  }
+  if (m_applicationHeader.state == NOT_VALID ||
+      m_applicationHeader.headerVersion < HEADER_VERSION_V2 ||
+      m_applicationHeader.firmwareSize == 0) {
+    return false;
+  }
+
+  // an image already found not valid is not hashed again to find it out
+  if (m_applicationHeader.state == NOT_CHECKED && m_pVerificationRecord != NULL) {
+    VerificationRecord::Status status = m_pVerificationRecord->getStatus(m_applicationHeaderAddress,
+                                                                         m_applicationHeader.checksum,
+                                                                         m_applicationHeader.firmwareVersion,
+                                                                         m_applicationHeader.firmwareSize);
+    if (status == VerificationRecord::VERIFIED_NOT_VALID) {
+      tr_debug(" Application already verified as not valid");
+      m_applicationHeader.state = NOT_VALID;
+      return false;
+    }
+  }
+
+  return true;
+}
+
+uint32_t MbedApplication::getApplicationAddress() const {
+  return m_applicationAddress;
+}
+
 uint64_t MbedApplication::getFirmwareVersion() {
   if (! m_applicationHeader.initialized) {
     int32_t result = readApplicationHeader();
@@ -54,6 +85,27 @@ uint64_t MbedApplication::getFirmwareVersion() {
   return m_applicationHeader.firmwareVersion;
 }
 
+uint64_t MbedApplication::getPayloadSize() {
+  if (! m_applicationHeader.initialized) {
+    int32_t result = readApplicationHeader();
+    if (result != UC_ERR_NONE) {
+      tr_error(" Invalid application header: %d", result);
+      m_applicationHeader.state = NOT_VALID;
+      return 0;
+    }
+  }
+
+  return m_applicationHeader.payloadSize;
+}
+
+uint32_t MbedApplication::getCompression() {
+  if (! m_applicationHeader.initialized) {
+    readApplicationHeader();
+  }
+
+  return m_applicationHeader.compression;
+}
+
 uint64_t MbedApplication::getFirmwareSize() {
   if (! m_applicationHeader.initialized) {
     int32_t result = readApplicationHeader();
@@ -94,6 +146,46 @@ bool MbedApplication::isNewerThan(MbedApplication& otherApplication) {
   return otherApplication.m_applicationHeader.firmwareVersion < m_applicationHeader.firmwareVersion;
 }
   
+bool MbedApplication::hasImage(uint64_t firmwareSize, const uint8_t* pHash) {
+  // read application header if required
+  if (! m_applicationHeader.initialized) {
+    readApplicationHeader();
+  }
+
+  if (m_applicationHeader.headerVersion < HEADER_VERSION_V2 ||
+      m_applicationHeader.firmwareSize == 0 ||
+      m_applicationHeader.state == NOT_VALID) {
+    return false;
+  }
+
+  return m_applicationHeader.firmwareSize == firmwareSize &&
+         memcmp(m_applicationHeader.hash, pHash, SHA256_SIZE) == 0;
+}
+
+bool MbedApplication::hasSameImage(MbedApplication& otherApplication) {
+  // read application header if required
+  if (! m_applicationHeader.initialized) {
+    readApplicationHeader();
+  }
+  if (! otherApplication.m_applicationHeader.initialized) {
+    otherApplication.readApplicationHeader();
+  }
+
+  // empty or invalid applications never match
+  if (m_applicationHeader.headerVersion < HEADER_VERSION_V2 ||
+      m_applicationHeader.firmwareSize == 0 ||
+      m_applicationHeader.state == NOT_VALID ||
+      otherApplication.m_applicationHeader.headerVersion < HEADER_VERSION_V2 ||
+      otherApplication.m_applicationHeader.firmwareSize == 0 ||
+      otherApplication.m_applicationHeader.state == NOT_VALID) {
+    return false;
+  }
+
+  return m_applicationHeader.firmwareVersion == otherApplication.m_applicationHeader.firmwareVersion &&
+         m_applicationHeader.firmwareSize == otherApplication.m_applicationHeader.firmwareSize &&
+         memcmp(m_applicationHeader.hash, otherApplication.m_applicationHeader.hash, SIZEOF_SHA256) == 0;
+}
+  
 int32_t MbedApplication::checkApplication() {
   // read the header
   int32_t result = readApplicationHeader();
@@ -105,49 +197,82 @@ int32_t MbedApplication::checkApplication() {
   tr_debug(" Application size is %lld", m_applicationHeader.firmwareSize);
 
   // at this stage, the header is valid
+  // no need to calculate the hash if it was already verified for this header
+  if (m_pVerificationRecord != NULL && m_applicationHeader.firmwareSize > 0) {
+    VerificationRecord::Status status = m_pVerificationRecord->getStatus(m_applicationHeaderAddress,
+                                                                         m_applicationHeader.checksum,
+                                                                         m_applicationHeader.firmwareVersion,
+                                                                         m_applicationHeader.firmwareSize);
+    if (status == VerificationRecord::VERIFIED_VALID) {
+      tr_debug(" Application already verified");
+      m_applicationHeader.state = VALID;
+      return UC_ERR_NONE;
+    }
+    if (status == VerificationRecord::VERIFIED_NOT_VALID) {
+      tr_debug(" Application already verified as not valid");
+      m_applicationHeader.state = NOT_VALID;
+      return UC_ERR_HASH_INVALID;
+    }
+  }
+
   // calculate hash if slot is not empty
   if (m_applicationHeader.firmwareSize > 0) {
     // initialize hashing facility 
-    mbedtls_sha256_context mbedtls_ctx;
-    mbedtls_sha256_init(&mbedtls_ctx);
-    mbedtls_sha256_starts(&mbedtls_ctx, 0);
+    ImageHasher imageHasher;
+    imageHasher.start();
 
     uint8_t SHA[SIZEOF_SHA256] = { 0 };
-    uint32_t remaining = m_applicationHeader.firmwareSize;
+    uint32_t address = m_applicationAddress;
+    uint32_t remaining = m_applicationHeader.payloadSize;
+
+    // a compressed image is hashed as it is decompressed
+    Decompressor decompressor;
+    const bool compressed = (m_applicationHeader.compression != COMPRESSION_NONE);
+    if (compressed) {
+      result = decompressor.start(m_applicationHeader.compression);
+    }
+
+    // a buffer is only needed if the flash cannot be read directly
+    std::unique_ptr<uint8_t[]> readBuffer;
+    if (! m_flashUpdater.isDirectReadable(address, remaining)) {
+      readBuffer.reset(new uint8_t[READ_BUFFER_SIZE]);
+    }
     
     // read full image 
-    tr_debug(" Calculating hash (start address 0x%08x, size %lld)", m_applicationAddress, m_applicationHeader.firmwareSize);
-    while (remaining > 0) {
-      // read full buffer or what is remaining 
-      uint32_t readSize = (remaining > BUFFER_SIZE) ? BUFFER_SIZE : remaining;
-     
-      // read buffer using FlashIAP API for portability */
-      int err = m_flashUpdater.read(m_buffer, m_applicationAddress + (m_applicationHeader.firmwareSize - remaining), readSize);
-      if (err != 0) {
-        tr_error(" Error while reading flash %d", err);
+    tr_debug(" Calculating hash (start address 0x%08x, size %lld)", m_applicationAddress, m_applicationHeader.payloadSize);
+    while (remaining > 0 && result == UC_ERR_NONE) {
+      // get the full image at once if directly readable, or a buffer
+      uint32_t readSize = remaining;
+      const uint8_t* pData = m_flashUpdater.readRegion(address, readSize, readBuffer.get(), READ_BUFFER_SIZE);
+      if (pData == NULL) {
+        tr_error(" Error while reading flash at address 0x%08x", address);
         result = UC_ERR_READING_FLASH;
         break;
       }
 
       // update hash
-      mbedtls_sha256_update(&mbedtls_ctx, m_buffer, readSize);
+      if (compressed) {
+        result = decompressor.update(pData, readSize, imageHasher);
+      }
+      else {
+        imageHasher.update(pData, readSize);
+      }
 
-      // update remaining bytes
+      // update address and remaining bytes
+      address += readSize;
       remaining -= readSize;
     }
 
     // finalize hash
-    mbedtls_sha256_finish(&mbedtls_ctx, SHA);
-    mbedtls_sha256_free(&mbedtls_ctx);
+    imageHasher.finish(SHA);
+    if (result == UC_ERR_NONE && compressed && decompressor.getNbrOfDecompressedBytes() != m_applicationHeader.firmwareSize) {
+      tr_error(" Decompressed %lld bytes instead of %lld", decompressor.getNbrOfDecompressedBytes(), m_applicationHeader.firmwareSize);
+      result = UC_ERR_DECOMPRESSION_FAILED;
+    }
 
     // compare calculated hash with hash from header
-    int diff = memcmp(m_applicationHeader.hash, SHA, SIZEOF_SHA256);
-
-    if (diff == 0) {
-      result = UC_ERR_NONE;
-    }
-    else {
-      result = UC_ERR_HASH_INVALID;
+    if (result == UC_ERR_NONE) {
+      result = compareHash(SHA);
     }
   } 
   else {
@@ -163,6 +288,87 @@ int32_t MbedApplication::checkApplication() {
   return result;
 }
   
+int32_t MbedApplication::checkApplicationHash(const uint8_t* pCalculatedHash) {
+  // read the header
+  int32_t result = readApplicationHeader();
+  if (result != UC_ERR_NONE) {
+    tr_error(" Invalid application header: %d", result);
+    m_applicationHeader.state = NOT_VALID;
+    return result;
+  }
+
+  if (m_applicationHeader.firmwareSize > 0) {
+    result = compareHash(pCalculatedHash);
+  }
+  else {
+    // header is valid but application size is 0
+    result = UC_ERR_FIRMWARE_EMPTY;
+  }
+  if (result == UC_ERR_NONE) {
+    m_applicationHeader.state = VALID;
+  }
+  else {
+    m_applicationHeader.state = NOT_VALID;
+  }
+  return result;
+}
+
+int32_t MbedApplication::compareHash(const uint8_t* pCalculatedHash) {
+  int diff = memcmp(m_applicationHeader.hash, pCalculatedHash, SIZEOF_SHA256);
+  int32_t result = (diff == 0) ? UC_ERR_NONE : UC_ERR_HASH_INVALID;
+
+  // remember the result for the next checks
+  if (m_pVerificationRecord != NULL) {
+    m_pVerificationRecord->setStatus(m_applicationHeaderAddress,
+                                     m_applicationHeader.checksum,
+                                     m_applicationHeader.firmwareVersion,
+                                     m_applicationHeader.firmwareSize,
+                                     (result == UC_ERR_NONE) ? VerificationRecord::VERIFIED_VALID : VerificationRecord::VERIFIED_NOT_VALID);
+  }
+
+  return result;
+}
+
+int32_t MbedApplication::checkBootable() {
+  const uint64_t firmwareSize = getFirmwareSize();
+  if (firmwareSize < RESET_HANDLER_OFFSET + sizeof(uint32_t)) {
+    return UC_ERR_FIRMWARE_EMPTY;
+  }
+  // a compressed image must be installed before it can be started
+  if (m_applicationHeader.compression != COMPRESSION_NONE) {
+    return UC_ERR_NOT_BOOTABLE;
+  }
+
+  uint8_t vectorTable[RESET_HANDLER_OFFSET + sizeof(uint32_t)] = { 0 };
+  int err = m_flashUpdater.read(vectorTable, m_applicationAddress, sizeof(vectorTable));
+  if (0 != err) {
+    tr_error("Flash read failed: %d", err);
+    return UC_ERR_READING_FLASH;
+  }
+  const uint32_t initialStackPointer = parseUint32LittleEndian(&vectorTable[INITIAL_STACK_POINTER_OFFSET]);
+  // the lowest bit of the handler address selects the thumb state
+  const uint32_t resetHandler = parseUint32LittleEndian(&vectorTable[RESET_HANDLER_OFFSET]) & ~1UL;
+  tr_debug(" Application at 0x%08x: initial stack pointer 0x%08x, reset handler 0x%08x", 
+           m_applicationAddress, initialStackPointer, resetHandler);
+
+  // the stack must be word aligned (which an erased vector table is not)
+  if (initialStackPointer == 0 || (initialStackPointer & 0x3) != 0) {
+    tr_error(" Application at 0x%08x has no valid vector table", m_applicationAddress);
+    return UC_ERR_NOT_BOOTABLE;
+  }
+  // an application linked for another address would jump outside of its image
+  if (resetHandler < m_applicationAddress || resetHandler - m_applicationAddress >= firmwareSize) {
+    tr_error(" Application at 0x%08x is not linked for this address", m_applicationAddress);
+    return UC_ERR_NOT_BOOTABLE;
+  }
+
+  return UC_ERR_NONE;
+}
+
+void MbedApplication::setVerificationRecord(VerificationRecord* pVerificationRecord) {
+  m_pVerificationRecord = pVerificationRecord;
+}
+
 void MbedApplication::compareTo(MbedApplication& otherApplication) {
   tr_debug(" Comparing applications at address 0x%08x and 0x%08x", m_applicationAddress, otherApplication.m_applicationAddress);
   
@@ -194,37 +400,49 @@ void MbedApplication::compareTo(MbedApplication& otherApplication) {
     tr_debug("Hash differ");
   }
   
-  if (m_applicationHeader.firmwareSize == otherApplication.m_applicationHeader.firmwareSize) {
+  if (m_applicationHeader.payloadSize == otherApplication.m_applicationHeader.payloadSize) {
     tr_debug(" Comparing application binaries");
-    const uint32_t pageSize = m_flashUpdater.get_page_size();
-    tr_debug("Flash page size is %d", pageSize);
-
-    std::unique_ptr<char> readPageBuffer1 = std::unique_ptr<char>(new char[pageSize]);
-    std::unique_ptr<char> readPageBuffer2 = std::unique_ptr<char>(new char[pageSize]);
     uint32_t address1 = m_applicationAddress;
     uint32_t address2 = otherApplication.m_applicationAddress;
+    uint32_t remaining = m_applicationHeader.payloadSize;
+
+    // buffers are only needed if the flash cannot be read directly
+    std::unique_ptr<uint8_t[]> readBuffer1;
+    std::unique_ptr<uint8_t[]> readBuffer2;
+    if (! m_flashUpdater.isDirectReadable(address1, remaining)) {
+      readBuffer1.reset(new uint8_t[READ_BUFFER_SIZE]);
+    }
+    if (! m_flashUpdater.isDirectReadable(address2, remaining)) {
+      readBuffer2.reset(new uint8_t[READ_BUFFER_SIZE]);
+    }
     uint32_t nbrOfBytes = 0;
     bool binariesMatch = true;
-    while (nbrOfBytes < m_applicationHeader.firmwareSize) {
-      result = m_flashUpdater.readPage(pageSize, readPageBuffer1.get(), address1);
-      if (result != UC_ERR_NONE) {
+    while (remaining > 0) {
+      uint32_t readSize1 = remaining;
+      const uint8_t* pData1 = m_flashUpdater.readRegion(address1, readSize1, readBuffer1.get(), READ_BUFFER_SIZE);
+      if (pData1 == NULL) {
         tr_error("Cannot read application 1 (address 0x%08x)", address1);
         binariesMatch = false;
         break;       
       }
-      result = m_flashUpdater.readPage(pageSize, readPageBuffer2.get(), address2);
-      if (result != UC_ERR_NONE) {
+      // compare the same number of bytes on both sides
+      uint32_t readSize2 = readSize1;
+      const uint8_t* pData2 = m_flashUpdater.readRegion(address2, readSize2, readBuffer2.get(), READ_BUFFER_SIZE);
+      if (pData2 == NULL) {
         tr_error("Cannot read application 2 (address 0x%08x)", address2);
         binariesMatch = false;
         break;       
       }
 
-      if (memcmp(readPageBuffer1.get(), readPageBuffer2.get(), pageSize) != 0) {
-        tr_error("Applications differ at byte %d (address1 0x%08x - address2 0x%08x)", nbrOfBytes, address1, address2);
+      if (memcmp(pData1, pData2, readSize2) != 0) {
+        tr_error("Applications differ after byte %d (address1 0x%08x - address2 0x%08x)", nbrOfBytes, address1, address2);
         binariesMatch = false;
         break;       
       }
-      nbrOfBytes += pageSize;
+      address1 += readSize2;
+      address2 += readSize2;
+      remaining -= readSize2;
+      nbrOfBytes += readSize2;
     }
 
     if (binariesMatch) {
@@ -276,6 +494,24 @@ int32_t MbedApplication::readApplicationHeader() {
       }  
       break;
 
+      case HEADER_VERSION_V3: {
+        if (m_applicationHeader.magic == HEADER_MAGIC_V2) {
+          uint8_t read_buffer[HEADER_SIZE_V3] = {0};
+          err = m_flashUpdater.read(read_buffer, m_applicationHeaderAddress, HEADER_SIZE_V3);
+          if (err == 0) {
+            result = parseInternalHeaderV3(read_buffer);
+            if (result != UC_ERR_NONE) {
+              tr_error("Failed header parsing : %d", result);
+            }
+          }
+          else {
+            tr_error("Error when reading flash %d", err);
+            result = UC_ERR_READING_FLASH;
+          }
+        }
+      }
+      break;
+
       // Other firmware header versions can be supported here
       default:
       break;
@@ -288,7 +524,8 @@ int32_t MbedApplication::readApplicationHeader() {
 
   m_applicationHeader.initialized = true;
   if (result == UC_ERR_NONE) {
-    m_applicationHeader.state = VALID;
+    // the header is valid, the image itself is not checked yet
+    m_applicationHeader.state = NOT_CHECKED;
   }
   else {
     m_applicationHeader.state = NOT_VALID;
@@ -297,6 +534,47 @@ int32_t MbedApplication::readApplicationHeader() {
   return result;
 }
 
+int32_t MbedApplication::parseApplicationHeader(const uint8_t* pBuffer, uint32_t size) {
+  // default return code
+  int32_t result = UC_ERR_INVALID_HEADER;
+
+  if (pBuffer != NULL && size >= 8) {
+    // read out header magic and version
+    m_applicationHeader.magic = parseUint32(&pBuffer[0]);
+    m_applicationHeader.headerVersion = parseUint32(&pBuffer[4]);
+
+    // choose version to decode
+    switch (m_applicationHeader.headerVersion) {
+      case HEADER_VERSION_V2:
+        if (m_applicationHeader.magic == HEADER_MAGIC_V2 && size >= HEADER_SIZE_V2) {
+          result = parseInternalHeaderV2(pBuffer);
+        }
+        break;
+
+      case HEADER_VERSION_V3:
+        if (m_applicationHeader.magic == HEADER_MAGIC_V2 && size >= HEADER_SIZE_V3) {
+          result = parseInternalHeaderV3(pBuffer);
+        }
+        break;
+
+      // Other firmware header versions can be supported here
+      default:
+        break;
+    }
+  }
+
+  m_applicationHeader.initialized = true;
+  if (result == UC_ERR_NONE) {
+    // the header is valid, the image itself is not checked yet
+    m_applicationHeader.state = NOT_CHECKED;
+  }
+  else {
+    m_applicationHeader.state = NOT_VALID;
+  }
+
+  return result;
+}
+
 int32_t MbedApplication::parseInternalHeaderV2(const uint8_t *pBuffer) {
   // we expect pBuffer to contain the entire header (version 2)
   int32_t result = UC_ERR_INVALID_HEADER;
@@ -309,6 +587,7 @@ int32_t MbedApplication::parseInternalHeaderV2(const uint8_t *pBuffer) {
     uint32_t temp32 = parseUint32(&pBuffer[HEADER_CRC_OFFSET_V2]);
 
     if (temp32 == calculatedChecksum) {
+      m_applicationHeader.checksum = temp32;
       // parse content 
       m_applicationHeader.firmwareVersion = parseUint64(&pBuffer[FIRMWARE_VERSION_OFFSET_V2]);
       m_applicationHeader.firmwareSize = parseUint64(&pBuffer[FIRMWARE_SIZE_OFFSET_V2]);
@@ -318,6 +597,11 @@ int32_t MbedApplication::parseInternalHeaderV2(const uint8_t *pBuffer) {
       
       memcpy(m_applicationHeader.hash, &pBuffer[HASH_OFFSET_V2], SHA256_SIZE);
       memcpy(m_applicationHeader.campaign, &pBuffer[CAMPAIGN_OFFSET_V2], GUID_SIZE);
+      m_applicationHeader.signatureSize = parseUint32(&pBuffer[SIGNATURE_SIZE_OFFSET_V2]);
+
+      // the image is stored as is
+      m_applicationHeader.payloadSize = m_applicationHeader.firmwareSize;
+      m_applicationHeader.compression = COMPRESSION_NONE;
 
       // set result
       result = UC_ERR_NONE;
@@ -330,6 +614,84 @@ int32_t MbedApplication::parseInternalHeaderV2(const uint8_t *pBuffer) {
   return result;
 }
 
+int32_t MbedApplication::parseInternalHeaderV3(const uint8_t *pBuffer) {
+  // the version 3 header is the version 2 header followed by the description of
+  // the payload, which is the compressed image
+  int32_t result = UC_ERR_INVALID_HEADER;
+
+  if (pBuffer != NULL) {
+    uint32_t calculatedChecksum = crc32(pBuffer, HEADER_CRC_OFFSET_V3);
+    uint32_t temp32 = parseUint32(&pBuffer[HEADER_CRC_OFFSET_V3]);
+
+    if (temp32 == calculatedChecksum) {
+      m_applicationHeader.checksum = temp32;
+      m_applicationHeader.firmwareVersion = parseUint64(&pBuffer[FIRMWARE_VERSION_OFFSET_V2]);
+      m_applicationHeader.firmwareSize = parseUint64(&pBuffer[FIRMWARE_SIZE_OFFSET_V2]);
+      memcpy(m_applicationHeader.hash, &pBuffer[HASH_OFFSET_V2], SHA256_SIZE);
+      memcpy(m_applicationHeader.campaign, &pBuffer[CAMPAIGN_OFFSET_V2], GUID_SIZE);
+      m_applicationHeader.signatureSize = parseUint32(&pBuffer[SIGNATURE_SIZE_OFFSET_V2]);
+      m_applicationHeader.payloadSize = parseUint64(&pBuffer[PAYLOAD_SIZE_OFFSET_V3]);
+      m_applicationHeader.compression = parseUint32(&pBuffer[COMPRESSION_OFFSET_V3]);
+
+      tr_debug(" headerVersion %d, firmwareVersion %lld, firmwareSize %lld, payloadSize %lld, compression 0x%08x", 
+               m_applicationHeader.headerVersion, m_applicationHeader.firmwareVersion, m_applicationHeader.firmwareSize,
+               m_applicationHeader.payloadSize, m_applicationHeader.compression); 
+
+      // the payload must be readable by this bootloader
+      if (m_applicationHeader.compression == COMPRESSION_NONE) {
+        result = (m_applicationHeader.payloadSize == m_applicationHeader.firmwareSize) ? UC_ERR_NONE : UC_ERR_INVALID_HEADER;
+      }
+      else if ((m_applicationHeader.compression & COMPRESSION_DELTA) != 0) {
+        // a delta payload is only received, the rebuilt image is stored
+        result = DeltaPatcher::isSupported(m_applicationHeader.compression) ? UC_ERR_NONE : UC_ERR_INVALID_PATCH;
+      }
+      else {
+        result = Decompressor::isSupported(m_applicationHeader.compression) ? UC_ERR_NONE : UC_ERR_DECOMPRESSION_FAILED;
+      }
+    }
+    else {
+      result = UC_ERR_INVALID_CHECKSUM;
+    }
+  }
+
+  return result;
+}
+
+int32_t MbedApplication::getInstalledHeader(uint8_t* pBuffer, uint32_t size, uint8_t eraseValue) {
+  if (! m_applicationHeader.initialized) {
+    readApplicationHeader();
+  }
+  if (pBuffer == NULL || size < HEADER_SIZE_V2 || m_applicationHeader.state == NOT_VALID) {
+    return UC_ERR_INVALID_HEADER;
+  }
+
+  // version 2 header describing the decompressed image
+  memset(pBuffer, eraseValue, size);
+  memset(pBuffer, 0, HEADER_SIZE_V2);
+  writeUint32(&pBuffer[0], m_applicationHeader.magic);
+  writeUint32(&pBuffer[4], HEADER_VERSION_V2);
+  writeUint64(&pBuffer[FIRMWARE_VERSION_OFFSET_V2], m_applicationHeader.firmwareVersion);
+  writeUint64(&pBuffer[FIRMWARE_SIZE_OFFSET_V2], m_applicationHeader.firmwareSize);
+  memcpy(&pBuffer[HASH_OFFSET_V2], m_applicationHeader.hash, SHA256_SIZE);
+  memcpy(&pBuffer[CAMPAIGN_OFFSET_V2], m_applicationHeader.campaign, GUID_SIZE);
+  writeUint32(&pBuffer[SIGNATURE_SIZE_OFFSET_V2], m_applicationHeader.signatureSize);
+  writeUint32(&pBuffer[HEADER_CRC_OFFSET_V2], crc32(pBuffer, HEADER_CRC_OFFSET_V2));
+
+  return UC_ERR_NONE;
+}
+
+uint32_t MbedApplication::parseUint32LittleEndian(const uint8_t* pBuffer) {
+  uint32_t result = 0;
+  if (pBuffer) {
+    result = pBuffer[3];
+    result = (result << 8) | pBuffer[2];
+    result = (result << 8) | pBuffer[1];
+    result = (result << 8) | pBuffer[0];
+  }
+
+  return result;
+}
+
 uint32_t MbedApplication::parseUint32(const uint8_t* pBuffer) {
   uint32_t result = 0;
   if (pBuffer) {
@@ -342,6 +704,18 @@ uint32_t MbedApplication::parseUint32(const uint8_t* pBuffer) {
   return result;
 }
 
+void MbedApplication::writeUint32(uint8_t* pBuffer, uint32_t value) {
+  pBuffer[0] = value >> 24;
+  pBuffer[1] = value >> 16;
+  pBuffer[2] = value >> 8;
+  pBuffer[3] = value;
+}
+
+void MbedApplication::writeUint64(uint8_t* pBuffer, uint64_t value) {
+  writeUint32(&pBuffer[0], (uint32_t) (value >> 32));
+  writeUint32(&pBuffer[4], (uint32_t) value);
+}
+
 uint64_t MbedApplication::parseUint64(const uint8_t *pBuffer) {
   uint64_t result = 0;
   if (pBuffer) {
@@ -359,24 +733,8 @@ uint64_t MbedApplication::parseUint64(const uint8_t *pBuffer) {
 }
 
 uint32_t MbedApplication::crc32(const uint8_t *pBuffer, uint32_t length) {
-  const uint8_t *pCurrent = pBuffer;
-  uint32_t crc = 0xFFFFFFFF;
-
-  while (length--) {
-    crc ^= *pCurrent;
-    pCurrent++;
-
-    for (uint32_t counter = 0; counter < 8; counter++) {
-      if (crc & 1) {
-        crc = (crc >> 1) ^ 0xEDB88320;
-      }
-      else {
-        crc = crc >> 1;
-      }
-    }
-  }
-
-  return (crc ^ 0xFFFFFFFF);
+  // the implementation is selected with update-client.crc32-engine
+  return Crc32::compute(pBuffer, length);
 }
 
 } // namesapce
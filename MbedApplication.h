@@ -1,9 +1,12 @@
 #pragma once
 
+#if !defined(UPDATE_CLIENT_FLASH_SIMULATOR)
 #include "mbed.h"
+#endif
 #include <cstdint>
 
 #include "FlashUpdater.h"
+#include "VerificationRecord.h"
 
 namespace update_client {
 
@@ -11,25 +14,58 @@ class MbedApplication {
 public:
   MbedApplication(FlashUpdater& flashUpdater, uint32_t applicationHeaderAddress, uint32_t applicationAddress);
 
+  // full validation: the header and the hash of the image (computed once)
   bool isValid();
+  // header only validation: a non empty application with a valid header, whose image
+  // is not known to be invalid. The image is not read
+  bool hasValidHeader();
+  uint32_t getApplicationAddress() const;
   uint64_t getFirmwareVersion();
   uint64_t getFirmwareSize();
+  // size of the image as stored after the header and its compression (see Decompressor.h),
+  // the firmware size and the hash are the ones of the decompressed image
+  uint64_t getPayloadSize();
+  uint32_t getCompression();
+  // builds the header of the installed (decompressed) application, in a header area
+  // of the given size that is padded with the erase value
+  int32_t getInstalledHeader(uint8_t* pBuffer, uint32_t size, uint8_t eraseValue);
   bool isNewerThan(MbedApplication& otherApplication);
+  // compares the headers (version, size and hash) of both applications, without reading the images
+  bool hasSameImage(MbedApplication& otherApplication);
+  // compares the size and hash of the image with the ones in the header, without reading the image
+  bool hasImage(uint64_t firmwareSize, const uint8_t* pHash);
   int32_t checkApplication();
+  // validates the application against a hash calculated while the image was
+  // received or copied, instead of reading the image again
+  int32_t checkApplicationHash(const uint8_t* pCalculatedHash);
+  // parses a header received in a buffer (e.g. during a download) rather than reading it from flash
+  int32_t parseApplicationHeader(const uint8_t* pBuffer, uint32_t size);
   void compareTo(MbedApplication& otherApplication);
+  // checks that the vector table of the application points into the application, i.e. that
+  // the application was linked for its address and can be started where it is stored
+  int32_t checkBootable();
+  // use a verification record to avoid hashing an application that did not change since its last verification
+  void setVerificationRecord(VerificationRecord* pVerificationRecord);
   
 private:
   int32_t readApplicationHeader();
   int32_t parseInternalHeaderV2(const uint8_t *pBuffer);
+  int32_t parseInternalHeaderV3(const uint8_t *pBuffer);
+  int32_t compareHash(const uint8_t* pCalculatedHash);
   
   static uint32_t parseUint32(const uint8_t *pBuffer);
   static uint64_t parseUint64(const uint8_t *pBuffer);
+  static void writeUint32(uint8_t* pBuffer, uint32_t value);
+  static void writeUint64(uint8_t* pBuffer, uint64_t value);
+  // the vector table is stored in the byte order of the target (little endian)
+  static uint32_t parseUint32LittleEndian(const uint8_t *pBuffer);
   static uint32_t crc32(const uint8_t *pBuffer, uint32_t length);
 
   // data members
   FlashUpdater& m_flashUpdater;
   const uint32_t m_applicationHeaderAddress;
   const uint32_t m_applicationAddress;
+  VerificationRecord* m_pVerificationRecord;
 
   // application header
   // GUID type  
@@ -53,7 +89,10 @@ private:
     uint64_t firmwareSize;
     hash_t hash;
     guid_t campaign;
+    uint32_t checksum;
     uint32_t signatureSize;
+    uint64_t payloadSize;
+    uint32_t compression;
     uint8_t signature[0];
     ApplicationState state;
   };
@@ -72,12 +111,21 @@ private:
   static const uint32_t CAMPAIGN_OFFSET_V2 = 88;
   static const uint32_t SIGNATURE_SIZE_OFFSET_V2 = 104;
   static const uint32_t HEADER_CRC_OFFSET_V2 = 108;
+  // version 3: version 2 fields followed by the payload size and compression
+  static const uint32_t HEADER_VERSION_V3 = 3;
+  static const uint32_t HEADER_SIZE_V3 = 124;
+  static const uint32_t PAYLOAD_SIZE_OFFSET_V3 = 108;
+  static const uint32_t COMPRESSION_OFFSET_V3 = 116;
+  static const uint32_t HEADER_CRC_OFFSET_V3 = 120;
+
+  // entries of the vector table at the start of the application
+  static const uint32_t INITIAL_STACK_POINTER_OFFSET = 0;
+  static const uint32_t RESET_HANDLER_OFFSET = 4;
 
   // other constants
   static const uint32_t SIZEOF_SHA256 = (256/8);
-  static const uint32_t BUFFER_SIZE = 256;
-  // buffer used in storage operations 
-  uint8_t m_buffer[BUFFER_SIZE];
+  // size of the buffer used in storage operations when the flash cannot be read directly
+  static const uint32_t READ_BUFFER_SIZE = MBED_CONF_UPDATE_CLIENT_READ_BUFFER_SIZE;
 };
 
 } // namespace
\ No newline at end of file
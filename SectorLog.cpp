@@ -0,0 +1,106 @@
+#include "SectorLog.h"
+#include "UCErrorCodes.h"
+#include "Crc32.h"
+
+#if MBED_CONF_MBED_TRACE_ENABLE
+#include "mbed_trace.h"
+#define TRACE_GROUP "SectorLog"
+#endif // MBED_CONF_MBED_TRACE_ENABLE
+
+namespace update_client {
+
+SectorLog::SectorLog(FlashUpdater& flashUpdater, uint32_t sectorAddress, uint32_t magic, uint32_t dataSize) :
+  m_flashUpdater(flashUpdater),
+  m_sectorAddress(sectorAddress),
+  m_magic(magic),
+  m_dataSize(dataSize),
+  m_entrySlotSize(0),
+  m_nbrOfEntrySlots(0),
+  m_nextEntrySlot(0) {
+}
+
+bool SectorLog::isEnabled() const {
+  return m_sectorAddress != 0;
+}
+
+int32_t SectorLog::load(void* pData, bool& found) {
+  found = false;
+  const uint32_t pageSize = m_flashUpdater.get_page_size();
+  const uint32_t sectorSize = m_flashUpdater.getSectorSize(m_sectorAddress);
+  if (sectorSize == 0 || m_flashUpdater.alignAddressToSector(m_sectorAddress, true) != m_sectorAddress) {
+    tr_error("Sector log address 0x%08x is not a sector address", m_sectorAddress);
+    return UC_ERR_READING_FLASH;
+  }
+  const uint32_t entrySize = MAGIC_SIZE + m_dataSize + CHECKSUM_SIZE;
+  m_entrySlotSize = ((entrySize + pageSize - 1) / pageSize) * pageSize;
+  m_nbrOfEntrySlots = sectorSize / m_entrySlotSize;
+
+  // an erased magic marks the end of the entries written in the sector
+  uint32_t erasedMagic = 0;
+  memset(&erasedMagic, m_flashUpdater.get_erase_value(), sizeof(erasedMagic));
+
+  // keep the last valid entry found in the sector
+  m_nextEntrySlot = m_nbrOfEntrySlots;
+  std::unique_ptr<uint8_t[]> entryBuffer(new uint8_t[entrySize]);
+  for (uint32_t entrySlot = 0; entrySlot < m_nbrOfEntrySlots; entrySlot++) {
+    int err = m_flashUpdater.read(entryBuffer.get(), m_sectorAddress + entrySlot * m_entrySlotSize, entrySize);
+    if (0 != err) {
+      tr_error("Flash read failed: %d", err);
+      return UC_ERR_READING_FLASH;
+    }
+    uint32_t magic = 0;
+    memcpy(&magic, entryBuffer.get(), MAGIC_SIZE);
+    if (magic == erasedMagic) {
+      m_nextEntrySlot = entrySlot;
+      break;
+    }
+    // entries that were not completely written are skipped
+    uint32_t checksum = 0;
+    memcpy(&checksum, entryBuffer.get() + MAGIC_SIZE + m_dataSize, CHECKSUM_SIZE);
+    if (magic == m_magic && checksum == computeChecksum(entryBuffer.get())) {
+      memcpy(pData, entryBuffer.get() + MAGIC_SIZE, m_dataSize);
+      found = true;
+    }
+  }
+
+  return UC_ERR_NONE;
+}
+
+int32_t SectorLog::append(const void* pData) {
+  if (m_nbrOfEntrySlots == 0) {
+    tr_error("Sector log at 0x%08x is not loaded", m_sectorAddress);
+    return UC_ERR_WRITE_FAILED;
+  }
+
+  // erase the sector only when it is full
+  if (m_nextEntrySlot >= m_nbrOfEntrySlots) {
+    int err = m_flashUpdater.erase(m_sectorAddress, m_flashUpdater.getSectorSize(m_sectorAddress));
+    if (0 != err) {
+      tr_error("Flash erase failed: %d", err);
+      return UC_ERR_WRITE_FAILED;
+    }
+    m_nextEntrySlot = 0;
+  }
+
+  // the entry is programmed in full pages
+  std::unique_ptr<uint8_t[]> entryBuffer(new uint8_t[m_entrySlotSize]);
+  memset(entryBuffer.get(), m_flashUpdater.get_erase_value(), m_entrySlotSize);
+  memcpy(entryBuffer.get(), &m_magic, MAGIC_SIZE);
+  memcpy(entryBuffer.get() + MAGIC_SIZE, pData, m_dataSize);
+  const uint32_t checksum = computeChecksum(entryBuffer.get());
+  memcpy(entryBuffer.get() + MAGIC_SIZE + m_dataSize, &checksum, CHECKSUM_SIZE);
+  int err = m_flashUpdater.program(entryBuffer.get(), m_sectorAddress + m_nextEntrySlot * m_entrySlotSize, m_entrySlotSize);
+  if (0 != err) {
+    tr_error("Flash program failed: %d", err);
+    return UC_ERR_WRITE_FAILED;
+  }
+  m_nextEntrySlot++;
+
+  return UC_ERR_NONE;
+}
+
+uint32_t SectorLog::computeChecksum(const uint8_t* pEntry) const {
+  return Crc32::compute(pEntry, MAGIC_SIZE + m_dataSize);
+}
+
+} // namespace
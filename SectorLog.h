@@ -0,0 +1,50 @@
+#pragma once
+
+#if !defined(UPDATE_CLIENT_FLASH_SIMULATOR)
+#include "mbed.h"
+#endif
+#include <cstdint>
+
+#include "FlashUpdater.h"
+
+namespace update_client {
+
+// SectorLog keeps the last version of a small fixed size structure in a reserved
+// flash sector, for the verification record and the download journal. Each version
+// is appended after the previous one, so that the sector is only erased when it is
+// full. An entry is stored in full pages as a magic, the data and a CRC32 of both:
+// an erased magic marks the end of the entries and an entry that was not completely
+// written (e.g. on a reset) fails its CRC and is skipped.
+
+class SectorLog {
+public:
+  // the sector at address 0 disables the log
+  SectorLog(FlashUpdater& flashUpdater, uint32_t sectorAddress, uint32_t magic, uint32_t dataSize);
+
+  bool isEnabled() const;
+  // reads the sector, copies the data of the last valid entry to pData and sets found,
+  // pData is left unchanged when there is none. Must be called before append()
+  int32_t load(void* pData, bool& found);
+  // writes the data as the last entry, the sector is erased first if it is full
+  int32_t append(const void* pData);
+
+private:
+  uint32_t computeChecksum(const uint8_t* pEntry) const;
+
+  static const uint32_t MAGIC_SIZE = sizeof(uint32_t);
+  static const uint32_t CHECKSUM_SIZE = sizeof(uint32_t);
+
+  // data members
+  FlashUpdater& m_flashUpdater;
+  const uint32_t m_sectorAddress;
+  const uint32_t m_magic;
+  const uint32_t m_dataSize;
+  // size of an entry in the sector (rounded up to the page size)
+  uint32_t m_entrySlotSize;
+  // number of entries that fit in the sector
+  uint32_t m_nbrOfEntrySlots;
+  // index where the next entry is written
+  uint32_t m_nextEntrySlot;
+};
+
+} // namespace
@@ -0,0 +1,56 @@
+#include "SerialTransport.h"
+#include <chrono>
+
+namespace update_client {
+
+#if defined(UPDATE_DOWNLOAD) && DEVICE_SERIAL
+
+SerialTransport::SerialTransport(PinName tx, PinName rx, int baudRate) :
+  m_serial(tx, rx, baudRate) {
+  m_serial.sigio(callback(this, &SerialTransport::onSerialEvent));
+}
+
+bool SerialTransport::connected() {
+  return true;
+}
+
+bool SerialTransport::waitForData(uint32_t timeout) {
+  if (m_serial.readable()) {
+    return true;
+  }
+  // the event is also signaled when the data is transmitted, check again on wake up
+  uint32_t flags = m_events.wait_any_for(SERIAL_EVENT_FLAG | INTERRUPT_EVENT_FLAG, std::chrono::milliseconds(timeout));
+
+  return (flags & osFlagsError) == 0 && (flags & SERIAL_EVENT_FLAG) != 0 && m_serial.readable();
+}
+
+uint32_t SerialTransport::read(uint8_t* pBuffer, uint32_t size) {
+  // the port is blocking, it is only read when data is available: the read
+  // then returns the data in the receive buffer without waiting
+  if (! m_serial.readable()) {
+    return 0;
+  }
+  ssize_t readSize = m_serial.read(pBuffer, size);
+
+  return (readSize > 0) ? (uint32_t) readSize : 0;
+}
+
+bool SerialTransport::write(const uint8_t* pData, uint32_t size) {
+  return m_serial.write(pData, size) == (ssize_t) size;
+}
+
+void SerialTransport::interrupt() {
+  m_events.set(INTERRUPT_EVENT_FLAG);
+}
+
+void SerialTransport::clearInterrupt() {
+  m_events.clear(INTERRUPT_EVENT_FLAG);
+}
+
+void SerialTransport::onSerialEvent() {
+  m_events.set(SERIAL_EVENT_FLAG);
+}
+
+#endif
+
+} // namespace
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "mbed.h"
+
+#include "DownloadTransport.h"
+
+namespace update_client {
+
+#if defined(UPDATE_DOWNLOAD) && DEVICE_SERIAL
+
+// transport over a UART: the serial port signals the data received, a UART
+// has no connection state so the host is always considered connected
+
+class SerialTransport :
+  public DownloadTransport {
+public:
+  SerialTransport(PinName tx, PinName rx, int baudRate);
+
+  // DownloadTransport implementation
+  virtual bool connected();
+  virtual bool waitForData(uint32_t timeout);
+  virtual uint32_t read(uint8_t* pBuffer, uint32_t size);
+  virtual bool write(const uint8_t* pData, uint32_t size);
+  virtual void interrupt();
+  virtual void clearInterrupt();
+
+private:
+  // called by the serial driver (in interrupt context) when its state changes
+  void onSerialEvent();
+
+  // data members
+  BufferedSerial m_serial;
+  enum {
+    SERIAL_EVENT_FLAG = 1,
+    INTERRUPT_EVENT_FLAG = 2
+  };
+  EventFlags m_events;
+};
+
+#endif
+
+} // namespace
@@ -0,0 +1,107 @@
+#include "SocketTransport.h"
+
+#if defined(UPDATE_DOWNLOAD) && defined(UPDATE_CLIENT_FLASH_SIMULATOR)
+
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace update_client {
+
+SocketTransport::SocketTransport(int fd) :
+  m_fd(fd),
+  m_connected(fd >= 0) {
+  if (pipe(m_interruptPipe) != 0) {
+    m_interruptPipe[0] = -1;
+    m_interruptPipe[1] = -1;
+  }
+  for (uint32_t index = 0; index < 2; index++) {
+    if (m_interruptPipe[index] >= 0) {
+      fcntl(m_interruptPipe[index], F_SETFL, fcntl(m_interruptPipe[index], F_GETFL) | O_NONBLOCK);
+    }
+  }
+}
+
+SocketTransport::~SocketTransport() {
+  for (uint32_t index = 0; index < 2; index++) {
+    if (m_interruptPipe[index] >= 0) {
+      close(m_interruptPipe[index]);
+    }
+  }
+}
+
+bool SocketTransport::connected() {
+  return m_connected;
+}
+
+bool SocketTransport::waitForData(uint32_t timeout) {
+  // once the peer is gone, only an interrupt ends the wait (poll ignores negative descriptors)
+  struct pollfd fds[2] = { { m_connected ? m_fd : -1, POLLIN, 0 }, { m_interruptPipe[0], POLLIN, 0 } };
+  int result = poll(fds, 2, (int) timeout);
+  if (result <= 0) {
+    return false;
+  }
+  // the interrupt is consumed by the wait it ends
+  if ((fds[1].revents & POLLIN) != 0) {
+    clearInterrupt();
+    return false;
+  }
+  // a hang up is reported by the next read
+  return (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) != 0;
+}
+
+uint32_t SocketTransport::read(uint8_t* pBuffer, uint32_t size) {
+  // only the data available is read, so that the read never blocks
+  struct pollfd fds = { m_fd, POLLIN, 0 };
+  if (! m_connected || poll(&fds, 1, 0) <= 0) {
+    return 0;
+  }
+  ssize_t readSize = ::read(m_fd, pBuffer, size);
+  if (readSize == 0 || (readSize < 0 && errno != EINTR && errno != EAGAIN)) {
+    // the peer closed the connection (or a pty lost its slave side)
+    m_connected = false;
+    return 0;
+  }
+
+  return (readSize > 0) ? (uint32_t) readSize : 0;
+}
+
+bool SocketTransport::write(const uint8_t* pData, uint32_t size) {
+  while (size > 0 && m_connected) {
+    // a socket closed by the peer must not raise SIGPIPE, a pty is not a socket
+    ssize_t writeSize = send(m_fd, pData, size, MSG_NOSIGNAL);
+    if (writeSize < 0 && errno == ENOTSOCK) {
+      writeSize = ::write(m_fd, pData, size);
+    }
+    if (writeSize < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      m_connected = false;
+      return false;
+    }
+    pData += writeSize;
+    size -= (uint32_t) writeSize;
+  }
+
+  return size == 0;
+}
+
+void SocketTransport::interrupt() {
+  const uint8_t interrupt = 1;
+  if (::write(m_interruptPipe[1], &interrupt, sizeof(interrupt)) < 0) {
+    // the pipe is full, a wake up is already pending
+  }
+}
+
+void SocketTransport::clearInterrupt() {
+  uint8_t interrupts[16];
+  while (m_interruptPipe[0] >= 0 && ::read(m_interruptPipe[0], interrupts, sizeof(interrupts)) > 0) {
+  }
+}
+
+} // namespace
+
+#endif
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+
+#include "DownloadTransport.h"
+
+namespace update_client {
+
+#if defined(UPDATE_DOWNLOAD) && defined(UPDATE_CLIENT_FLASH_SIMULATOR)
+
+// transport over a file descriptor on the host: a connected socket or the
+// master side of a pty. It runs the download session against the flash
+// simulator, e.g. for soak testing the download throughput without hardware.
+// The host is connected until the peer closes its side.
+
+class SocketTransport :
+  public DownloadTransport {
+public:
+  // the transport does not own the file descriptor
+  explicit SocketTransport(int fd);
+  ~SocketTransport();
+
+  // DownloadTransport implementation
+  virtual bool connected();
+  virtual bool waitForData(uint32_t timeout);
+  virtual uint32_t read(uint8_t* pBuffer, uint32_t size);
+  virtual bool write(const uint8_t* pData, uint32_t size);
+  virtual void interrupt();
+  virtual void clearInterrupt();
+
+private:
+  // data members
+  const int m_fd;
+  // written by interrupt() for waking up waitForData()
+  int m_interruptPipe[2];
+  volatile bool m_connected;
+};
+
+#endif
+
+} // namespace
@@ -0,0 +1,181 @@
+#pragma once
+
+#include <cstdint>
+
+// Compile-time flash layout, for targets whose sector map and storage configuration
+// are known at build time. It is enabled by setting the sector-map configuration
+// option (MBED_CONF_UPDATE_CLIENT_SECTOR_MAP) to one of the sector maps below, e.g.
+//   "update-client.sector-map": "update_client::SectorMapSTM32F4_1MB"
+// FlashUpdater then takes its sector index from the map instead of walking the
+// sector map through the flash driver, and CandidateApplications takes the slot
+// table from StaticSlotLayout. Layouts that are not sector aligned, that do not
+// fit in the flash or that have empty slots fail the build.
+
+namespace update_client {
+
+// a run of consecutive sectors of the same size
+template <uint32_t SectorSize, uint32_t NbrOfSectors>
+struct StaticSectorRun {
+  static constexpr uint32_t SECTOR_SIZE = SectorSize;
+  static constexpr uint32_t NBR_OF_SECTORS = NbrOfSectors;
+
+  static_assert(SectorSize > 0 && NbrOfSectors > 0, "Sector runs cannot be empty");
+};
+
+// sector map of a flash starting at FlashStart, made of the sector runs in address order
+template <uint32_t FlashStart, typename... Runs>
+struct StaticSectorMap {
+  static constexpr uint32_t FLASH_START = FlashStart;
+  static constexpr uint32_t NBR_OF_RUNS = sizeof...(Runs);
+
+  static_assert(sizeof...(Runs) > 0, "The sector map needs at least one sector run");
+
+  static constexpr uint32_t getRunSectorSize(uint32_t runIndex) {
+    const uint32_t sectorSizes[] = { Runs::SECTOR_SIZE... };
+    return sectorSizes[runIndex];
+  }
+
+  static constexpr uint32_t getRunNbrOfSectors(uint32_t runIndex) {
+    const uint32_t nbrOfSectors[] = { Runs::NBR_OF_SECTORS... };
+    return nbrOfSectors[runIndex];
+  }
+
+  static constexpr uint32_t getFlashSize() {
+    uint32_t flashSize = 0;
+    for (uint32_t runIndex = 0; runIndex < NBR_OF_RUNS; runIndex++) {
+      flashSize += getRunSectorSize(runIndex) * getRunNbrOfSectors(runIndex);
+    }
+    return flashSize;
+  }
+
+  static constexpr uint32_t getFlashEnd() {
+    return FLASH_START + getFlashSize();
+  }
+
+  // returns the size of the sector containing the address (0 if outside of the flash)
+  static constexpr uint32_t getSectorSize(uint32_t address) {
+    uint32_t runAddress = FLASH_START;
+    for (uint32_t runIndex = 0; runIndex < NBR_OF_RUNS; runIndex++) {
+      const uint32_t runSize = getRunSectorSize(runIndex) * getRunNbrOfSectors(runIndex);
+      if (address >= runAddress && address < runAddress + runSize) {
+        return getRunSectorSize(runIndex);
+      }
+      runAddress += runSize;
+    }
+    return 0;
+  }
+
+  // same as FlashUpdater::alignAddressToSector: addresses out of the flash are
+  // pinned to the flash boundaries
+  static constexpr uint32_t alignAddressToSector(uint32_t address, bool roundDown) {
+    if (address <= FLASH_START) {
+      return FLASH_START;
+    }
+    if (address >= getFlashEnd()) {
+      return getFlashEnd();
+    }
+    uint32_t runAddress = FLASH_START;
+    for (uint32_t runIndex = 0; runIndex < NBR_OF_RUNS; runIndex++) {
+      const uint32_t sectorSize = getRunSectorSize(runIndex);
+      const uint32_t runSize = sectorSize * getRunNbrOfSectors(runIndex);
+      if (address < runAddress + runSize) {
+        const uint32_t sectorAddress = runAddress + ((address - runAddress) / sectorSize) * sectorSize;
+        return (roundDown || sectorAddress == address) ? sectorAddress : sectorAddress + sectorSize;
+      }
+      runAddress += runSize;
+    }
+    return getFlashEnd();
+  }
+
+  static constexpr bool isSectorAligned(uint32_t address) {
+    return address >= FLASH_START && address <= getFlashEnd() &&
+           alignAddressToSector(address, true) == address;
+  }
+
+  // number of sectors from the (sector aligned) start address to the end address
+  static constexpr uint32_t countSectors(uint32_t startAddress, uint32_t endAddress) {
+    uint32_t nbrOfSectors = 0;
+    for (uint32_t address = startAddress; address < endAddress && getSectorSize(address) != 0;
+         address += getSectorSize(address)) {
+      nbrOfSectors++;
+    }
+    return nbrOfSectors;
+  }
+};
+
+// sector maps of the supported target families
+// STM32F4 with 1 MB of flash (e.g. STM32F401xE/F411xE/F446xE with 512 KB use the first runs only)
+typedef StaticSectorMap<0x08000000UL,
+                        StaticSectorRun<16 * 1024, 4>,
+                        StaticSectorRun<64 * 1024, 1>,
+                        StaticSectorRun<128 * 1024, 7> > SectorMapSTM32F4_1MB;
+// STM32F42x/F43x with 2 MB of flash in two banks
+typedef StaticSectorMap<0x08000000UL,
+                        StaticSectorRun<16 * 1024, 4>,
+                        StaticSectorRun<64 * 1024, 1>,
+                        StaticSectorRun<128 * 1024, 7>,
+                        StaticSectorRun<16 * 1024, 4>,
+                        StaticSectorRun<64 * 1024, 1>,
+                        StaticSectorRun<128 * 1024, 7> > SectorMapSTM32F4_2MB;
+// STM32L4 with 1 MB of flash (2 KB pages)
+typedef StaticSectorMap<0x08000000UL,
+                        StaticSectorRun<2 * 1024, 512> > SectorMapSTM32L4_1MB;
+// nRF52840 (4 KB pages)
+typedef StaticSectorMap<0x00000000UL,
+                        StaticSectorRun<4 * 1024, 256> > SectorMapNRF52840;
+
+// slot table of the storage area, computed as CandidateApplications does at runtime:
+// the storage is split in NbrOfSlots slots of equal size, each rounded down to the sectors
+template <typename SectorMap, uint32_t StorageAddress, uint32_t StorageSize, uint32_t NbrOfSlots>
+struct StaticSlotTable {
+  static constexpr uint32_t NBR_OF_SLOTS = NbrOfSlots;
+  static constexpr uint32_t STORAGE_START = StorageAddress;
+  static constexpr uint32_t STORAGE_END = StorageAddress + StorageSize;
+  static constexpr uint32_t MAX_SLOT_SIZE = (NbrOfSlots > 0) ? StorageSize / NbrOfSlots : 0;
+
+  static constexpr uint32_t getSlotStart(uint32_t slotIndex) {
+    return SectorMap::alignAddressToSector(STORAGE_START + slotIndex * MAX_SLOT_SIZE, true);
+  }
+
+  static constexpr uint32_t getSlotEnd(uint32_t slotIndex) {
+    return SectorMap::alignAddressToSector(getSlotStart(slotIndex) + MAX_SLOT_SIZE, true);
+  }
+
+  static constexpr uint32_t getSlotSize(uint32_t slotIndex) {
+    return getSlotEnd(slotIndex) - getSlotStart(slotIndex);
+  }
+
+  static constexpr uint32_t getNbrOfSectors(uint32_t slotIndex) {
+    return SectorMap::countSectors(getSlotStart(slotIndex), getSlotEnd(slotIndex));
+  }
+
+  // every slot spans at least one sector, within the storage and after the previous slot
+  static constexpr bool hasValidSlots() {
+    uint32_t previousEnd = STORAGE_START;
+    for (uint32_t slotIndex = 0; slotIndex < NbrOfSlots; slotIndex++) {
+      if (getSlotStart(slotIndex) < previousEnd || getSlotEnd(slotIndex) > STORAGE_END ||
+          getNbrOfSectors(slotIndex) == 0) {
+        return false;
+      }
+      previousEnd = getSlotEnd(slotIndex);
+    }
+    return true;
+  }
+};
+
+// the slot table, checked when it is instantiated
+template <typename SectorMap, uint32_t StorageAddress, uint32_t StorageSize, uint32_t NbrOfSlots>
+struct StaticSlotLayout :
+  public StaticSlotTable<SectorMap, StorageAddress, StorageSize, NbrOfSlots> {
+  typedef StaticSlotTable<SectorMap, StorageAddress, StorageSize, NbrOfSlots> Table;
+
+  static_assert(NbrOfSlots > 0, "The storage needs at least one slot");
+  static_assert(StorageSize > 0, "The storage size is not configured");
+  static_assert(StorageAddress >= SectorMap::FLASH_START && StorageAddress + StorageSize <= SectorMap::getFlashEnd(),
+                "The storage does not fit in the flash");
+  static_assert(SectorMap::isSectorAligned(StorageAddress), "The storage address is not sector aligned");
+  static_assert(SectorMap::isSectorAligned(StorageAddress + StorageSize), "The end of the storage is not sector aligned");
+  static_assert(Table::hasValidSlots(), "The storage is too small for the number of slots or the slots overlap");
+};
+
+} // namespace
@@ -10,7 +10,16 @@ enum UC_RETURN_CODES {
   UC_ERR_READING_FLASH = -3,
   UC_ERR_HASH_INVALID = -4,
   UC_ERR_FIRMWARE_EMPTY = -5,
-  UC_ERR_WRITE_FAILED = -6
+  UC_ERR_WRITE_FAILED = -6,
+  UC_ERR_INVALID_FRAME = -7,
+  UC_ERR_FIRMWARE_TOO_LARGE = -8,
+  UC_ERR_TRANSFER_INCOMPLETE = -9,
+  UC_ERR_NOT_BOOTABLE = -10,
+  UC_ERR_DECOMPRESSION_FAILED = -11,
+  UC_ERR_INVALID_PATCH = -12,
+  UC_ERR_BASE_MISMATCH = -13,
+  UC_ERR_INVALID_SLOT = -14,
+  UC_ERR_DOWNLOAD_STOPPED = -15
 };
 
 }
\ No newline at end of file
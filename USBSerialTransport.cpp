@@ -0,0 +1,60 @@
+#include "USBSerialTransport.h"
+#include <chrono>
+
+namespace update_client {
+
+#if defined(UPDATE_DOWNLOAD)
+
+USBSerialTransport::USBSerialTransport() :
+  m_usbSerial(false) {
+  // the session waits for the data received instead of polling the endpoint
+  m_usbSerial.attach(callback(this, &USBSerialTransport::onDataReceived));
+}
+
+void USBSerialTransport::connect() {
+  m_usbSerial.connect();
+}
+
+bool USBSerialTransport::connected() {
+  return m_usbSerial.connected();
+}
+
+bool USBSerialTransport::waitForData(uint32_t timeout) {
+  if (m_usbSerial.available() > 0) {
+    return true;
+  }
+  uint32_t flags = m_events.wait_any_for(DATA_EVENT_FLAG | INTERRUPT_EVENT_FLAG, std::chrono::milliseconds(timeout));
+
+  return (flags & osFlagsError) == 0 && (flags & DATA_EVENT_FLAG) != 0;
+}
+
+uint32_t USBSerialTransport::read(uint8_t* pBuffer, uint32_t size) {
+  // only the data available is read, so that the read never blocks
+  uint32_t availableSize = m_usbSerial.available();
+  if (availableSize == 0) {
+    return 0;
+  }
+  ssize_t readSize = m_usbSerial.read(pBuffer, (availableSize < size) ? availableSize : size);
+
+  return (readSize > 0) ? (uint32_t) readSize : 0;
+}
+
+bool USBSerialTransport::write(const uint8_t* pData, uint32_t size) {
+  return m_usbSerial.write(pData, size) == (ssize_t) size;
+}
+
+void USBSerialTransport::interrupt() {
+  m_events.set(INTERRUPT_EVENT_FLAG);
+}
+
+void USBSerialTransport::clearInterrupt() {
+  m_events.clear(INTERRUPT_EVENT_FLAG);
+}
+
+void USBSerialTransport::onDataReceived() {
+  m_events.set(DATA_EVENT_FLAG);
+}
+
+#endif
+
+} // namespace
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "mbed.h"
+#include "USBSerial.h"
+
+#include "DownloadTransport.h"
+
+namespace update_client {
+
+#if defined(UPDATE_DOWNLOAD)
+
+// transport over USB CDC: the endpoint signals the data received, the host
+// is connected when its terminal is open (DTR)
+
+class USBSerialTransport :
+  public DownloadTransport {
+public:
+  USBSerialTransport();
+
+  // connects the USB device, without waiting for the host
+  void connect();
+
+  // DownloadTransport implementation
+  virtual bool connected();
+  virtual bool waitForData(uint32_t timeout);
+  virtual uint32_t read(uint8_t* pBuffer, uint32_t size);
+  virtual bool write(const uint8_t* pData, uint32_t size);
+  virtual void interrupt();
+  virtual void clearInterrupt();
+
+private:
+  // called by the USB stack (in interrupt context) when data is received
+  void onDataReceived();
+
+  // data members
+  USBSerial m_usbSerial;
+  enum {
+    DATA_EVENT_FLAG = 1,
+    INTERRUPT_EVENT_FLAG = 2
+  };
+  EventFlags m_events;
+};
+
+#endif
+
+} // namespace
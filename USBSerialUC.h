@@ -1,7 +1,9 @@
 #pragma once
 
 #include "mbed.h"
-#include "USBSerial.h"
+
+#include "DownloadSession.h"
+#include "USBSerialTransport.h"
 
 namespace update_client {
 
@@ -18,20 +20,24 @@ public:
   virtual void start();
   virtual void stop();
 
+  // number of bytes that were not transferred because the device already had the application
+  uint32_t getNbrOfSkippedBytes() const;
+  // time from the start of the last download to its first byte received, in ms
+  uint32_t getTimeToFirstByte() const;
+  // time taken by the last call to stop() for ending the downloader thread, in ms
+  uint32_t getStopLatency() const;
+
 private:
   // private method
   void downloadFirmware();
 
   // data members  
-  USBSerial m_usbSerial;
+  USBSerialTransport m_transport;
+  DownloadSession m_downloadSession;
   Thread m_downloaderThread;
-  enum { 
-    STOP_EVENT_FLAG = 1
-  };
-  EventFlags m_stopEvent;
+  uint32_t m_stopLatency;
 };
 
 #endif
 
 } // namespace
-
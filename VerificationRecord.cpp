@@ -0,0 +1,139 @@
+#include "VerificationRecord.h"
+#include "UCErrorCodes.h"
+
+#if MBED_CONF_MBED_TRACE_ENABLE
+#include "mbed_trace.h"
+#define TRACE_GROUP "VerificationRecord"
+#endif // MBED_CONF_MBED_TRACE_ENABLE
+
+namespace update_client {
+
+VerificationRecord::VerificationRecord(FlashUpdater& flashUpdater, uint32_t recordAddress) :
+  m_sectorLog(flashUpdater, recordAddress, RECORD_MAGIC, sizeof(Record)),
+  m_loaded(false) {
+  memset((void*) &m_record, 0, sizeof(m_record));
+}
+
+bool VerificationRecord::isEnabled() const {
+  return m_sectorLog.isEnabled();
+}
+
+VerificationRecord::Status VerificationRecord::getStatus(uint32_t headerAddress, uint32_t headerChecksum,
+                                                         uint64_t firmwareVersion, uint64_t firmwareSize) {
+  if (! isEnabled() || load() != UC_ERR_NONE) {
+    return NOT_VERIFIED;
+  }
+
+  uint32_t entryIndex = findEntry(headerAddress);
+  if (entryIndex == m_record.nbrOfEntries) {
+    return NOT_VERIFIED;
+  }
+
+  // the record only applies if the header did not change since the verification
+  const Entry& entry = m_record.entries[entryIndex];
+  if (entry.headerChecksum != headerChecksum ||
+      entry.firmwareVersion != firmwareVersion ||
+      entry.firmwareSize != firmwareSize) {
+    return NOT_VERIFIED;
+  }
+
+  return static_cast<Status>(entry.status);
+}
+
+int32_t VerificationRecord::setStatus(uint32_t headerAddress, uint32_t headerChecksum,
+                                      uint64_t firmwareVersion, uint64_t firmwareSize, Status status) {
+  if (! isEnabled()) {
+    return UC_ERR_NONE;
+  }
+  int32_t result = load();
+  if (result != UC_ERR_NONE) {
+    return result;
+  }
+
+  uint32_t entryIndex = findEntry(headerAddress);
+  if (entryIndex == m_record.nbrOfEntries) {
+    if (m_record.nbrOfEntries == MAX_ENTRIES) {
+      tr_error("Verification record is full");
+      return UC_ERR_WRITE_FAILED;
+    }
+    m_record.nbrOfEntries++;
+  }
+  else if (m_record.entries[entryIndex].headerChecksum == headerChecksum &&
+           m_record.entries[entryIndex].firmwareVersion == firmwareVersion &&
+           m_record.entries[entryIndex].firmwareSize == firmwareSize &&
+           m_record.entries[entryIndex].status == (uint32_t) status) {
+    // nothing changed, avoid writing the flash
+    return UC_ERR_NONE;
+  }
+
+  Entry& entry = m_record.entries[entryIndex];
+  entry.headerAddress = headerAddress;
+  entry.headerChecksum = headerChecksum;
+  entry.firmwareVersion = firmwareVersion;
+  entry.firmwareSize = firmwareSize;
+  entry.status = status;
+  entry.reserved = 0;
+  tr_debug(" Recording status %d for application at 0x%08x", status, headerAddress);
+
+  return store();
+}
+
+int32_t VerificationRecord::invalidate(uint32_t headerAddress) {
+  if (! isEnabled()) {
+    return UC_ERR_NONE;
+  }
+  int32_t result = load();
+  if (result != UC_ERR_NONE) {
+    return result;
+  }
+
+  uint32_t entryIndex = findEntry(headerAddress);
+  if (entryIndex == m_record.nbrOfEntries) {
+    return UC_ERR_NONE;
+  }
+  tr_debug(" Invalidating record of application at 0x%08x", headerAddress);
+
+  // remove the entry by moving the last one in its place
+  m_record.nbrOfEntries--;
+  m_record.entries[entryIndex] = m_record.entries[m_record.nbrOfEntries];
+  memset((void*) &m_record.entries[m_record.nbrOfEntries], 0, sizeof(Entry));
+
+  return store();
+}
+
+int32_t VerificationRecord::load() {
+  if (m_loaded) {
+    return UC_ERR_NONE;
+  }
+
+  // start with an empty record, then keep the last valid one found in the sector
+  Record record;
+  bool found = false;
+  int32_t result = m_sectorLog.load(&record, found);
+  if (result != UC_ERR_NONE) {
+    return result;
+  }
+  memset((void*) &m_record, 0, sizeof(m_record));
+  if (found && record.nbrOfEntries <= MAX_ENTRIES) {
+    m_record = record;
+  }
+  tr_debug(" Verification record loaded with %d entries", m_record.nbrOfEntries);
+  m_loaded = true;
+
+  return UC_ERR_NONE;
+}
+
+int32_t VerificationRecord::store() {
+  return m_sectorLog.append(&m_record);
+}
+
+uint32_t VerificationRecord::findEntry(uint32_t headerAddress) const {
+  for (uint32_t entryIndex = 0; entryIndex < m_record.nbrOfEntries; entryIndex++) {
+    if (m_record.entries[entryIndex].headerAddress == headerAddress) {
+      return entryIndex;
+    }
+  }
+  return m_record.nbrOfEntries;
+}
+
+} // namespace
@@ -0,0 +1,71 @@
+#pragma once
+
+#if !defined(UPDATE_CLIENT_FLASH_SIMULATOR)
+#include "mbed.h"
+#endif
+#include <cstdint>
+
+#include "FlashUpdater.h"
+#include "SectorLog.h"
+
+// address of the flash sector reserved for the verification record, 0 to disable it
+#ifndef MBED_CONF_UPDATE_CLIENT_VERIFICATION_RECORD_ADDRESS
+#define MBED_CONF_UPDATE_CLIENT_VERIFICATION_RECORD_ADDRESS 0
+#endif
+
+namespace update_client {
+
+// VerificationRecord keeps, in a reserved flash sector, the result of the last
+// full hash verification of each application (active and candidates). An
+// application whose header (checksum, version and size) did not change since its
+// last verification does not need to be hashed again.
+// Records are appended to the sector through a SectorLog.
+
+class VerificationRecord {
+public:
+  enum Status {
+    NOT_VERIFIED = 0,
+    VERIFIED_VALID = 1,
+    VERIFIED_NOT_VALID = 2
+  };
+
+  VerificationRecord(FlashUpdater& flashUpdater, uint32_t recordAddress);
+
+  bool isEnabled() const;
+  // returns the status recorded for the application with the given header
+  Status getStatus(uint32_t headerAddress, uint32_t headerChecksum, uint64_t firmwareVersion, uint64_t firmwareSize);
+  // records the status of the application with the given header
+  int32_t setStatus(uint32_t headerAddress, uint32_t headerChecksum, uint64_t firmwareVersion, uint64_t firmwareSize, Status status);
+  // forgets the application at the given header address (e.g. before it is written)
+  int32_t invalidate(uint32_t headerAddress);
+
+private:
+  int32_t load();
+  int32_t store();
+  uint32_t findEntry(uint32_t headerAddress) const;
+
+  // one entry per application: the active one and the candidates
+  static const uint32_t MAX_ENTRIES = MBED_CONF_UPDATE_CLIENT_STORAGE_LOCATIONS + 1;
+  static const uint32_t RECORD_MAGIC = 0x56524543UL;
+
+  struct Entry {
+    uint32_t headerAddress;
+    uint32_t headerChecksum;
+    uint64_t firmwareVersion;
+    uint64_t firmwareSize;
+    uint32_t status;
+    uint32_t reserved;
+  };
+  struct Record {
+    uint32_t nbrOfEntries;
+    uint32_t reserved;
+    Entry entries[MAX_ENTRIES];
+  };
+
+  // data members
+  SectorLog m_sectorLog;
+  Record m_record;
+  bool m_loaded;
+};
+
+} // namespace
@@ -0,0 +1,248 @@
+#pragma once
+
+// Helpers shared by the host tests: images and headers placed in the flash
+// simulator, and the host side of the download protocol over a socket pair.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "Crc32.h"
+#include "DownloadProtocol.h"
+#include "FlashUpdater.h"
+#include "ImageHasher.h"
+
+#define CHECK(condition)                                                  \
+  do {                                                                    \
+    if (!(condition)) {                                                   \
+      printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+      exit(1);                                                            \
+    }                                                                     \
+  } while (0)
+
+#define CHECK_EQUAL(expected, actual)                                     \
+  do {                                                                    \
+    const long long expectedValue = (long long) (expected);               \
+    const long long actualValue = (long long) (actual);                   \
+    if (expectedValue != actualValue) {                                   \
+      printf("%s:%d: check failed: %s == %s (%lld != %lld)\n", __FILE__, __LINE__, \
+             #expected, #actual, expectedValue, actualValue);             \
+      exit(1);                                                            \
+    }                                                                     \
+  } while (0)
+
+namespace test_support {
+
+using namespace update_client;
+
+// layout of the host build (see CMakeLists.txt)
+const uint32_t ACTIVE_HEADER_ADDRESS = HEADER_ADDR;
+const uint32_t HEADER_SIZE = POST_APPLICATION_ADDR - HEADER_ADDR;
+const uint32_t STORAGE_ADDRESS = MBED_CONF_UPDATE_CLIENT_STORAGE_ADDRESS;
+const uint32_t STORAGE_SIZE = MBED_CONF_UPDATE_CLIENT_STORAGE_SIZE;
+const uint32_t NBR_OF_SLOTS = MBED_CONF_UPDATE_CLIENT_STORAGE_LOCATIONS;
+const uint32_t SLOT_SIZE = STORAGE_SIZE / NBR_OF_SLOTS;
+
+// header fields, see MbedApplication.h
+const uint32_t HEADER_MAGIC = 0x5a51b3d4UL;
+const uint32_t HEADER_SIZE_V2 = 112;
+const uint32_t HEADER_CRC_OFFSET_V2 = 108;
+
+inline uint32_t getSlotAddress(uint32_t slotIndex) {
+  return STORAGE_ADDRESS + slotIndex * SLOT_SIZE;
+}
+
+inline std::vector<uint8_t> makeImage(uint32_t size, uint32_t seed) {
+  std::vector<uint8_t> image(size);
+  srand(seed);
+  for (uint32_t index = 0; index < size; index++) {
+    image[index] = (uint8_t) rand();
+  }
+  return image;
+}
+
+// makes the image startable at the given address: the initial stack pointer and
+// the reset handler at the start of the vector table (little endian)
+inline void setVectorTable(std::vector<uint8_t>& image, uint32_t stackPointer, uint32_t resetHandler) {
+  for (uint32_t index = 0; index < 4; index++) {
+    image[index] = (uint8_t) (stackPointer >> (8 * index));
+    image[4 + index] = (uint8_t) (resetHandler >> (8 * index));
+  }
+}
+
+inline void writeUint32(uint8_t* pBuffer, uint32_t value) {
+  pBuffer[0] = (uint8_t) (value >> 24);
+  pBuffer[1] = (uint8_t) (value >> 16);
+  pBuffer[2] = (uint8_t) (value >> 8);
+  pBuffer[3] = (uint8_t) value;
+}
+
+inline void writeUint64(uint8_t* pBuffer, uint64_t value) {
+  writeUint32(pBuffer, (uint32_t) (value >> 32));
+  writeUint32(pBuffer + 4, (uint32_t) value);
+}
+
+inline uint32_t readUint32(const uint8_t* pBuffer) {
+  return ((uint32_t) pBuffer[0] << 24) | ((uint32_t) pBuffer[1] << 16) | ((uint32_t) pBuffer[2] << 8) | pBuffer[3];
+}
+
+// builds the header area (HEADER_SIZE bytes, version 2 header) of the image
+inline std::vector<uint8_t> makeHeader(uint64_t version, const std::vector<uint8_t>& image) {
+  std::vector<uint8_t> header(HEADER_SIZE, 0xFF);
+  memset(header.data(), 0, HEADER_SIZE_V2);
+  writeUint32(&header[0], HEADER_MAGIC);
+  writeUint32(&header[4], 2);
+  writeUint64(&header[8], version);
+  writeUint64(&header[16], image.size());
+  ImageHasher imageHasher;
+  imageHasher.start();
+  imageHasher.update(image.data(), image.size());
+  imageHasher.finish(&header[24]);
+  writeUint32(&header[HEADER_CRC_OFFSET_V2], Crc32::compute(header.data(), HEADER_CRC_OFFSET_V2));
+  return header;
+}
+
+// stores the header and the image in the simulated flash, without flash operations
+inline void placeImage(FlashUpdater& flashUpdater, uint32_t headerAddress, uint64_t version,
+                       const std::vector<uint8_t>& image) {
+  uint8_t* pMemory = flashUpdater.getMemory() + (headerAddress - flashUpdater.get_flash_start());
+  const std::vector<uint8_t> header = makeHeader(version, image);
+  memcpy(pMemory, header.data(), header.size());
+  memcpy(pMemory + HEADER_SIZE, image.data(), image.size());
+}
+
+inline bool hasImage(FlashUpdater& flashUpdater, uint32_t address, const std::vector<uint8_t>& image) {
+  return memcmp(flashUpdater.getMemory() + (address - flashUpdater.get_flash_start()), image.data(), image.size()) == 0;
+}
+
+inline bool readFile(const std::string& path, std::vector<uint8_t>& data) {
+  FILE* pFile = fopen(path.c_str(), "rb");
+  if (pFile == NULL) {
+    return false;
+  }
+  data.clear();
+  uint8_t buffer[4096];
+  size_t size = 0;
+  while ((size = fread(buffer, 1, sizeof(buffer), pFile)) > 0) {
+    data.insert(data.end(), buffer, buffer + size);
+  }
+  fclose(pFile);
+  return true;
+}
+
+inline bool writeFile(const std::string& path, const std::vector<uint8_t>& data) {
+  FILE* pFile = fopen(path.c_str(), "wb");
+  if (pFile == NULL) {
+    return false;
+  }
+  const bool written = fwrite(data.data(), 1, data.size(), pFile) == data.size();
+  return (fclose(pFile) == 0) && written;
+}
+
+// host side of the download protocol, on one end of a socket pair whose other
+// end is given to a SocketTransport
+class HostLink {
+public:
+  HostLink() {
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, m_fds) != 0) {
+      m_fds[0] = -1;
+      m_fds[1] = -1;
+    }
+  }
+
+  ~HostLink() {
+    closeHost();
+    if (m_fds[1] >= 0) {
+      close(m_fds[1]);
+    }
+  }
+
+  // the file descriptor of the device side
+  int getDeviceFd() const {
+    return m_fds[1];
+  }
+
+  bool sendRaw(const uint8_t* pData, size_t size) {
+    while (size > 0) {
+      ssize_t written = write(m_fds[0], pData, size);
+      if (written <= 0) {
+        return false;
+      }
+      pData += written;
+      size -= (size_t) written;
+    }
+    return true;
+  }
+
+  static std::vector<uint8_t> makeFrame(uint8_t frameType, const uint8_t* pPayload, uint32_t size) {
+    std::vector<uint8_t> frame(DOWNLOAD_FRAME_PREFIX_SIZE + size + DOWNLOAD_FRAME_CRC_SIZE);
+    frame[0] = frameType;
+    frame[1] = (uint8_t) (size >> 8);
+    frame[2] = (uint8_t) size;
+    if (size > 0) {
+      memcpy(&frame[DOWNLOAD_FRAME_PREFIX_SIZE], pPayload, size);
+    }
+    const uint32_t crc = Crc32::compute(frame.data(), DOWNLOAD_FRAME_PREFIX_SIZE + size);
+    writeUint32(&frame[DOWNLOAD_FRAME_PREFIX_SIZE + size], crc);
+    return frame;
+  }
+
+  bool sendFrame(uint8_t frameType, const uint8_t* pPayload, uint32_t size) {
+    const std::vector<uint8_t> frame = makeFrame(frameType, pPayload, size);
+    return sendRaw(frame.data(), frame.size());
+  }
+
+  // sends the payload from the given offset in DATA frames of the maximum size, up to endOffset
+  bool sendData(const std::vector<uint8_t>& payload, size_t offset, size_t endOffset) {
+    while (offset < endOffset) {
+      const size_t size = (endOffset - offset < DOWNLOAD_MAX_DATA_SIZE) ? endOffset - offset : DOWNLOAD_MAX_DATA_SIZE;
+      if (! sendFrame(DOWNLOAD_FRAME_DATA, &payload[offset], (uint32_t) size)) {
+        return false;
+      }
+      offset += size;
+    }
+    return true;
+  }
+
+  bool sendEnd() {
+    return sendFrame(DOWNLOAD_FRAME_END, NULL, 0);
+  }
+
+  // receives a response frame (ACK, NACK, SKIP or RESUME) with its value
+  bool receiveResponse(uint8_t& frameType, uint32_t& value) {
+    uint8_t frame[DOWNLOAD_FRAME_PREFIX_SIZE + DOWNLOAD_RESPONSE_SIZE + DOWNLOAD_FRAME_CRC_SIZE];
+    size_t receivedSize = 0;
+    while (receivedSize < sizeof(frame)) {
+      ssize_t readSize = read(m_fds[0], frame + receivedSize, sizeof(frame) - receivedSize);
+      if (readSize <= 0) {
+        return false;
+      }
+      receivedSize += (size_t) readSize;
+    }
+    const uint32_t crc = Crc32::compute(frame, DOWNLOAD_FRAME_PREFIX_SIZE + DOWNLOAD_RESPONSE_SIZE);
+    if (readUint32(&frame[DOWNLOAD_FRAME_PREFIX_SIZE + DOWNLOAD_RESPONSE_SIZE]) != crc) {
+      return false;
+    }
+    frameType = frame[0];
+    value = readUint32(&frame[DOWNLOAD_FRAME_PREFIX_SIZE]);
+    return true;
+  }
+
+  // closes the host side, the device sees the host disconnected
+  void closeHost() {
+    if (m_fds[0] >= 0) {
+      close(m_fds[0]);
+      m_fds[0] = -1;
+    }
+  }
+
+private:
+  int m_fds[2];
+};
+
+} // namespace test_support
@@ -0,0 +1,140 @@
+// Direct boot (A/B) selection: CandidateApplications::getBootAddress starts the newest
+// valid candidate that can run in its slot, checked by MbedApplication::checkBootable,
+// and falls back to the active application
+
+#include "CandidateApplications.h"
+#include "MbedApplication.h"
+#include "TestSupport.h"
+#include "UCErrorCodes.h"
+
+using namespace update_client;
+using namespace test_support;
+
+namespace {
+
+const uint32_t STACK_POINTER = 0x20010000;
+const uint32_t IMAGE_SIZE = 20 * 1024;
+
+uint32_t getSlotApplicationAddress(uint32_t slotIndex) {
+  return getSlotAddress(slotIndex) + HEADER_SIZE;
+}
+
+// an image linked for the given address: its reset handler (thumb) is within the image
+std::vector<uint8_t> makeBootableImage(uint32_t linkAddress, uint32_t seed) {
+  std::vector<uint8_t> image = makeImage(IMAGE_SIZE, seed);
+  setVectorTable(image, STACK_POINTER, linkAddress + 0x200 + 1);
+  return image;
+}
+
+void placeCandidate(FlashUpdater& flashUpdater, uint32_t slotIndex, uint64_t version, const std::vector<uint8_t>& image) {
+  placeImage(flashUpdater, getSlotAddress(slotIndex), version, image);
+}
+
+uint32_t getBootAddress(FlashUpdater& flashUpdater) {
+  CandidateApplications candidateApplications(flashUpdater, STORAGE_ADDRESS, STORAGE_SIZE, HEADER_SIZE, NBR_OF_SLOTS);
+  MbedApplication activeApplication(flashUpdater, ACTIVE_HEADER_ADDRESS, POST_APPLICATION_ADDR);
+  uint32_t bootAddress = 0;
+  CHECK_EQUAL(UC_ERR_NONE, candidateApplications.getBootAddress(activeApplication, bootAddress));
+  return bootAddress;
+}
+
+int32_t checkBootable(FlashUpdater& flashUpdater, uint32_t slotIndex) {
+  MbedApplication application(flashUpdater, getSlotAddress(slotIndex), getSlotApplicationAddress(slotIndex));
+  return application.checkBootable();
+}
+
+void testCheckBootable() {
+  FlashUpdater flashUpdater;
+  flashUpdater.init();
+
+  // linked for its slot
+  placeCandidate(flashUpdater, 0, 2, makeBootableImage(getSlotApplicationAddress(0), 1));
+  CHECK_EQUAL(UC_ERR_NONE, checkBootable(flashUpdater, 0));
+
+  // erased vector table
+  std::vector<uint8_t> image = makeImage(IMAGE_SIZE, 2);
+  memset(image.data(), 0xFF, 8);
+  placeCandidate(flashUpdater, 1, 2, image);
+  CHECK_EQUAL(UC_ERR_NOT_BOOTABLE, checkBootable(flashUpdater, 1));
+  // no stack pointer, or one that is not word aligned
+  image = makeBootableImage(getSlotApplicationAddress(1), 3);
+  setVectorTable(image, 0, getSlotApplicationAddress(1) + 0x201);
+  placeCandidate(flashUpdater, 1, 2, image);
+  CHECK_EQUAL(UC_ERR_NOT_BOOTABLE, checkBootable(flashUpdater, 1));
+  setVectorTable(image, STACK_POINTER + 2, getSlotApplicationAddress(1) + 0x201);
+  placeCandidate(flashUpdater, 1, 2, image);
+  CHECK_EQUAL(UC_ERR_NOT_BOOTABLE, checkBootable(flashUpdater, 1));
+
+  // linked for another slot, or for the active application
+  placeCandidate(flashUpdater, 2, 2, makeBootableImage(getSlotApplicationAddress(0), 4));
+  CHECK_EQUAL(UC_ERR_NOT_BOOTABLE, checkBootable(flashUpdater, 2));
+  placeCandidate(flashUpdater, 2, 2, makeBootableImage(POST_APPLICATION_ADDR, 5));
+  CHECK_EQUAL(UC_ERR_NOT_BOOTABLE, checkBootable(flashUpdater, 2));
+  // reset handler right after the image, or right at its start
+  image = makeBootableImage(getSlotApplicationAddress(2), 6);
+  setVectorTable(image, STACK_POINTER, getSlotApplicationAddress(2) + IMAGE_SIZE + 1);
+  placeCandidate(flashUpdater, 2, 2, image);
+  CHECK_EQUAL(UC_ERR_NOT_BOOTABLE, checkBootable(flashUpdater, 2));
+  setVectorTable(image, STACK_POINTER, getSlotApplicationAddress(2) + 1);
+  placeCandidate(flashUpdater, 2, 2, image);
+  CHECK_EQUAL(UC_ERR_NONE, checkBootable(flashUpdater, 2));
+
+  // too small for a vector table
+  placeCandidate(flashUpdater, 3, 2, std::vector<uint8_t>(4, 0));
+  CHECK_EQUAL(UC_ERR_FIRMWARE_EMPTY, checkBootable(flashUpdater, 3));
+}
+
+void testNewestBootableSlotIsChosen() {
+  FlashUpdater flashUpdater;
+  flashUpdater.init();
+  placeImage(flashUpdater, ACTIVE_HEADER_ADDRESS, 2, makeBootableImage(POST_APPLICATION_ADDR, 10));
+  placeCandidate(flashUpdater, 0, 3, makeBootableImage(getSlotApplicationAddress(0), 11));
+  placeCandidate(flashUpdater, 1, 5, makeBootableImage(getSlotApplicationAddress(1), 12));
+  placeCandidate(flashUpdater, 3, 4, makeBootableImage(getSlotApplicationAddress(3), 13));
+  CHECK_EQUAL(getSlotApplicationAddress(1), getBootAddress(flashUpdater));
+
+  // a newer candidate that cannot run in its slot (linked for another slot) is not started,
+  // nor one with an erased vector table, nor one whose image does not match its header
+  placeCandidate(flashUpdater, 2, 6, makeBootableImage(getSlotApplicationAddress(1), 14));
+  CHECK_EQUAL(getSlotApplicationAddress(1), getBootAddress(flashUpdater));
+  std::vector<uint8_t> image = makeImage(IMAGE_SIZE, 15);
+  memset(image.data(), 0xFF, 8);
+  placeCandidate(flashUpdater, 2, 6, image);
+  CHECK_EQUAL(getSlotApplicationAddress(1), getBootAddress(flashUpdater));
+  placeCandidate(flashUpdater, 2, 6, makeBootableImage(getSlotApplicationAddress(2), 16));
+  flashUpdater.getMemory()[getSlotApplicationAddress(2) + 1000 - flashUpdater.get_flash_start()] ^= 0x01;
+  CHECK_EQUAL(getSlotApplicationAddress(1), getBootAddress(flashUpdater));
+
+  // once valid and linked for its slot, the newest candidate is started
+  placeCandidate(flashUpdater, 2, 6, makeBootableImage(getSlotApplicationAddress(2), 16));
+  CHECK_EQUAL(getSlotApplicationAddress(2), getBootAddress(flashUpdater));
+}
+
+void testActiveApplicationIsTheFallback() {
+  FlashUpdater flashUpdater;
+  flashUpdater.init();
+  placeImage(flashUpdater, ACTIVE_HEADER_ADDRESS, 5, makeBootableImage(POST_APPLICATION_ADDR, 20));
+
+  // no candidate
+  CHECK_EQUAL(POST_APPLICATION_ADDR, getBootAddress(flashUpdater));
+  // candidates older than or as old as the active application
+  placeCandidate(flashUpdater, 0, 4, makeBootableImage(getSlotApplicationAddress(0), 21));
+  placeCandidate(flashUpdater, 1, 5, makeBootableImage(getSlotApplicationAddress(1), 22));
+  CHECK_EQUAL(POST_APPLICATION_ADDR, getBootAddress(flashUpdater));
+  // newer candidates that cannot be started in their slot
+  placeCandidate(flashUpdater, 2, 6, makeBootableImage(POST_APPLICATION_ADDR, 23));
+  std::vector<uint8_t> image = makeImage(IMAGE_SIZE, 24);
+  memset(image.data(), 0xFF, 8);
+  placeCandidate(flashUpdater, 3, 7, image);
+  CHECK_EQUAL(POST_APPLICATION_ADDR, getBootAddress(flashUpdater));
+}
+
+} // namespace
+
+int main() {
+  testCheckBootable();
+  testNewestBootableSlotIsChosen();
+  testActiveApplicationIsTheFallback();
+  printf("test_boot_selection: ok\n");
+  return 0;
+}
@@ -0,0 +1,166 @@
+// Compressed update files built by tools/make_update.py: downloaded through the
+// DownloadSession, then decompressed by the install of the bootloader, the active
+// application must be the original image. Run with the Python interpreter and the
+// path of make_update.py as arguments
+
+#include <thread>
+
+#include "CandidateApplications.h"
+#include "Decompressor.h"
+#include "DownloadSession.h"
+#include "SocketTransport.h"
+#include "TestSupport.h"
+#include "UCErrorCodes.h"
+
+using namespace update_client;
+using namespace test_support;
+
+namespace {
+
+// update files of make_update.py: version 3 header followed by the payload
+const uint32_t UPDATE_HEADER_SIZE = 124;
+const uint32_t UPDATE_COMPRESSION_OFFSET = 116;
+
+std::string gPython;
+std::string gMakeUpdate;
+
+// an image that compresses like code: runs of a few recurring blocks mixed with random bytes
+std::vector<uint8_t> makeCompressibleImage(uint32_t size, uint32_t seed) {
+  const std::vector<uint8_t> blocks = makeImage(64 * 16, seed);
+  std::vector<uint8_t> image;
+  srand(seed + 1);
+  while (image.size() < size) {
+    const uint32_t blockIndex = (uint32_t) rand() % 64;
+    image.insert(image.end(), &blocks[blockIndex * 16], &blocks[blockIndex * 16] + 16);
+    for (uint32_t index = (uint32_t) rand() % 8; index > 0; index--) {
+      image.push_back((uint8_t) rand());
+    }
+  }
+  image.resize(size);
+  return image;
+}
+
+// runs make_update.py with the given options, returns the update file
+std::vector<uint8_t> makeUpdate(const std::vector<uint8_t>& image, uint64_t version, const std::string& options) {
+  CHECK(writeFile("compressed_image.bin", image));
+  const std::string command = "\"" + gPython + "\" \"" + gMakeUpdate + "\" --version " + std::to_string(version) +
+                              " " + options + " compressed_image.bin -o compressed_update.bin > /dev/null";
+  CHECK_EQUAL(0, system(command.c_str()));
+  std::vector<uint8_t> update;
+  CHECK(readFile("compressed_update.bin", update));
+  CHECK(update.size() > UPDATE_HEADER_SIZE);
+  return update;
+}
+
+// sends the update file, returns the error code of the download and the response of the device
+int32_t download(FlashUpdater& flashUpdater, const std::vector<uint8_t>& update, uint8_t& frameType) {
+  HostLink hostLink;
+  SocketTransport transport(hostLink.getDeviceFd());
+  DownloadSession session(transport);
+  int32_t result = UC_ERR_NONE;
+  std::thread device([&]() { result = session.download(flashUpdater); });
+
+  uint32_t value = 0;
+  CHECK(hostLink.sendFrame(DOWNLOAD_FRAME_HEADER, update.data(), UPDATE_HEADER_SIZE));
+  CHECK(hostLink.receiveResponse(frameType, value));
+  CHECK_EQUAL(DOWNLOAD_FRAME_ACK, frameType);
+  const std::vector<uint8_t> payload(update.begin() + UPDATE_HEADER_SIZE, update.end());
+  CHECK(hostLink.sendData(payload, 0, payload.size()));
+  CHECK(hostLink.sendEnd());
+  CHECK(hostLink.receiveResponse(frameType, value));
+  device.join();
+  return result;
+}
+
+int32_t install(FlashUpdater& flashUpdater, uint32_t installBufferSize = MBED_CONF_UPDATE_CLIENT_INSTALL_BUFFER_SIZE) {
+  CandidateApplications candidateApplications(flashUpdater, STORAGE_ADDRESS, STORAGE_SIZE,
+                                              DownloadSession::SLOT_HEADER_SIZE, NBR_OF_SLOTS);
+  candidateApplications.setInstallBufferSize(installBufferSize);
+  MbedApplication activeApplication(flashUpdater, ACTIVE_HEADER_ADDRESS, POST_APPLICATION_ADDR);
+  uint32_t newestSlotIndex = 0;
+  CHECK(candidateApplications.hasNewerApplication(activeApplication, newestSlotIndex));
+  return candidateApplications.installApplication(newestSlotIndex, ACTIVE_HEADER_ADDRESS);
+}
+
+bool isActiveApplication(FlashUpdater& flashUpdater, uint64_t version, const std::vector<uint8_t>& image) {
+  MbedApplication activeApplication(flashUpdater, ACTIVE_HEADER_ADDRESS, POST_APPLICATION_ADDR);
+  return activeApplication.checkApplication() == UC_ERR_NONE &&
+         activeApplication.getFirmwareVersion() == version &&
+         activeApplication.getCompression() == COMPRESSION_NONE &&
+         hasImage(flashUpdater, POST_APPLICATION_ADDR, image);
+}
+
+void testRoundTrip(const std::string& options, uint32_t expectedWindowBits, uint32_t expectedLookaheadBits,
+                   uint32_t imageSize, uint32_t installBufferSize) {
+  FlashUpdater flashUpdater;
+  flashUpdater.init();
+  placeImage(flashUpdater, ACTIVE_HEADER_ADDRESS, 1, makeImage(40 * 1024, 1));
+
+  const std::vector<uint8_t> image = makeCompressibleImage(imageSize, 2);
+  const std::vector<uint8_t> update = makeUpdate(image, 2, options);
+  const uint32_t compression = readUint32(&update[UPDATE_COMPRESSION_OFFSET]);
+  CHECK_EQUAL(COMPRESSION_HEATSHRINK, compression & 0xFF);
+  CHECK_EQUAL(expectedWindowBits, (compression >> 8) & 0xFF);
+  CHECK_EQUAL(expectedLookaheadBits, (compression >> 16) & 0xFF);
+  CHECK(update.size() - UPDATE_HEADER_SIZE < SLOT_SIZE - DownloadSession::SLOT_HEADER_SIZE);
+
+  // the candidate is stored compressed
+  uint8_t frameType = 0;
+  CHECK_EQUAL(UC_ERR_NONE, download(flashUpdater, update, frameType));
+  CHECK_EQUAL(DOWNLOAD_FRAME_ACK, frameType);
+  CHECK(hasImage(flashUpdater, getSlotAddress(0), std::vector<uint8_t>(update.begin(), update.begin() + UPDATE_HEADER_SIZE)));
+  CHECK(hasImage(flashUpdater, getSlotAddress(0) + DownloadSession::SLOT_HEADER_SIZE,
+                 std::vector<uint8_t>(update.begin() + UPDATE_HEADER_SIZE, update.end())));
+
+  // and installed decompressed, an install buffer smaller than the header is rejected
+  // before anything is erased
+  CHECK_EQUAL(UC_ERR_WRITE_FAILED, install(flashUpdater, HEADER_SIZE / 2));
+  CHECK(isActiveApplication(flashUpdater, 1, makeImage(40 * 1024, 1)));
+  CHECK_EQUAL(UC_ERR_NONE, install(flashUpdater, installBufferSize));
+  CHECK(isActiveApplication(flashUpdater, 2, image));
+}
+
+void testCorruptedPayload() {
+  const std::vector<uint8_t> activeImage = makeImage(40 * 1024, 3);
+  const std::vector<uint8_t> image = makeCompressibleImage(100 * 1024, 4);
+  std::vector<uint8_t> update = makeUpdate(image, 2, "");
+  update[UPDATE_HEADER_SIZE + (update.size() - UPDATE_HEADER_SIZE) / 2] ^= 0x10;
+
+  // the download checks the image as it is decompressed
+  FlashUpdater flashUpdater;
+  flashUpdater.init();
+  placeImage(flashUpdater, ACTIVE_HEADER_ADDRESS, 1, activeImage);
+  uint8_t frameType = 0;
+  const int32_t result = download(flashUpdater, update, frameType);
+  CHECK(result == UC_ERR_HASH_INVALID || result == UC_ERR_DECOMPRESSION_FAILED);
+  CHECK_EQUAL(DOWNLOAD_FRAME_NACK, frameType);
+
+  // a corrupted candidate in a slot is rejected by the install, the header is not
+  // written so that the aborted install never looks like a valid application
+  uint8_t* pSlot = flashUpdater.getMemory() + (getSlotAddress(0) - flashUpdater.get_flash_start());
+  memset(pSlot, 0xFF, DownloadSession::SLOT_HEADER_SIZE);
+  memcpy(pSlot, update.data(), UPDATE_HEADER_SIZE);
+  memcpy(pSlot + DownloadSession::SLOT_HEADER_SIZE, update.data() + UPDATE_HEADER_SIZE, update.size() - UPDATE_HEADER_SIZE);
+  CHECK(install(flashUpdater) != UC_ERR_NONE);
+  MbedApplication activeApplication(flashUpdater, ACTIVE_HEADER_ADDRESS, POST_APPLICATION_ADDR);
+  CHECK(! activeApplication.hasValidHeader());
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  if (argc < 3) {
+    printf("usage: test_compressed_update <python> <make_update.py>\n");
+    return 1;
+  }
+  gPython = argv[1];
+  gMakeUpdate = argv[2];
+  // the defaults of make_update.py, with an image larger than a slot once installed
+  // uncompressed (the candidate fits compressed), and a small window installed
+  // through a small buffer
+  testRoundTrip("", 11, 6, SLOT_SIZE + 20 * 1024, MBED_CONF_UPDATE_CLIENT_INSTALL_BUFFER_SIZE);
+  testRoundTrip("--window 8 --lookahead 4", 8, 4, 100 * 1024, 256);
+  testCorruptedPayload();
+  printf("test_compressed_update: ok\n");
+  return 0;
+}
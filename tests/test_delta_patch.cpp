@@ -0,0 +1,218 @@
+// Delta patches built by tools/make_update.py, applied by DeltaPatcher against a
+// base placed in the flash simulator as the active application. Run with the
+// Python interpreter and the path of make_update.py as arguments
+
+#include "DeltaPatcher.h"
+#include "Decompressor.h"
+#include "MbedApplication.h"
+#include "TestSupport.h"
+#include "UCErrorCodes.h"
+
+using namespace update_client;
+using namespace test_support;
+
+namespace {
+
+// update files of make_update.py: version 3 header followed by the payload
+const uint32_t UPDATE_HEADER_SIZE = 124;
+const uint32_t UPDATE_COMPRESSION_OFFSET = 116;
+
+std::string gPython;
+std::string gMakeUpdate;
+
+// collects the rebuilt image
+class ImageSink :
+  public DecompressorSink {
+public:
+  virtual int32_t write(const uint8_t* pData, uint32_t size) {
+    m_image.insert(m_image.end(), pData, pData + size);
+    return UC_ERR_NONE;
+  }
+
+  std::vector<uint8_t> m_image;
+};
+
+// the target differs from the base by changed bytes (diff), inserted bytes (extra),
+// a block moved backwards (seek) and bytes appended
+std::vector<uint8_t> makeTarget(const std::vector<uint8_t>& base) {
+  std::vector<uint8_t> target(base.begin(), base.begin() + 20 * 1024);
+  for (uint32_t index = 1000; index < 20 * 1024; index += 97) {
+    target[index] ^= 0x5A;
+  }
+  const std::vector<uint8_t> inserted = makeImage(700, 11);
+  target.insert(target.end(), inserted.begin(), inserted.end());
+  target.insert(target.end(), base.begin() + 40 * 1024, base.end());
+  target.insert(target.end(), base.begin() + 22 * 1024, base.begin() + 38 * 1024);
+  const std::vector<uint8_t> appended = makeImage(3000, 12);
+  target.insert(target.end(), appended.begin(), appended.end());
+  return target;
+}
+
+// runs make_update.py, returns the payload and its compression
+void makeUpdate(const std::vector<uint8_t>& base, const std::vector<uint8_t>& target, bool compressed,
+                std::vector<uint8_t>& payload, uint32_t& compression) {
+  CHECK(writeFile("delta_base.bin", base));
+  CHECK(writeFile("delta_target.bin", target));
+  const std::string command = "\"" + gPython + "\" \"" + gMakeUpdate + "\" --version 5 --base delta_base.bin" +
+                              (compressed ? "" : " --no-compression") + " delta_target.bin -o delta_update.bin > /dev/null";
+  CHECK_EQUAL(0, system(command.c_str()));
+  std::vector<uint8_t> update;
+  CHECK(readFile("delta_update.bin", update));
+  CHECK(update.size() > UPDATE_HEADER_SIZE);
+  compression = readUint32(&update[UPDATE_COMPRESSION_OFFSET]);
+  CHECK((compression & COMPRESSION_DELTA) != 0);
+  CHECK(DeltaPatcher::isSupported(compression));
+  payload.assign(update.begin() + UPDATE_HEADER_SIZE, update.end());
+}
+
+// applies the payload in blocks of the given size, then finishes the patch
+int32_t applyPatch(FlashUpdater& flashUpdater, const std::vector<uint8_t>& payload, uint32_t compression,
+                   uint32_t blockSize, std::vector<uint8_t>& image) {
+  MbedApplication baseApplication(flashUpdater, ACTIVE_HEADER_ADDRESS, POST_APPLICATION_ADDR);
+  DeltaPatcher deltaPatcher(flashUpdater, baseApplication);
+  ImageSink sink;
+  CHECK_EQUAL(UC_ERR_NONE, deltaPatcher.start(sink));
+  const uint32_t patchCompression = compression & ~((uint32_t) COMPRESSION_DELTA);
+  Decompressor decompressor;
+  if (patchCompression != COMPRESSION_NONE) {
+    CHECK_EQUAL(UC_ERR_NONE, decompressor.start(patchCompression));
+  }
+
+  int32_t result = UC_ERR_NONE;
+  for (size_t offset = 0; offset < payload.size() && result == UC_ERR_NONE; offset += blockSize) {
+    const uint32_t size = (uint32_t) ((payload.size() - offset < blockSize) ? payload.size() - offset : blockSize);
+    result = (patchCompression != COMPRESSION_NONE) ? decompressor.update(&payload[offset], size, deltaPatcher) :
+                                                      deltaPatcher.write(&payload[offset], size);
+  }
+  if (result == UC_ERR_NONE) {
+    result = deltaPatcher.finish();
+  }
+  image = sink.m_image;
+  return result;
+}
+
+void testTargetRebuilt() {
+  const std::vector<uint8_t> base = makeImage(60 * 1024, 1);
+  const std::vector<uint8_t> target = makeTarget(base);
+  FlashUpdater flashUpdater;
+  flashUpdater.init();
+  placeImage(flashUpdater, ACTIVE_HEADER_ADDRESS, 4, base);
+
+  for (uint32_t compressed = 0; compressed < 2; compressed++) {
+    std::vector<uint8_t> payload;
+    uint32_t compression = 0;
+    makeUpdate(base, target, compressed != 0, payload, compression);
+    // the diff bytes are mostly zeros, the compressed patch is much smaller than the target
+    if (compressed != 0) {
+      CHECK(payload.size() < target.size() / 4);
+    }
+    // blocks of any size, as received in DATA frames
+    const uint32_t blockSizes[] = { 1, 13, 64, DOWNLOAD_MAX_DATA_SIZE };
+    for (uint32_t blockSize : blockSizes) {
+      std::vector<uint8_t> image;
+      CHECK_EQUAL(UC_ERR_NONE, applyPatch(flashUpdater, payload, compression, blockSize, image));
+      CHECK(image == target);
+    }
+  }
+}
+
+void testWrongBase() {
+  const std::vector<uint8_t> base = makeImage(60 * 1024, 1);
+  const std::vector<uint8_t> target = makeTarget(base);
+  std::vector<uint8_t> payload;
+  uint32_t compression = 0;
+  makeUpdate(base, target, false, payload, compression);
+
+  // another application is active
+  FlashUpdater flashUpdater;
+  flashUpdater.init();
+  placeImage(flashUpdater, ACTIVE_HEADER_ADDRESS, 4, makeImage(60 * 1024, 2));
+  std::vector<uint8_t> image;
+  CHECK_EQUAL(UC_ERR_BASE_MISMATCH, applyPatch(flashUpdater, payload, compression, 256, image));
+  CHECK(image.empty());
+
+  // the active application has the header of the base, but its image was changed
+  placeImage(flashUpdater, ACTIVE_HEADER_ADDRESS, 4, base);
+  flashUpdater.getMemory()[POST_APPLICATION_ADDR + 100 - flashUpdater.get_flash_start()] ^= 0x01;
+  CHECK_EQUAL(UC_ERR_BASE_MISMATCH, applyPatch(flashUpdater, payload, compression, 256, image));
+  CHECK(image.empty());
+}
+
+void testTruncatedPatch() {
+  const std::vector<uint8_t> base = makeImage(60 * 1024, 1);
+  const std::vector<uint8_t> target = makeTarget(base);
+  std::vector<uint8_t> payload;
+  uint32_t compression = 0;
+  makeUpdate(base, target, false, payload, compression);
+  FlashUpdater flashUpdater;
+  flashUpdater.init();
+  placeImage(flashUpdater, ACTIVE_HEADER_ADDRESS, 4, base);
+
+  // cut in the patch header, in the first record header, in its diff and before the last byte
+  const size_t cutSizes[] = { 10, DeltaPatcher::PATCH_HEADER_SIZE + 5, DeltaPatcher::PATCH_HEADER_SIZE + 100,
+                              payload.size() / 2, payload.size() - 1 };
+  for (size_t cutSize : cutSizes) {
+    const std::vector<uint8_t> truncated(payload.begin(), payload.begin() + cutSize);
+    std::vector<uint8_t> image;
+    CHECK_EQUAL(UC_ERR_INVALID_PATCH, applyPatch(flashUpdater, truncated, compression, 512, image));
+    CHECK(image.size() < target.size());
+  }
+}
+
+// a patch made of the header of a patch for the base and the given records
+std::vector<uint8_t> makeRecords(const std::vector<uint8_t>& patch, const std::vector<int32_t>& records) {
+  std::vector<uint8_t> recordsPatch(patch.begin(), patch.begin() + DeltaPatcher::PATCH_HEADER_SIZE);
+  for (size_t index = 0; index + 2 < records.size(); index += 3) {
+    uint8_t recordHeader[DeltaPatcher::RECORD_HEADER_SIZE];
+    writeUint32(&recordHeader[0], (uint32_t) records[index]);
+    writeUint32(&recordHeader[4], (uint32_t) records[index + 1]);
+    writeUint32(&recordHeader[8], (uint32_t) records[index + 2]);
+    recordsPatch.insert(recordsPatch.end(), recordHeader, recordHeader + sizeof(recordHeader));
+    // the diff bytes (adding 0 keeps the base) and the extra bytes
+    recordsPatch.insert(recordsPatch.end(), (size_t) records[index] + (size_t) records[index + 1], 0);
+  }
+  return recordsPatch;
+}
+
+void testSeekOutOfRange() {
+  const std::vector<uint8_t> base = makeImage(60 * 1024, 1);
+  std::vector<uint8_t> payload;
+  uint32_t compression = 0;
+  makeUpdate(base, makeTarget(base), false, payload, compression);
+  FlashUpdater flashUpdater;
+  flashUpdater.init();
+  placeImage(flashUpdater, ACTIVE_HEADER_ADDRESS, 4, base);
+  const int32_t baseSize = (int32_t) base.size();
+  std::vector<uint8_t> image;
+
+  // seeks within the base, up to its end, are valid
+  CHECK_EQUAL(UC_ERR_NONE, applyPatch(flashUpdater, makeRecords(payload, { 100, 0, baseSize - 100, 0, 0, -baseSize }),
+                                      COMPRESSION_NONE, 256, image));
+  CHECK_EQUAL(100, image.size());
+  // before the start of the base
+  CHECK_EQUAL(UC_ERR_INVALID_PATCH, applyPatch(flashUpdater, makeRecords(payload, { 0, 0, -1 }), COMPRESSION_NONE, 256, image));
+  CHECK_EQUAL(UC_ERR_INVALID_PATCH, applyPatch(flashUpdater, makeRecords(payload, { 100, 10, -101 }), COMPRESSION_NONE, 256, image));
+  // past the end of the base
+  CHECK_EQUAL(UC_ERR_INVALID_PATCH, applyPatch(flashUpdater, makeRecords(payload, { 0, 0, baseSize + 1 }), COMPRESSION_NONE, 256, image));
+  CHECK_EQUAL(UC_ERR_INVALID_PATCH, applyPatch(flashUpdater, makeRecords(payload, { 100, 0, baseSize - 99 }), COMPRESSION_NONE, 256, image));
+  // a diff past the end of the base
+  CHECK_EQUAL(UC_ERR_INVALID_PATCH, applyPatch(flashUpdater, makeRecords(payload, { 0, 0, baseSize - 10, 11, 0, 0 }),
+                                               COMPRESSION_NONE, 256, image));
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  if (argc < 3) {
+    printf("usage: test_delta_patch <python> <make_update.py>\n");
+    return 1;
+  }
+  gPython = argv[1];
+  gMakeUpdate = argv[2];
+  testTargetRebuilt();
+  testWrongBase();
+  testTruncatedPatch();
+  testSeekOutOfRange();
+  printf("test_delta_patch: ok\n");
+  return 0;
+}
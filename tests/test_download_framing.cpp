@@ -0,0 +1,124 @@
+// Framing errors of the download protocol: frames with an invalid CRC, a size field
+// larger than allowed or an unexpected type end the download with a NACK, and the
+// slot is not taken for a candidate
+
+#include <thread>
+
+#include "CandidateApplications.h"
+#include "DownloadSession.h"
+#include "SocketTransport.h"
+#include "TestSupport.h"
+#include "UCErrorCodes.h"
+
+using namespace update_client;
+using namespace test_support;
+
+namespace {
+
+const uint64_t VERSION = 3;
+
+std::vector<uint8_t> makeHeaderPayload(const std::vector<uint8_t>& image) {
+  std::vector<uint8_t> header = makeHeader(VERSION, image);
+  header.resize(HEADER_SIZE_V2);
+  return header;
+}
+
+// the frame with its last CRC byte changed
+std::vector<uint8_t> makeCorruptedFrame(uint8_t frameType, const uint8_t* pPayload, uint32_t size) {
+  std::vector<uint8_t> frame = HostLink::makeFrame(frameType, pPayload, size);
+  frame[frame.size() - 1] ^= 0x01;
+  return frame;
+}
+
+// the prefix of a frame (type and size), without payload nor CRC
+std::vector<uint8_t> makeFramePrefix(uint8_t frameType, uint32_t size) {
+  return { frameType, (uint8_t) (size >> 8), (uint8_t) size };
+}
+
+// runs a download in which the host sends the given bytes, after a valid header
+// and the start of the image when startImage is set. Checks that the device answers
+// with a NACK carrying the error returned by the download
+int32_t runDownload(const std::vector<uint8_t>& bytes, bool startImage) {
+  FlashUpdater flashUpdater;
+  flashUpdater.init();
+  HostLink hostLink;
+  SocketTransport transport(hostLink.getDeviceFd());
+  DownloadSession session(transport);
+  int32_t result = UC_ERR_NONE;
+  std::thread device([&]() { result = session.download(flashUpdater); });
+
+  const std::vector<uint8_t> image = makeImage(40 * 1024, 1);
+  uint8_t frameType = 0;
+  uint32_t value = 0;
+  if (startImage) {
+    const std::vector<uint8_t> header = makeHeaderPayload(image);
+    CHECK(hostLink.sendFrame(DOWNLOAD_FRAME_HEADER, header.data(), (uint32_t) header.size()));
+    CHECK(hostLink.receiveResponse(frameType, value));
+    CHECK_EQUAL(DOWNLOAD_FRAME_ACK, frameType);
+    CHECK(hostLink.sendData(image, 0, 2 * DOWNLOAD_MAX_DATA_SIZE));
+  }
+  CHECK(hostLink.sendRaw(bytes.data(), bytes.size()));
+  CHECK(hostLink.receiveResponse(frameType, value));
+  device.join();
+  CHECK_EQUAL(DOWNLOAD_FRAME_NACK, frameType);
+  CHECK_EQUAL(result, (int32_t) value);
+
+  // the slot of the download has no header, it is not a candidate
+  CandidateApplications candidateApplications(flashUpdater, STORAGE_ADDRESS, STORAGE_SIZE,
+                                              DownloadSession::SLOT_HEADER_SIZE, NBR_OF_SLOTS);
+  CHECK(! candidateApplications.getMbedApplication(0).hasValidHeader());
+  return result;
+}
+
+void testHeaderFrameErrors() {
+  const std::vector<uint8_t> header = makeHeaderPayload(makeImage(40 * 1024, 1));
+
+  // CRC mismatch
+  CHECK_EQUAL(UC_ERR_INVALID_FRAME,
+              runDownload(makeCorruptedFrame(DOWNLOAD_FRAME_HEADER, header.data(), (uint32_t) header.size()), false));
+  // header larger than the header area, rejected from the size field
+  CHECK_EQUAL(UC_ERR_INVALID_FRAME, runDownload(makeFramePrefix(DOWNLOAD_FRAME_HEADER, DownloadSession::SLOT_HEADER_SIZE + 1), false));
+  CHECK_EQUAL(UC_ERR_INVALID_FRAME, runDownload(makeFramePrefix(DOWNLOAD_FRAME_HEADER, 0xFFFF), false));
+  // the transfer must start with the header
+  CHECK_EQUAL(UC_ERR_INVALID_FRAME, runDownload(HostLink::makeFrame(DOWNLOAD_FRAME_DATA, header.data(), 16), false));
+  CHECK_EQUAL(UC_ERR_INVALID_FRAME, runDownload(HostLink::makeFrame(0x55, header.data(), 16), false));
+  CHECK_EQUAL(UC_ERR_INVALID_FRAME, runDownload(HostLink::makeFrame(DOWNLOAD_FRAME_ACK, header.data(), 4), false));
+}
+
+void testDataFrameErrors() {
+  const std::vector<uint8_t> data = makeImage(DOWNLOAD_MAX_DATA_SIZE, 2);
+
+  // CRC mismatch
+  CHECK_EQUAL(UC_ERR_INVALID_FRAME, runDownload(makeCorruptedFrame(DOWNLOAD_FRAME_DATA, data.data(), 100), true));
+  // payload larger than the maximum announced in the ACK, rejected from the size field
+  CHECK_EQUAL(UC_ERR_INVALID_FRAME, runDownload(makeFramePrefix(DOWNLOAD_FRAME_DATA, DOWNLOAD_MAX_DATA_SIZE + 1), true));
+  CHECK_EQUAL(UC_ERR_INVALID_FRAME, runDownload(makeFramePrefix(DOWNLOAD_FRAME_DATA, 0xFFFF), true));
+  // unknown types, a response type sent by the host and a header in the middle of the image
+  CHECK_EQUAL(UC_ERR_INVALID_FRAME, runDownload(HostLink::makeFrame(0x00, data.data(), 16), true));
+  CHECK_EQUAL(UC_ERR_INVALID_FRAME, runDownload(HostLink::makeFrame(0x7F, data.data(), 16), true));
+  CHECK_EQUAL(UC_ERR_INVALID_FRAME, runDownload(HostLink::makeFrame(DOWNLOAD_FRAME_NACK, data.data(), 4), true));
+  CHECK_EQUAL(UC_ERR_INVALID_FRAME, runDownload(HostLink::makeFrame(DOWNLOAD_FRAME_HEADER, data.data(), 16), true));
+  // an END frame has no payload
+  CHECK_EQUAL(UC_ERR_INVALID_FRAME, runDownload(HostLink::makeFrame(DOWNLOAD_FRAME_END, data.data(), 4), true));
+}
+
+void testDataPastImage() {
+  // more data than announced in the header
+  const std::vector<uint8_t> data = makeImage(DOWNLOAD_MAX_DATA_SIZE, 3);
+  std::vector<uint8_t> bytes;
+  for (uint32_t frameIndex = 0; frameIndex < 9; frameIndex++) {
+    const std::vector<uint8_t> frame = HostLink::makeFrame(DOWNLOAD_FRAME_DATA, data.data(), (uint32_t) data.size());
+    bytes.insert(bytes.end(), frame.begin(), frame.end());
+  }
+  CHECK_EQUAL(UC_ERR_INVALID_FRAME, runDownload(bytes, true));
+}
+
+} // namespace
+
+int main() {
+  testHeaderFrameErrors();
+  testDataFrameErrors();
+  testDataPastImage();
+  printf("test_download_framing: ok\n");
+  return 0;
+}
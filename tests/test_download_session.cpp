@@ -0,0 +1,320 @@
+// DownloadSession driven through a SocketTransport, against the flash simulator
+
+#include <thread>
+
+#include "CandidateApplications.h"
+#include "DownloadSession.h"
+#include "SocketTransport.h"
+#include "TestSupport.h"
+#include "UCErrorCodes.h"
+
+using namespace update_client;
+using namespace test_support;
+
+namespace {
+
+// the header frame carries the header itself, without the padding of the header area
+std::vector<uint8_t> makeHeaderPayload(uint64_t version, const std::vector<uint8_t>& image) {
+  std::vector<uint8_t> header = makeHeader(version, image);
+  header.resize(HEADER_SIZE_V2);
+  return header;
+}
+
+void testCompleteDownload() {
+  FlashUpdater flashUpdater;
+  flashUpdater.init();
+  HostLink hostLink;
+  SocketTransport transport(hostLink.getDeviceFd());
+  DownloadSession session(transport);
+
+  const std::vector<uint8_t> image = makeImage(100 * 1024 + 5, 1);
+  const std::vector<uint8_t> header = makeHeaderPayload(7, image);
+  int32_t result = UC_ERR_NONE;
+  std::thread device([&]() { result = session.download(flashUpdater); });
+
+  uint8_t frameType = 0;
+  uint32_t value = 0;
+  CHECK(hostLink.sendFrame(DOWNLOAD_FRAME_HEADER, header.data(), (uint32_t) header.size()));
+  CHECK(hostLink.receiveResponse(frameType, value));
+  CHECK_EQUAL(DOWNLOAD_FRAME_ACK, frameType);
+  CHECK_EQUAL(DOWNLOAD_MAX_DATA_SIZE, value);
+  CHECK(hostLink.sendData(image, 0, image.size()));
+  CHECK(hostLink.sendEnd());
+  CHECK(hostLink.receiveResponse(frameType, value));
+  device.join();
+  CHECK_EQUAL(UC_ERR_NONE, result);
+  CHECK_EQUAL(DOWNLOAD_FRAME_ACK, frameType);
+  CHECK_EQUAL(image.size(), value);
+
+  // the candidate is in the first slot and is valid
+  CHECK(hasImage(flashUpdater, getSlotAddress(0) + DownloadSession::SLOT_HEADER_SIZE, image));
+  CandidateApplications candidateApplications(flashUpdater, STORAGE_ADDRESS, STORAGE_SIZE,
+                                              DownloadSession::SLOT_HEADER_SIZE, NBR_OF_SLOTS);
+  CHECK_EQUAL(UC_ERR_NONE, candidateApplications.getMbedApplication(0).checkApplication());
+  CHECK_EQUAL(7, candidateApplications.getMbedApplication(0).getFirmwareVersion());
+
+  // the same image is not transferred again
+  device = std::thread([&]() { result = session.download(flashUpdater); });
+  CHECK(hostLink.sendFrame(DOWNLOAD_FRAME_HEADER, header.data(), (uint32_t) header.size()));
+  CHECK(hostLink.receiveResponse(frameType, value));
+  device.join();
+  CHECK_EQUAL(UC_ERR_NONE, result);
+  CHECK_EQUAL(DOWNLOAD_FRAME_SKIP, frameType);
+  CHECK_EQUAL(image.size(), value);
+  CHECK_EQUAL(image.size(), session.getNbrOfSkippedBytes());
+
+  // a matching header is not enough: a corrupted copy of the image is not skipped, the
+  // image is transferred again to another slot
+  flashUpdater.getMemory()[getSlotAddress(0) + DownloadSession::SLOT_HEADER_SIZE - flashUpdater.get_flash_start()] ^= 0x01;
+  device = std::thread([&]() { result = session.download(flashUpdater); });
+  CHECK(hostLink.sendFrame(DOWNLOAD_FRAME_HEADER, header.data(), (uint32_t) header.size()));
+  CHECK(hostLink.receiveResponse(frameType, value));
+  CHECK_EQUAL(DOWNLOAD_FRAME_ACK, frameType);
+  CHECK(hostLink.sendData(image, 0, image.size()));
+  CHECK(hostLink.sendEnd());
+  CHECK(hostLink.receiveResponse(frameType, value));
+  device.join();
+  CHECK_EQUAL(UC_ERR_NONE, result);
+  CHECK_EQUAL(DOWNLOAD_FRAME_ACK, frameType);
+  CHECK_EQUAL(image.size(), value);
+  CHECK(hasImage(flashUpdater, getSlotAddress(1) + DownloadSession::SLOT_HEADER_SIZE, image));
+  CandidateApplications retriedCandidates(flashUpdater, STORAGE_ADDRESS, STORAGE_SIZE,
+                                          DownloadSession::SLOT_HEADER_SIZE, NBR_OF_SLOTS);
+  CHECK_EQUAL(UC_ERR_NONE, retriedCandidates.getMbedApplication(1).checkApplication());
+  CHECK_EQUAL(7, retriedCandidates.getMbedApplication(1).getFirmwareVersion());
+}
+
+// sectors of the size of the download buffers, each buffer covers a whole sector
+const SectorRegion UNIFORM_1K_REGIONS[] = { { 1024, 1024 } };
+const FlashSimulatorConfig UNIFORM_1K_CONFIG = { 0x08000000, 8, 0xFF, UNIFORM_1K_REGIONS, 1, { 2, 8000, 32, 30 } };
+
+void sendCompleteDownload(FlashUpdater& flashUpdater, uint64_t version, const std::vector<uint8_t>& image) {
+  HostLink hostLink;
+  SocketTransport transport(hostLink.getDeviceFd());
+  DownloadSession session(transport);
+  const std::vector<uint8_t> header = makeHeaderPayload(version, image);
+  int32_t result = UC_ERR_NONE;
+  std::thread device([&]() { result = session.download(flashUpdater); });
+
+  uint8_t frameType = 0;
+  uint32_t value = 0;
+  CHECK(hostLink.sendFrame(DOWNLOAD_FRAME_HEADER, header.data(), (uint32_t) header.size()));
+  CHECK(hostLink.receiveResponse(frameType, value));
+  CHECK_EQUAL(DOWNLOAD_FRAME_ACK, frameType);
+  CHECK(hostLink.sendData(image, 0, image.size()));
+  CHECK(hostLink.sendEnd());
+  CHECK(hostLink.receiveResponse(frameType, value));
+  device.join();
+  CHECK_EQUAL(UC_ERR_NONE, result);
+  CHECK_EQUAL(DOWNLOAD_FRAME_ACK, frameType);
+}
+
+void testRetriedDownloadLeavesIdenticalSectors() {
+  FlashUpdater flashUpdater;
+  flashUpdater.configure(UNIFORM_1K_CONFIG);
+  flashUpdater.init();
+  // the other slots hold newer candidates, the first slot is the one written again
+  for (uint32_t slotIndex = 1; slotIndex < NBR_OF_SLOTS; slotIndex++) {
+    placeImage(flashUpdater, getSlotAddress(slotIndex), 10 + slotIndex, makeImage(10 * 1024, 10 + slotIndex));
+  }
+  const std::vector<uint8_t> image = makeImage(100 * 1024, 5);
+  sendCompleteDownload(flashUpdater, 2, image);
+  const uint32_t nbrOfSectors = (DownloadSession::SLOT_HEADER_SIZE + (uint32_t) image.size() + 1023) / 1024;
+
+  // the same payload sent again (with another version) replaces the oldest candidate:
+  // only the sector of the header and the last, partially written, sector are erased
+  flashUpdater.resetWriteStats();
+  sendCompleteDownload(flashUpdater, 3, image);
+  CHECK(flashUpdater.getWriteStats().nbrOfErases <= 2);
+  CHECK(flashUpdater.getWriteStats().nbrOfSkippedErases >= nbrOfSectors - 2);
+  CHECK(hasImage(flashUpdater, getSlotAddress(0) + DownloadSession::SLOT_HEADER_SIZE, image));
+  CandidateApplications candidateApplications(flashUpdater, STORAGE_ADDRESS, STORAGE_SIZE,
+                                              DownloadSession::SLOT_HEADER_SIZE, NBR_OF_SLOTS);
+  CHECK_EQUAL(UC_ERR_NONE, candidateApplications.getMbedApplication(0).checkApplication());
+  CHECK_EQUAL(3, candidateApplications.getMbedApplication(0).getFirmwareVersion());
+}
+
+// returns the data received in a few bytes at a time, with empty reads in between
+class DribblingTransport :
+  public DownloadTransport {
+public:
+  explicit DribblingTransport(DownloadTransport& transport) :
+    m_transport(transport),
+    m_nbrOfReads(0) {
+  }
+
+  virtual bool connected() {
+    return m_transport.connected();
+  }
+  virtual bool waitForData(uint32_t timeout) {
+    return m_transport.waitForData(timeout);
+  }
+  virtual uint32_t read(uint8_t* pBuffer, uint32_t size) {
+    m_nbrOfReads++;
+    if (m_nbrOfReads % 2 == 0) {
+      return 0;
+    }
+    return m_transport.read(pBuffer, (size < 7) ? size : 7);
+  }
+  virtual bool write(const uint8_t* pData, uint32_t size) {
+    return m_transport.write(pData, size);
+  }
+  virtual void interrupt() {
+    m_transport.interrupt();
+  }
+  virtual void clearInterrupt() {
+    m_transport.clearInterrupt();
+  }
+
+private:
+  DownloadTransport& m_transport;
+  uint32_t m_nbrOfReads;
+};
+
+void testShortReads() {
+  FlashUpdater flashUpdater;
+  flashUpdater.init();
+  HostLink hostLink;
+  SocketTransport socketTransport(hostLink.getDeviceFd());
+  DribblingTransport transport(socketTransport);
+  DownloadSession session(transport);
+
+  // the download buffers are filled across short and empty reads, the image is
+  // written without padding in between
+  const std::vector<uint8_t> image = makeImage(30 * 1024 + 3, 6);
+  const std::vector<uint8_t> header = makeHeaderPayload(4, image);
+  int32_t result = UC_ERR_NONE;
+  std::thread device([&]() { result = session.download(flashUpdater); });
+  uint8_t frameType = 0;
+  uint32_t value = 0;
+  CHECK(hostLink.sendFrame(DOWNLOAD_FRAME_HEADER, header.data(), (uint32_t) header.size()));
+  CHECK(hostLink.receiveResponse(frameType, value));
+  CHECK_EQUAL(DOWNLOAD_FRAME_ACK, frameType);
+  CHECK(hostLink.sendData(image, 0, image.size()));
+  CHECK(hostLink.sendEnd());
+  CHECK(hostLink.receiveResponse(frameType, value));
+  device.join();
+  CHECK_EQUAL(UC_ERR_NONE, result);
+  CHECK_EQUAL(DOWNLOAD_FRAME_ACK, frameType);
+  CHECK(hasImage(flashUpdater, getSlotAddress(0) + DownloadSession::SLOT_HEADER_SIZE, image));
+}
+
+void testStopRequest() {
+  FlashUpdater flashUpdater;
+  flashUpdater.init();
+  HostLink hostLink;
+  SocketTransport transport(hostLink.getDeviceFd());
+  DownloadSession session(transport);
+
+  const std::vector<uint8_t> image = makeImage(120 * 1024, 2);
+  const std::vector<uint8_t> header = makeHeaderPayload(8, image);
+  int32_t result = UC_ERR_NONE;
+  std::thread device([&]() { result = session.download(flashUpdater); });
+
+  uint8_t frameType = 0;
+  uint32_t value = 0;
+  CHECK(hostLink.sendFrame(DOWNLOAD_FRAME_HEADER, header.data(), (uint32_t) header.size()));
+  CHECK(hostLink.receiveResponse(frameType, value));
+  CHECK_EQUAL(DOWNLOAD_FRAME_ACK, frameType);
+  // the host stops sending in the middle of the image, the session waits for data
+  CHECK(hostLink.sendData(image, 0, 64 * 1024));
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  session.requestStop();
+  device.join();
+  CHECK_EQUAL(UC_ERR_DOWNLOAD_STOPPED, result);
+  CHECK(hostLink.receiveResponse(frameType, value));
+  CHECK_EQUAL(DOWNLOAD_FRAME_NACK, frameType);
+  CHECK_EQUAL(UC_ERR_DOWNLOAD_STOPPED, (int32_t) value);
+}
+
+void testHostDisconnected() {
+  FlashUpdater flashUpdater;
+  flashUpdater.init();
+  HostLink hostLink;
+  SocketTransport transport(hostLink.getDeviceFd());
+  DownloadSession session(transport);
+
+  const std::vector<uint8_t> image = makeImage(50 * 1024, 3);
+  const std::vector<uint8_t> header = makeHeaderPayload(9, image);
+  int32_t result = UC_ERR_NONE;
+  std::thread device([&]() { result = session.download(flashUpdater); });
+  CHECK(hostLink.sendFrame(DOWNLOAD_FRAME_HEADER, header.data(), (uint32_t) header.size()));
+  CHECK(hostLink.sendData(image, 0, 10 * 1024));
+  hostLink.closeHost();
+  device.join();
+  CHECK_EQUAL(UC_ERR_TRANSFER_INCOMPLETE, result);
+  CHECK(! transport.connected());
+}
+
+void testRunUntilStopped() {
+  HostLink hostLink;
+  SocketTransport transport(hostLink.getDeviceFd());
+  DownloadSession session(transport);
+  std::thread device([&]() { session.run(); });
+
+  // run() downloads the update files sent by the host until it is stopped
+  const std::vector<uint8_t> image = makeImage(20 * 1024, 4);
+  const std::vector<uint8_t> header = makeHeaderPayload(10, image);
+  uint8_t frameType = 0;
+  uint32_t value = 0;
+  CHECK(hostLink.sendFrame(DOWNLOAD_FRAME_HEADER, header.data(), (uint32_t) header.size()));
+  CHECK(hostLink.receiveResponse(frameType, value));
+  CHECK_EQUAL(DOWNLOAD_FRAME_ACK, frameType);
+  CHECK(hostLink.sendData(image, 0, image.size()));
+  CHECK(hostLink.sendEnd());
+  CHECK(hostLink.receiveResponse(frameType, value));
+  CHECK_EQUAL(DOWNLOAD_FRAME_ACK, frameType);
+
+  session.requestStop();
+  device.join();
+  CHECK(session.isStopRequested());
+}
+
+void testStopClearedBeforeRun() {
+  HostLink hostLink;
+  SocketTransport transport(hostLink.getDeviceFd());
+  DownloadSession session(transport);
+
+  // a stop requested while the session is not waiting leaves an interrupt pending,
+  // clearing the stop request also clears it
+  session.requestStop();
+  session.clearStopRequest();
+  CHECK(! session.isStopRequested());
+  std::thread host([&]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    const uint8_t data = 0;
+    hostLink.sendRaw(&data, sizeof(data));
+  });
+  const bool dataReceived = transport.waitForData(5000);
+  host.join();
+  CHECK(dataReceived);
+}
+
+void testWaitAfterDisconnection() {
+  HostLink hostLink;
+  SocketTransport transport(hostLink.getDeviceFd());
+  hostLink.closeHost();
+  uint8_t data = 0;
+  CHECK_EQUAL(0, transport.read(&data, sizeof(data)));
+  CHECK(! transport.connected());
+
+  // without a host, waiting for data lasts until the timeout instead of returning at once
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  CHECK(! transport.waitForData(50));
+  CHECK(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(40));
+}
+
+} // namespace
+
+int main() {
+  testCompleteDownload();
+  testRetriedDownloadLeavesIdenticalSectors();
+  testShortReads();
+  testStopRequest();
+  testHostDisconnected();
+  testRunUntilStopped();
+  testStopClearedBeforeRun();
+  testWaitAfterDisconnection();
+  printf("test_download_session: ok\n");
+  return 0;
+}
@@ -0,0 +1,229 @@
+// A download cut short followed by the install flow of the bootloader: the slot of
+// the interrupted download must not be taken for a candidate, and the active
+// application must be left as is until the download is complete
+
+#include <random>
+#include <thread>
+
+#include "CandidateApplications.h"
+#include "DownloadSession.h"
+#include "FlashWritePipeline.h"
+#include "SocketTransport.h"
+#include "TestSupport.h"
+#include "UCErrorCodes.h"
+
+using namespace update_client;
+using namespace test_support;
+
+namespace {
+
+// sectors of 16 KB, so that an interrupted download records its progress
+const SectorRegion UNIFORM_16K_REGIONS[] = { { 16 * 1024, 64 } };
+const FlashSimulatorConfig UNIFORM_16K_CONFIG = { 0x08000000, 8, 0xFF, UNIFORM_16K_REGIONS, 1, { 2, 8000, 32, 30 } };
+
+// the install flow of the bootloader: the newest candidate is installed
+// based on its header and validated while it is copied
+int32_t runBootloader(FlashUpdater& flashUpdater, bool& installed) {
+  CandidateApplications candidateApplications(flashUpdater, STORAGE_ADDRESS, STORAGE_SIZE, HEADER_SIZE, NBR_OF_SLOTS);
+  MbedApplication activeApplication(flashUpdater, ACTIVE_HEADER_ADDRESS, POST_APPLICATION_ADDR);
+  uint32_t newestSlotIndex = 0;
+  installed = candidateApplications.hasNewerApplication(activeApplication, newestSlotIndex);
+  if (! installed) {
+    return UC_ERR_NONE;
+  }
+  return candidateApplications.installApplication(newestSlotIndex, ACTIVE_HEADER_ADDRESS);
+}
+
+bool isActiveApplication(FlashUpdater& flashUpdater, uint64_t version, const std::vector<uint8_t>& image) {
+  MbedApplication activeApplication(flashUpdater, ACTIVE_HEADER_ADDRESS, POST_APPLICATION_ADDR);
+  return activeApplication.checkApplication() == UC_ERR_NONE &&
+         activeApplication.getFirmwareVersion() == version &&
+         hasImage(flashUpdater, POST_APPLICATION_ADDR, image);
+}
+
+// sends the update file up to the given payload offset, the host disconnects there.
+// The payload is sent from the offset the device resumes at, returned in resumeOffset
+int32_t sendInterruptedDownload(FlashUpdater& flashUpdater, uint64_t version, const std::vector<uint8_t>& image,
+                                size_t endOffset, size_t& resumeOffset) {
+  HostLink hostLink;
+  SocketTransport transport(hostLink.getDeviceFd());
+  DownloadSession session(transport);
+  int32_t result = UC_ERR_NONE;
+  std::thread device([&]() { result = session.download(flashUpdater); });
+
+  std::vector<uint8_t> header = makeHeader(version, image);
+  header.resize(HEADER_SIZE_V2);
+  uint8_t frameType = 0;
+  uint32_t value = 0;
+  CHECK(hostLink.sendFrame(DOWNLOAD_FRAME_HEADER, header.data(), (uint32_t) header.size()));
+  CHECK(hostLink.receiveResponse(frameType, value));
+  CHECK(frameType == DOWNLOAD_FRAME_ACK || frameType == DOWNLOAD_FRAME_RESUME);
+  resumeOffset = (frameType == DOWNLOAD_FRAME_RESUME) ? value : 0;
+  if (endOffset > resumeOffset) {
+    CHECK(hostLink.sendData(image, resumeOffset, endOffset));
+  }
+  hostLink.closeHost();
+  device.join();
+  return result;
+}
+
+int32_t sendInterruptedDownload(FlashUpdater& flashUpdater, uint64_t version, const std::vector<uint8_t>& image,
+                                size_t endOffset) {
+  size_t resumeOffset = 0;
+  const int32_t result = sendInterruptedDownload(flashUpdater, version, image, endOffset, resumeOffset);
+  CHECK_EQUAL(0, resumeOffset);
+  return result;
+}
+
+// sends the complete update file, from the offset the device resumes at, returns the offset
+size_t sendDownload(FlashUpdater& flashUpdater, uint64_t version, const std::vector<uint8_t>& image) {
+  HostLink hostLink;
+  SocketTransport transport(hostLink.getDeviceFd());
+  DownloadSession session(transport);
+  int32_t result = UC_ERR_NONE;
+  std::thread device([&]() { result = session.download(flashUpdater); });
+
+  std::vector<uint8_t> header = makeHeader(version, image);
+  header.resize(HEADER_SIZE_V2);
+  uint8_t frameType = 0;
+  uint32_t value = 0;
+  CHECK(hostLink.sendFrame(DOWNLOAD_FRAME_HEADER, header.data(), (uint32_t) header.size()));
+  CHECK(hostLink.receiveResponse(frameType, value));
+  CHECK(frameType == DOWNLOAD_FRAME_ACK || frameType == DOWNLOAD_FRAME_RESUME);
+  const size_t offset = (frameType == DOWNLOAD_FRAME_RESUME) ? value : 0;
+  CHECK(hostLink.sendData(image, offset, image.size()));
+  CHECK(hostLink.sendEnd());
+  CHECK(hostLink.receiveResponse(frameType, value));
+  device.join();
+  CHECK_EQUAL(UC_ERR_NONE, result);
+  CHECK_EQUAL(DOWNLOAD_FRAME_ACK, frameType);
+  return offset;
+}
+
+void testInterruptedDownloadIsNotInstalled(const FlashSimulatorConfig* pConfig) {
+  FlashUpdater flashUpdater;
+  if (pConfig != NULL) {
+    flashUpdater.configure(*pConfig);
+  }
+  flashUpdater.init();
+  const std::vector<uint8_t> activeImage = makeImage(90 * 1024, 1);
+  placeImage(flashUpdater, ACTIVE_HEADER_ADDRESS, 1, activeImage);
+
+  const std::vector<uint8_t> image = makeImage(100 * 1024, 2);
+  CHECK_EQUAL(UC_ERR_TRANSFER_INCOMPLETE, sendInterruptedDownload(flashUpdater, 2, image, 60 * 1024));
+
+  // the slot has no header, the bootloader keeps the active application (at each boot)
+  CandidateApplications candidateApplications(flashUpdater, STORAGE_ADDRESS, STORAGE_SIZE, HEADER_SIZE, NBR_OF_SLOTS);
+  CHECK(! candidateApplications.getMbedApplication(0).hasValidHeader());
+  for (uint32_t boot = 0; boot < 2; boot++) {
+    bool installed = true;
+    CHECK_EQUAL(UC_ERR_NONE, runBootloader(flashUpdater, installed));
+    CHECK(! installed);
+    CHECK(isActiveApplication(flashUpdater, 1, activeImage));
+  }
+
+  // once the download is complete, the candidate is installed
+  const size_t resumeOffset = sendDownload(flashUpdater, 2, image);
+  if (pConfig != NULL) {
+    // the sectors completed before the interruption are not sent again
+    CHECK_EQUAL(48 * 1024 - HEADER_SIZE, resumeOffset);
+  }
+  bool installed = false;
+  CHECK_EQUAL(UC_ERR_NONE, runBootloader(flashUpdater, installed));
+  CHECK(installed);
+  CHECK(isActiveApplication(flashUpdater, 2, image));
+}
+
+void testInterruptedDownloadKeepsOlderCandidate() {
+  FlashUpdater flashUpdater;
+  flashUpdater.init();
+  const std::vector<uint8_t> activeImage = makeImage(90 * 1024, 3);
+  placeImage(flashUpdater, ACTIVE_HEADER_ADDRESS, 1, activeImage);
+  const std::vector<uint8_t> candidateImage = makeImage(80 * 1024, 4);
+  placeImage(flashUpdater, getSlotAddress(0), 2, candidateImage);
+
+  // the download goes to an empty slot, the candidate already there is the one installed
+  const std::vector<uint8_t> image = makeImage(100 * 1024, 5);
+  CHECK_EQUAL(UC_ERR_TRANSFER_INCOMPLETE, sendInterruptedDownload(flashUpdater, 3, image, 30 * 1024));
+  bool installed = false;
+  CHECK_EQUAL(UC_ERR_NONE, runBootloader(flashUpdater, installed));
+  CHECK(installed);
+  CHECK(isActiveApplication(flashUpdater, 2, candidateImage));
+}
+
+// downloads interrupted 1 to 3 times at random offsets (reproducible, fixed seed), each
+// attempt resumes from the last sector recorded: the payload already written is not
+// sent again, except for the sector being written at the interruption
+void testResumeAtRandomOffsets() {
+  const uint32_t SECTOR_SIZE = 16 * 1024;
+  const uint32_t NBR_OF_DOWNLOADS = 20;
+  std::mt19937 random(17);
+  double minSentRatio = 1e9;
+  double maxSentRatio = 0;
+  uint32_t maxNbrOfInterruptions = 0;
+  for (uint32_t download = 0; download < NBR_OF_DOWNLOADS; download++) {
+    FlashUpdater flashUpdater;
+    flashUpdater.configure(UNIFORM_16K_CONFIG);
+    flashUpdater.init();
+    const std::vector<uint8_t> activeImage = makeImage(50 * 1024, 100 + download);
+    placeImage(flashUpdater, ACTIVE_HEADER_ADDRESS, 1, activeImage);
+    const std::vector<uint8_t> image = makeImage(SLOT_SIZE - HEADER_SIZE - (random() % (8 * 1024)), 200 + download);
+    const uint64_t version = 2 + download;
+
+    const uint32_t nbrOfInterruptions = 1 + random() % 3;
+    maxNbrOfInterruptions = (nbrOfInterruptions > maxNbrOfInterruptions) ? nbrOfInterruptions : maxNbrOfInterruptions;
+    size_t nbrOfSentBytes = 0;
+    size_t cutOffset = 0;
+    for (uint32_t interruption = 0; interruption < nbrOfInterruptions; interruption++) {
+      // cut somewhere in the remaining payload, within a DATA frame or at its end
+      const size_t previousCutOffset = cutOffset;
+      cutOffset += 1 + random() % ((image.size() - cutOffset) / 2);
+      size_t resumeOffset = 0;
+      flashUpdater.resetWriteStats();
+      CHECK_EQUAL(UC_ERR_TRANSFER_INCOMPLETE,
+                  sendInterruptedDownload(flashUpdater, version, image, cutOffset, resumeOffset));
+      nbrOfSentBytes += (cutOffset > resumeOffset) ? cutOffset - resumeOffset : 0;
+      // the sectors of an attempt are erased once at most
+      const uint32_t writtenSize = (cutOffset > resumeOffset) ? (uint32_t) (cutOffset - resumeOffset) : 0;
+      CHECK(flashUpdater.getWriteStats().nbrOfErases <= writtenSize / SECTOR_SIZE + 2);
+      if (interruption > 0) {
+        // the device resumes at a sector boundary (from the start before a sector is
+        // complete), at most a sector and the buffer in flight before the interruption
+        CHECK(resumeOffset == 0 || (resumeOffset + HEADER_SIZE) % SECTOR_SIZE == 0);
+        CHECK(resumeOffset <= previousCutOffset);
+        CHECK(previousCutOffset - resumeOffset < SECTOR_SIZE + MBED_CONF_UPDATE_CLIENT_DOWNLOAD_BUFFER_SIZE);
+      }
+    }
+
+    flashUpdater.resetWriteStats();
+    const size_t resumeOffset = sendDownload(flashUpdater, version, image);
+    CHECK(resumeOffset == 0 || (resumeOffset + HEADER_SIZE) % SECTOR_SIZE == 0);
+    CHECK(resumeOffset <= cutOffset);
+    CHECK(cutOffset - resumeOffset < SECTOR_SIZE + MBED_CONF_UPDATE_CLIENT_DOWNLOAD_BUFFER_SIZE);
+    CHECK(flashUpdater.getWriteStats().nbrOfErases <= (image.size() - resumeOffset) / SECTOR_SIZE + 2);
+    nbrOfSentBytes += image.size() - resumeOffset;
+
+    // the resumed candidate is complete and installed
+    bool installed = false;
+    CHECK_EQUAL(UC_ERR_NONE, runBootloader(flashUpdater, installed));
+    CHECK(installed);
+    CHECK(isActiveApplication(flashUpdater, version, image));
+
+    const double sentRatio = (double) nbrOfSentBytes / image.size();
+    minSentRatio = (sentRatio < minSentRatio) ? sentRatio : minSentRatio;
+    maxSentRatio = (sentRatio > maxSentRatio) ? sentRatio : maxSentRatio;
+  }
+  printf("resume at random offsets: %u downloads, 1 to %u interruptions, payload sent %.2fx to %.2fx the image size\n",
+         NBR_OF_DOWNLOADS, maxNbrOfInterruptions, minSentRatio, maxSentRatio);
+}
+
+} // namespace
+
+int main() {
+  testInterruptedDownloadIsNotInstalled(NULL);
+  testInterruptedDownloadIsNotInstalled(&UNIFORM_16K_CONFIG);
+  testInterruptedDownloadKeepsOlderCandidate();
+  testResumeAtRandomOffsets();
+  printf("test_interrupted_download: ok\n");
+  return 0;
+}
@@ -0,0 +1,125 @@
+// SectorLog, the append-only sector shared by the verification record and the
+// download journal: the last valid entry is kept across loads, the sector is
+// erased only when it is full and an entry not completely written is skipped
+
+#include "SectorLog.h"
+#include "TestSupport.h"
+#include "UCErrorCodes.h"
+
+using namespace update_client;
+using namespace test_support;
+
+namespace {
+
+const SectorRegion UNIFORM_1K_REGIONS[] = { { 1024, 1024 } };
+const FlashSimulatorConfig UNIFORM_1K_CONFIG = { 0x08000000, 8, 0xFF, UNIFORM_1K_REGIONS, 1, { 2, 8000, 32, 30 } };
+const uint32_t LOG_ADDRESS = 0x08001000;
+const uint32_t LOG_MAGIC = 0x54455354UL;
+
+struct Data {
+  uint32_t value;
+  uint8_t bytes[12];
+};
+// magic, data and CRC, in full pages of 8 bytes
+const uint32_t ENTRY_SLOT_SIZE = 24;
+const uint32_t NBR_OF_ENTRY_SLOTS = 1024 / ENTRY_SLOT_SIZE;
+
+Data makeData(uint32_t value) {
+  Data data;
+  memset(&data, (int) value, sizeof(data));
+  data.value = value;
+  return data;
+}
+
+// loads a new log on the sector, returns the value of the last entry (0 if none)
+uint32_t loadValue(FlashUpdater& flashUpdater) {
+  SectorLog sectorLog(flashUpdater, LOG_ADDRESS, LOG_MAGIC, sizeof(Data));
+  Data data = makeData(0);
+  bool found = false;
+  CHECK_EQUAL(UC_ERR_NONE, sectorLog.load(&data, found));
+  CHECK(found || data.value == 0);
+  return data.value;
+}
+
+void testAppendAndWrap() {
+  FlashUpdater flashUpdater;
+  flashUpdater.configure(UNIFORM_1K_CONFIG);
+  flashUpdater.init();
+  CHECK(! SectorLog(flashUpdater, 0, LOG_MAGIC, sizeof(Data)).isEnabled());
+  CHECK_EQUAL(0, loadValue(flashUpdater));
+
+  SectorLog sectorLog(flashUpdater, LOG_ADDRESS, LOG_MAGIC, sizeof(Data));
+  Data data;
+  bool found = false;
+  CHECK_EQUAL(UC_ERR_NONE, sectorLog.load(&data, found));
+  CHECK(! found);
+
+  // the sector is erased once, when the entry after the last slot is appended
+  flashUpdater.resetStats();
+  for (uint32_t value = 1; value <= NBR_OF_ENTRY_SLOTS; value++) {
+    const Data appended = makeData(value);
+    CHECK_EQUAL(UC_ERR_NONE, sectorLog.append(&appended));
+  }
+  CHECK_EQUAL(0, flashUpdater.getStats().nbrOfErases);
+  CHECK_EQUAL(NBR_OF_ENTRY_SLOTS, loadValue(flashUpdater));
+  const Data appended = makeData(NBR_OF_ENTRY_SLOTS + 1);
+  CHECK_EQUAL(UC_ERR_NONE, sectorLog.append(&appended));
+  CHECK_EQUAL(1, flashUpdater.getStats().nbrOfErases);
+  CHECK_EQUAL(NBR_OF_ENTRY_SLOTS + 1, loadValue(flashUpdater));
+
+  // a log reloaded on a full sector also erases it before appending
+  for (uint32_t value = NBR_OF_ENTRY_SLOTS + 2; value <= 2 * NBR_OF_ENTRY_SLOTS; value++) {
+    const Data next = makeData(value);
+    CHECK_EQUAL(UC_ERR_NONE, sectorLog.append(&next));
+  }
+  SectorLog reloadedLog(flashUpdater, LOG_ADDRESS, LOG_MAGIC, sizeof(Data));
+  CHECK_EQUAL(UC_ERR_NONE, reloadedLog.load(&data, found));
+  CHECK(found);
+  CHECK_EQUAL(2 * NBR_OF_ENTRY_SLOTS, data.value);
+  const Data last = makeData(5000);
+  CHECK_EQUAL(UC_ERR_NONE, reloadedLog.append(&last));
+  CHECK_EQUAL(2, flashUpdater.getStats().nbrOfErases);
+  CHECK_EQUAL(5000, loadValue(flashUpdater));
+}
+
+void testIncompleteEntries() {
+  FlashUpdater flashUpdater;
+  flashUpdater.configure(UNIFORM_1K_CONFIG);
+  flashUpdater.init();
+  SectorLog sectorLog(flashUpdater, LOG_ADDRESS, LOG_MAGIC, sizeof(Data));
+  Data data;
+  bool found = false;
+  CHECK_EQUAL(UC_ERR_NONE, sectorLog.load(&data, found));
+  for (uint32_t value = 1; value <= 3; value++) {
+    const Data appended = makeData(value);
+    CHECK_EQUAL(UC_ERR_NONE, sectorLog.append(&appended));
+  }
+
+  // the last entry was not completely written (reset while programming), the previous one is kept
+  uint8_t* pSector = flashUpdater.getMemory() + (LOG_ADDRESS - flashUpdater.get_flash_start());
+  memset(pSector + 2 * ENTRY_SLOT_SIZE + 12, 0xFF, ENTRY_SLOT_SIZE - 12);
+  CHECK_EQUAL(2, loadValue(flashUpdater));
+  // the entries are appended after it
+  SectorLog reloadedLog(flashUpdater, LOG_ADDRESS, LOG_MAGIC, sizeof(Data));
+  CHECK_EQUAL(UC_ERR_NONE, reloadedLog.load(&data, found));
+  const Data appended = makeData(4);
+  CHECK_EQUAL(UC_ERR_NONE, reloadedLog.append(&appended));
+  CHECK_EQUAL(4, loadValue(flashUpdater));
+  uint32_t magic = 0;
+  memcpy(&magic, pSector + 3 * ENTRY_SLOT_SIZE, sizeof(magic));
+  CHECK_EQUAL(LOG_MAGIC, magic);
+
+  // entries of another log (another magic) are ignored
+  SectorLog otherLog(flashUpdater, LOG_ADDRESS, LOG_MAGIC + 1, sizeof(Data));
+  CHECK_EQUAL(UC_ERR_NONE, otherLog.load(&data, found));
+  CHECK(! found);
+}
+
+} // namespace
+
+int main() {
+  testAppendAndWrap();
+  testIncompleteEntries();
+  printf("test_sector_log: ok\n");
+  return 0;
+}
@@ -0,0 +1,116 @@
+// Version ordered slot scan: with 4 slots holding versions 3 to 6 and the newest one
+// corrupted, CandidateApplications::hasValidNewerApplication hashes version 6, then
+// version 5 and stops. The number of images hashed is derived from the simulated
+// flash time, which is proportional to the bytes read. With the verification record,
+// the next scans only read the headers and the record
+
+#include "CandidateApplications.h"
+#include "MbedApplication.h"
+#include "TestSupport.h"
+#include "UCErrorCodes.h"
+
+using namespace update_client;
+using namespace test_support;
+
+namespace {
+
+const uint32_t IMAGE_SIZE = 100 * 1024;
+// a 16 KB sector below the active application
+const uint32_t VERIFICATION_RECORD_ADDRESS = 0x0800C000;
+
+// versions of the slots, not in slot order
+const uint64_t SLOT_VERSIONS[] = { 5, 3, 6, 4 };
+const uint32_t CORRUPTED_SLOT_INDEX = 2;
+const uint32_t VALID_SLOT_INDEX = 0;
+
+void corruptImage(FlashUpdater& flashUpdater, uint32_t slotIndex) {
+  flashUpdater.getMemory()[getSlotAddress(slotIndex) + HEADER_SIZE + IMAGE_SIZE / 2 - flashUpdater.get_flash_start()] ^= 0x01;
+}
+
+void placeCandidates(FlashUpdater& flashUpdater) {
+  placeImage(flashUpdater, ACTIVE_HEADER_ADDRESS, 2, makeImage(IMAGE_SIZE, 1));
+  for (uint32_t slotIndex = 0; slotIndex < NBR_OF_SLOTS; slotIndex++) {
+    placeImage(flashUpdater, getSlotAddress(slotIndex), SLOT_VERSIONS[slotIndex], makeImage(IMAGE_SIZE, 10 + slotIndex));
+  }
+  corruptImage(flashUpdater, CORRUPTED_SLOT_INDEX);
+}
+
+// simulated flash time of a full hash of an image
+uint64_t getHashTime(FlashUpdater& flashUpdater) {
+  flashUpdater.resetStats();
+  MbedApplication application(flashUpdater, getSlotAddress(VALID_SLOT_INDEX), getSlotAddress(VALID_SLOT_INDEX) + HEADER_SIZE);
+  CHECK_EQUAL(UC_ERR_NONE, application.checkApplication());
+  return flashUpdater.getStats().elapsedUs;
+}
+
+// runs a scan, returns the newest valid slot and the simulated flash time of the scan
+uint32_t scan(FlashUpdater& flashUpdater, uint32_t recordAddress, uint64_t& elapsedUs) {
+  CandidateApplications candidateApplications(flashUpdater, STORAGE_ADDRESS, STORAGE_SIZE, HEADER_SIZE, NBR_OF_SLOTS,
+                                              recordAddress);
+  MbedApplication activeApplication(flashUpdater, ACTIVE_HEADER_ADDRESS, POST_APPLICATION_ADDR);
+  flashUpdater.resetStats();
+  uint32_t newestSlotIndex = NBR_OF_SLOTS;
+  CHECK(candidateApplications.hasValidNewerApplication(activeApplication, newestSlotIndex));
+  elapsedUs = flashUpdater.getStats().elapsedUs;
+  return newestSlotIndex;
+}
+
+void testNewestCorrupted() {
+  FlashUpdater flashUpdater;
+  flashUpdater.init();
+  placeCandidates(flashUpdater);
+  const uint64_t hashUs = getHashTime(flashUpdater);
+  CHECK(hashUs > 0);
+
+  // versions 6 and 5 are hashed, versions 3 and 4 are not
+  uint64_t elapsedUs = 0;
+  CHECK_EQUAL(VALID_SLOT_INDEX, scan(flashUpdater, 0, elapsedUs));
+  CHECK(elapsedUs >= 2 * hashUs && elapsedUs < 3 * hashUs);
+  // a corrupted older candidate does not change the result, it is not hashed
+  corruptImage(flashUpdater, 1);
+  corruptImage(flashUpdater, 3);
+  CHECK_EQUAL(VALID_SLOT_INDEX, scan(flashUpdater, 0, elapsedUs));
+  CHECK(elapsedUs >= 2 * hashUs && elapsedUs < 3 * hashUs);
+  // without the record, every scan hashes them again
+  CHECK_EQUAL(VALID_SLOT_INDEX, scan(flashUpdater, 0, elapsedUs));
+  CHECK(elapsedUs >= 2 * hashUs);
+
+  // the slot for the next download is chosen from the headers: the oldest version
+  CandidateApplications candidateApplications(flashUpdater, STORAGE_ADDRESS, STORAGE_SIZE, HEADER_SIZE, NBR_OF_SLOTS);
+  flashUpdater.resetStats();
+  CHECK_EQUAL(1, candidateApplications.getSlotForCandidate());
+  CHECK(flashUpdater.getStats().elapsedUs < hashUs / 4);
+}
+
+void testNewestCorruptedWithRecord() {
+  FlashUpdater flashUpdater;
+  flashUpdater.init();
+  placeCandidates(flashUpdater);
+  const uint64_t hashUs = getHashTime(flashUpdater);
+
+  // the first scan hashes versions 6 and 5 and records the results
+  uint64_t elapsedUs = 0;
+  CHECK_EQUAL(VALID_SLOT_INDEX, scan(flashUpdater, VERIFICATION_RECORD_ADDRESS, elapsedUs));
+  CHECK(elapsedUs >= 2 * hashUs && elapsedUs < 3 * hashUs);
+  // the next scans hash nothing, version 6 is known not valid and version 5 valid
+  for (uint32_t bootIndex = 0; bootIndex < 3; bootIndex++) {
+    CHECK_EQUAL(VALID_SLOT_INDEX, scan(flashUpdater, VERIFICATION_RECORD_ADDRESS, elapsedUs));
+    CHECK(elapsedUs < hashUs / 4);
+  }
+
+  // a new version 6 changes the header, it is hashed and chosen
+  placeImage(flashUpdater, getSlotAddress(CORRUPTED_SLOT_INDEX), 6, makeImage(IMAGE_SIZE, 20));
+  CHECK_EQUAL(CORRUPTED_SLOT_INDEX, scan(flashUpdater, VERIFICATION_RECORD_ADDRESS, elapsedUs));
+  CHECK(elapsedUs >= hashUs && elapsedUs < 2 * hashUs);
+  CHECK_EQUAL(CORRUPTED_SLOT_INDEX, scan(flashUpdater, VERIFICATION_RECORD_ADDRESS, elapsedUs));
+  CHECK(elapsedUs < hashUs / 4);
+}
+
+} // namespace
+
+int main() {
+  testNewestCorrupted();
+  testNewestCorruptedWithRecord();
+  printf("test_slot_scan: ok\n");
+  return 0;
+}
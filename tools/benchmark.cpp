@@ -0,0 +1,677 @@
+// Host benchmarks of the update client hot paths, run against the flash simulator.
+// The results are printed as JSON on stdout, for tracking them release over release:
+//   - wall_ns_per_op: host time per operation (CPU bound parts, e.g. hashing)
+//   - sim_us: time spent in flash operations on the simulated clock, which does
+//     not depend on the host and is the figure to compare between releases
+//   - peak_heap_bytes: heap used by the operation (decompression and install), on
+//     top of the stack buffers of the update client
+//
+// Built with the host tests (tests/CMakeLists.txt):
+//   cmake -S tests -B build -DMBEDTLS_DIR=<mbed TLS source tree>
+//       -DUPDATE_CLIENT_SHA256_ENGINE=UPDATE_CLIENT_SHA256_MBEDTLS_SMALL
+//   cmake --build build --target benchmark
+//   ./build/benchmark > benchmark.json
+// SHA-256 is built from the mbed TLS sources (sha256.c) with bootloader_mbedtls_user_config.h
+// as user configuration and the same update-client.sha256-engine as the update client, so
+// that the sha256 label is the implementation measured. Configure a build directory per
+// engine and compare the sha256 throughput with the ROM size of mbedtls_sha256_process in
+// the map files of the target builds.
+
+#if defined(UPDATE_CLIENT_FLASH_SIMULATOR)
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <vector>
+
+#include "CandidateApplications.h"
+#include "Crc32.h"
+#include "Decompressor.h"
+#include "FlashUpdater.h"
+#include "ImageHasher.h"
+#include "MbedApplication.h"
+#include "UCErrorCodes.h"
+
+using namespace update_client;
+
+// heap used by the update client, tracked for the peak RAM of the benchmarks: each
+// block is allocated with its size in front of it
+namespace {
+size_t g_heapBytes = 0;
+size_t g_peakHeapBytes = 0;
+const size_t HEAP_BLOCK_PREFIX_SIZE = sizeof(max_align_t);
+} // namespace
+
+void* operator new(size_t size) {
+  uint8_t* pBlock = (uint8_t*) malloc(size + HEAP_BLOCK_PREFIX_SIZE);
+  if (pBlock == NULL) {
+    throw std::bad_alloc();
+  }
+  memcpy(pBlock, &size, sizeof(size));
+  g_heapBytes += size;
+  g_peakHeapBytes = (g_heapBytes > g_peakHeapBytes) ? g_heapBytes : g_peakHeapBytes;
+  return pBlock + HEAP_BLOCK_PREFIX_SIZE;
+}
+
+void* operator new[](size_t size) {
+  return operator new(size);
+}
+
+void operator delete(void* pData) noexcept {
+  if (pData == NULL) {
+    return;
+  }
+  uint8_t* pBlock = (uint8_t*) pData - HEAP_BLOCK_PREFIX_SIZE;
+  size_t size = 0;
+  memcpy(&size, pBlock, sizeof(size));
+  g_heapBytes -= size;
+  free(pBlock);
+}
+
+void operator delete[](void* pData) noexcept {
+  operator delete(pData);
+}
+
+void operator delete(void* pData, size_t) noexcept {
+  operator delete(pData);
+}
+
+void operator delete[](void* pData, size_t) noexcept {
+  operator delete(pData);
+}
+
+namespace {
+
+// layout used by the benchmarks, valid for all the geometries below
+const uint32_t ACTIVE_HEADER_ADDRESS = HEADER_ADDR;
+const uint32_t HEADER_SIZE = POST_APPLICATION_ADDR - HEADER_ADDR;
+const uint32_t STORAGE_ADDRESS = 0x08080000;
+const uint32_t STORAGE_SIZE = 0x80000;
+// a 16 KB sector below the application for the verification record (stm32f4_1mb)
+const uint32_t VERIFICATION_RECORD_ADDRESS = 0x0800C000;
+const uint32_t VERIFICATION_RECORD_SECTOR_SIZE = 16 * 1024;
+
+// header (version 2) fields, see MbedApplication.h
+const uint32_t HEADER_MAGIC = 0x5a51b3d4UL;
+const uint32_t HEADER_VERSION = 2;
+const uint32_t HEADER_SIZE_V2 = 112;
+const uint32_t HEADER_CRC_OFFSET = 108;
+// version 3 header, for compressed images
+const uint32_t HEADER_VERSION_V3 = 3;
+const uint32_t PAYLOAD_SIZE_OFFSET_V3 = 108;
+const uint32_t COMPRESSION_OFFSET_V3 = 116;
+const uint32_t HEADER_CRC_OFFSET_V3 = 120;
+// heatshrink parameters of the compressed images, the defaults of make_update.py
+const uint32_t WINDOW_BITS = 11;
+const uint32_t LOOKAHEAD_BITS = 6;
+
+// each benchmark is repeated for at least this time on the host
+const double MIN_WALL_NS = 200e6;
+
+const SectorRegion STM32F4_1MB_REGIONS[] = { { 16 * 1024, 4 }, { 64 * 1024, 1 }, { 128 * 1024, 7 } };
+const SectorRegion STM32F4_2MB_REGIONS[] = { { 16 * 1024, 4 }, { 64 * 1024, 1 }, { 128 * 1024, 7 },
+                                             { 16 * 1024, 4 }, { 64 * 1024, 1 }, { 128 * 1024, 7 } };
+const SectorRegion UNIFORM_2K_REGIONS[] = { { 2 * 1024, 512 } };
+const SectorRegion UNIFORM_4K_REGIONS[] = { { 4 * 1024, 256 } };
+
+struct Geometry {
+  const char* name;
+  FlashSimulatorConfig config;
+};
+
+const Geometry GEOMETRIES[] = {
+  { "stm32f4_1mb", { 0x08000000, 8, 0xFF, STM32F4_1MB_REGIONS, 3, { 2, 8000, 32, 30 } } },
+  { "uniform_2k_page8", { 0x08000000, 8, 0xFF, UNIFORM_2K_REGIONS, 1, { 2, 12000, 45, 30 } } },
+  { "uniform_4k_page4", { 0x08000000, 4, 0xFF, UNIFORM_4K_REGIONS, 1, { 2, 21000, 41, 30 } } }
+};
+
+const FlashSimulatorConfig LARGE_FLASH_CONFIG = { 0x08000000, 8, 0xFF, STM32F4_2MB_REGIONS, 6, { 2, 8000, 32, 30 } };
+
+bool g_firstResult = true;
+
+// pExtra adds fields of the benchmark to the result
+void printResult(const char* name, const char* geometry, uint32_t size, uint32_t iterations,
+                 double wallNs, const FlashSimulatorStats* pFlashStats, const char* pExtra = NULL) {
+  printf("%s\n    {\"name\": \"%s\", \"geometry\": \"%s\", \"bytes\": %u, \"iterations\": %u, \"wall_ns_per_op\": %.1f",
+         g_firstResult ? "" : ",", name, geometry, size, iterations, wallNs / iterations);
+  if (size > 0 && wallNs > 0) {
+    printf(", \"wall_mb_per_s\": %.2f", (double) size * iterations / (wallNs / 1e9) / 1e6);
+  }
+  if (pFlashStats != NULL) {
+    printf(", \"sim_us\": %llu, \"erases\": %u, \"programs\": %u, \"reads\": %u",
+           (unsigned long long) pFlashStats->elapsedUs, pFlashStats->nbrOfErases,
+           pFlashStats->nbrOfPrograms, pFlashStats->nbrOfReads);
+  }
+  if (pExtra != NULL) {
+    printf(", %s", pExtra);
+  }
+  printf("}");
+  g_firstResult = false;
+}
+
+double getWallNs(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+std::vector<uint8_t> makeImage(uint32_t size, uint32_t seed) {
+  std::vector<uint8_t> image(size);
+  srand(seed);
+  for (uint32_t index = 0; index < size; index++) {
+    image[index] = (uint8_t) rand();
+  }
+  return image;
+}
+
+void writeUint32(uint8_t* pBuffer, uint32_t value) {
+  pBuffer[0] = (uint8_t) (value >> 24);
+  pBuffer[1] = (uint8_t) (value >> 16);
+  pBuffer[2] = (uint8_t) (value >> 8);
+  pBuffer[3] = (uint8_t) value;
+}
+
+void writeUint64(uint8_t* pBuffer, uint64_t value) {
+  writeUint32(pBuffer, (uint32_t) (value >> 32));
+  writeUint32(pBuffer + 4, (uint32_t) value);
+}
+
+// builds the header area (HEADER_SIZE bytes) of the image
+void makeHeader(uint8_t* pBuffer, uint64_t version, const std::vector<uint8_t>& image) {
+  memset(pBuffer, 0xFF, HEADER_SIZE);
+  memset(pBuffer, 0, HEADER_SIZE_V2);
+  writeUint32(&pBuffer[0], HEADER_MAGIC);
+  writeUint32(&pBuffer[4], HEADER_VERSION);
+  writeUint64(&pBuffer[8], version);
+  writeUint64(&pBuffer[16], image.size());
+  ImageHasher imageHasher;
+  imageHasher.start();
+  imageHasher.update(image.data(), image.size());
+  imageHasher.finish(&pBuffer[24]);
+  writeUint32(&pBuffer[HEADER_CRC_OFFSET], Crc32::compute(pBuffer, HEADER_CRC_OFFSET));
+}
+
+// stores the header and the image in the simulated flash, without counting flash operations
+void placeImage(FlashUpdater& flashUpdater, uint32_t headerAddress, uint64_t version, const std::vector<uint8_t>& image) {
+  uint8_t* pMemory = flashUpdater.getMemory() + (headerAddress - flashUpdater.get_flash_start());
+  makeHeader(pMemory, version, image);
+  memcpy(pMemory + HEADER_SIZE, image.data(), image.size());
+}
+
+// an image that compresses like code: runs of a few recurring blocks mixed with random bytes
+std::vector<uint8_t> makeCompressibleImage(uint32_t size, uint32_t seed) {
+  const std::vector<uint8_t> blocks = makeImage(64 * 16, seed);
+  std::vector<uint8_t> image;
+  image.reserve(size);
+  srand(seed + 1);
+  while (image.size() < size) {
+    const uint32_t blockIndex = (uint32_t) rand() % 64;
+    image.insert(image.end(), &blocks[blockIndex * 16], &blocks[blockIndex * 16] + 16);
+    for (uint32_t index = (uint32_t) rand() % 8; index > 0; index--) {
+      image.push_back((uint8_t) rand());
+    }
+  }
+  image.resize(size);
+  return image;
+}
+
+// heatshrink compression (see Decompressor.h), the greedy encoder of make_update.py
+std::vector<uint8_t> compress(const std::vector<uint8_t>& data, uint32_t windowBits, uint32_t lookaheadBits) {
+  const uint32_t windowSize = 1UL << windowBits;
+  const uint32_t maxSize = 1UL << lookaheadBits;
+  const uint32_t backrefBits = 1 + windowBits + lookaheadBits;
+  std::vector<uint8_t> output;
+  uint32_t bits = 0;
+  uint32_t nbrOfBits = 0;
+  auto writeBits = [&](uint32_t value, uint32_t count) {
+    for (uint32_t bit = count; bit > 0; bit--) {
+      bits = (bits << 1) | ((value >> (bit - 1)) & 1);
+      if (++nbrOfBits == 8) {
+        output.push_back((uint8_t) bits);
+        bits = 0;
+        nbrOfBits = 0;
+      }
+    }
+  };
+  // positions of the last occurrences of each pair of bytes
+  std::vector<std::vector<uint32_t>> chains(65536);
+  uint32_t offset = 0;
+  while (offset < data.size()) {
+    uint32_t bestSize = 0;
+    uint32_t bestDistance = 0;
+    if (offset + 1 < data.size()) {
+      const std::vector<uint32_t>& chain = chains[(data[offset] << 8) | data[offset + 1]];
+      for (auto position = chain.rbegin(); position != chain.rend() && offset - *position <= windowSize; ++position) {
+        uint32_t size = 0;
+        while (size < maxSize && offset + size < data.size() && data[*position + size] == data[offset + size]) {
+          size++;
+        }
+        if (size > bestSize) {
+          bestSize = size;
+          bestDistance = offset - *position;
+          if (size == maxSize) {
+            break;
+          }
+        }
+      }
+    }
+    uint32_t step = 1;
+    if (bestSize * 9 > backrefBits) {
+      writeBits(0, 1);
+      writeBits(bestDistance - 1, windowBits);
+      writeBits(bestSize - 1, lookaheadBits);
+      step = bestSize;
+    }
+    else {
+      writeBits(1, 1);
+      writeBits(data[offset], 8);
+    }
+    for (uint32_t position = offset; position < offset + step && position + 1 < data.size(); position++) {
+      std::vector<uint32_t>& chain = chains[(data[position] << 8) | data[position + 1]];
+      chain.push_back(position);
+      if (chain.size() > 32) {
+        chain.erase(chain.begin());
+      }
+    }
+    offset += step;
+  }
+  if (nbrOfBits > 0) {
+    output.push_back((uint8_t) (bits << (8 - nbrOfBits)));
+  }
+  return output;
+}
+
+// stores a version 3 header and the payload compressed from the image in the simulated flash
+void placeCompressedImage(FlashUpdater& flashUpdater, uint32_t headerAddress, uint64_t version,
+                          const std::vector<uint8_t>& image, const std::vector<uint8_t>& payload) {
+  uint8_t* pMemory = flashUpdater.getMemory() + (headerAddress - flashUpdater.get_flash_start());
+  makeHeader(pMemory, version, image);
+  writeUint32(&pMemory[4], HEADER_VERSION_V3);
+  writeUint64(&pMemory[PAYLOAD_SIZE_OFFSET_V3], payload.size());
+  writeUint32(&pMemory[COMPRESSION_OFFSET_V3], COMPRESSION_HEATSHRINK | (WINDOW_BITS << 8) | (LOOKAHEAD_BITS << 16));
+  writeUint32(&pMemory[HEADER_CRC_OFFSET_V3], Crc32::compute(pMemory, HEADER_CRC_OFFSET_V3));
+  memcpy(pMemory + HEADER_SIZE, payload.data(), payload.size());
+}
+
+// all the software engines side by side, whatever update-client.crc32-engine selects
+// for the target (the hardware engine needs a target with DEVICE_CRC)
+void benchmarkCrc32() {
+  const uint32_t engines[] = { UPDATE_CLIENT_CRC32_BITWISE, UPDATE_CLIENT_CRC32_TABLE, UPDATE_CLIENT_CRC32_SLICING8 };
+  for (uint32_t engine : engines) {
+    char name[64];
+    snprintf(name, sizeof(name), "crc32_%s", Crc32::getEngineName(engine));
+    for (uint32_t size : { 128u, 4096u, 65536u }) {
+      std::vector<uint8_t> data = makeImage(size, 1);
+      if (Crc32::computeWithEngine(engine, data.data(), size) != Crc32::compute(data.data(), size)) {
+        fprintf(stderr, "CRC32 %s engine mismatch\n", Crc32::getEngineName(engine));
+        exit(1);
+      }
+      volatile uint32_t crc = 0;
+      uint32_t iterations = 0;
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      double wallNs = 0;
+      do {
+        for (uint32_t index = 0; index < 64; index++) {
+          crc = crc + Crc32::computeWithEngine(engine, data.data(), size);
+        }
+        iterations += 64;
+        wallNs = getWallNs(start);
+      } while (wallNs < MIN_WALL_NS);
+      printResult(name, "none", size, iterations, wallNs, NULL);
+    }
+  }
+}
+
+// SHA-256 throughput of the selected engine, without the flash reads of checkApplication
+void benchmarkSha256() {
+  char name[64];
+  snprintf(name, sizeof(name), "sha256_%s", ImageHasher::getEngineName());
+  for (uint32_t size : { 4096u, 65536u }) {
+    std::vector<uint8_t> data = makeImage(size, 1);
+    uint8_t hash[ImageHasher::HASH_SIZE];
+    uint32_t iterations = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    double wallNs = 0;
+    do {
+      for (uint32_t index = 0; index < 16; index++) {
+        ImageHasher imageHasher;
+        imageHasher.start();
+        imageHasher.update(data.data(), size);
+        imageHasher.finish(hash);
+      }
+      iterations += 16;
+      wallNs = getWallNs(start);
+    } while (wallNs < MIN_WALL_NS);
+    printResult(name, "none", size, iterations, wallNs, NULL);
+  }
+}
+
+// parsing a header covers the CRC of the header and the big endian fields (parseUint32/parseUint64)
+void benchmarkHeaderParsing() {
+  FlashUpdater flashUpdater;
+  flashUpdater.init();
+  uint8_t header[HEADER_SIZE];
+  makeHeader(header, 5, makeImage(1024, 2));
+
+  uint32_t iterations = 0;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  double wallNs = 0;
+  do {
+    for (uint32_t index = 0; index < 1024; index++) {
+      MbedApplication application(flashUpdater, STORAGE_ADDRESS, STORAGE_ADDRESS + HEADER_SIZE);
+      if (application.parseApplicationHeader(header, sizeof(header)) != UC_ERR_NONE) {
+        fprintf(stderr, "Header parsing failed\n");
+        exit(1);
+      }
+    }
+    iterations += 1024;
+    wallNs = getWallNs(start);
+  } while (wallNs < MIN_WALL_NS);
+  printResult("parse_header", "none", HEADER_SIZE_V2, iterations, wallNs, NULL);
+
+  // reading the header from flash adds the flash reads, sim_us is the one of a single read
+  placeImage(flashUpdater, STORAGE_ADDRESS, 5, makeImage(1024, 2));
+  FlashSimulatorStats flashStats;
+  iterations = 0;
+  start = std::chrono::steady_clock::now();
+  wallNs = 0;
+  do {
+    for (uint32_t index = 0; index < 1024; index++) {
+      flashUpdater.resetStats();
+      MbedApplication application(flashUpdater, STORAGE_ADDRESS, STORAGE_ADDRESS + HEADER_SIZE);
+      if (application.getFirmwareVersion() != 5) {
+        fprintf(stderr, "Header reading failed\n");
+        exit(1);
+      }
+      flashStats = flashUpdater.getStats();
+    }
+    iterations += 1024;
+    wallNs = getWallNs(start);
+  } while (wallNs < MIN_WALL_NS);
+  printResult("read_header", "stm32f4_1mb", HEADER_SIZE_V2, iterations, wallNs, &flashStats);
+}
+
+void benchmarkCheckApplication() {
+  FlashUpdater flashUpdater;
+  flashUpdater.configure(LARGE_FLASH_CONFIG);
+  flashUpdater.init();
+  for (uint32_t size : { 64u * 1024, 256u * 1024, 1024u * 1024 }) {
+    placeImage(flashUpdater, ACTIVE_HEADER_ADDRESS, 5, makeImage(size, 3));
+
+    FlashSimulatorStats flashStats;
+    uint32_t iterations = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    double wallNs = 0;
+    do {
+      flashUpdater.resetStats();
+      MbedApplication application(flashUpdater, ACTIVE_HEADER_ADDRESS, POST_APPLICATION_ADDR);
+      if (application.checkApplication() != UC_ERR_NONE) {
+        fprintf(stderr, "Application check failed\n");
+        exit(1);
+      }
+      flashStats = flashUpdater.getStats();
+      iterations++;
+      wallNs = getWallNs(start);
+    } while (wallNs < MIN_WALL_NS);
+    printResult("check_application", "stm32f4_2mb", size, iterations, wallNs, &flashStats);
+  }
+}
+
+// installs the candidate from the storage over the active application, on each geometry.
+// The throughput is the one of the image installed, peak_heap_bytes is the heap used by
+// the install (staging buffer and, for a compressed candidate, the decompression window)
+void benchmarkInstall(const char* name, const std::vector<uint8_t>& oldImage, const std::vector<uint8_t>& newImage,
+                      const std::vector<uint8_t>* pPayload,
+                      uint32_t installBufferSize = MBED_CONF_UPDATE_CLIENT_INSTALL_BUFFER_SIZE) {
+  const uint32_t size = (uint32_t) newImage.size();
+  for (const Geometry& geometry : GEOMETRIES) {
+    FlashSimulatorStats flashStats;
+    size_t peakHeapBytes = 0;
+    uint32_t iterations = 0;
+    double wallNs = 0;
+    do {
+      // the active application is replaced, so that its sectors are erased and programmed
+      FlashUpdater flashUpdater;
+      flashUpdater.configure(geometry.config);
+      flashUpdater.init();
+      placeImage(flashUpdater, ACTIVE_HEADER_ADDRESS, 4, oldImage);
+      if (pPayload != NULL) {
+        placeCompressedImage(flashUpdater, STORAGE_ADDRESS, 5, newImage, *pPayload);
+      }
+      else {
+        placeImage(flashUpdater, STORAGE_ADDRESS, 5, newImage);
+      }
+      CandidateApplications candidateApplications(flashUpdater, STORAGE_ADDRESS, STORAGE_SIZE, HEADER_SIZE, 1);
+      candidateApplications.setInstallBufferSize(installBufferSize);
+
+      flashUpdater.resetStats();
+      const size_t heapBytes = g_heapBytes;
+      g_peakHeapBytes = heapBytes;
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      if (candidateApplications.installApplication(0, ACTIVE_HEADER_ADDRESS) != UC_ERR_NONE) {
+        fprintf(stderr, "Install failed\n");
+        exit(1);
+      }
+      wallNs += getWallNs(start);
+      peakHeapBytes = g_peakHeapBytes - heapBytes;
+      flashStats = flashUpdater.getStats();
+      iterations++;
+    } while (wallNs < MIN_WALL_NS);
+    char extra[128];
+    snprintf(extra, sizeof(extra), "\"payload_bytes\": %u, \"install_buffer_bytes\": %u, \"peak_heap_bytes\": %u",
+             (uint32_t) ((pPayload != NULL) ? pPayload->size() : size), installBufferSize, (uint32_t) peakHeapBytes);
+    printResult(name, geometry.name, size, iterations, wallNs, &flashStats, extra);
+  }
+}
+
+void benchmarkInstallApplication() {
+  const uint32_t size = 256 * 1024;
+  benchmarkInstall("install_application", makeImage(size, 4), makeImage(size, 5), NULL);
+}
+
+// install time against the size of the staging buffer (update-client.install-buffer-size),
+// the chunks programmed are limited by this size and by the sectors
+void benchmarkInstallBufferSizes() {
+  const uint32_t size = 256 * 1024;
+  const std::vector<uint8_t> oldImage = makeImage(size, 4);
+  const std::vector<uint8_t> newImage = makeImage(size, 5);
+  for (uint32_t installBufferSize : { 256u, 512u, 1024u, 2048u, 4096u, 8192u, 16384u, 32768u }) {
+    benchmarkInstall("install_buffer_sweep", oldImage, newImage, NULL, installBufferSize);
+  }
+}
+
+// a compressed candidate is decompressed while it is installed
+void benchmarkInstallCompressedApplication() {
+  const uint32_t size = 256 * 1024;
+  const std::vector<uint8_t> newImage = makeCompressibleImage(size, 5);
+  const std::vector<uint8_t> payload = compress(newImage, WINDOW_BITS, LOOKAHEAD_BITS);
+  benchmarkInstall("install_compressed_application", makeImage(size, 4), newImage, &payload);
+}
+
+// counts the decompressed bytes
+class CountingSink :
+  public DecompressorSink {
+public:
+  CountingSink() :
+    m_nbrOfBytes(0) {
+  }
+
+  virtual int32_t write(const uint8_t* pData, uint32_t size) {
+    (void) pData;
+    m_nbrOfBytes += size;
+    return UC_ERR_NONE;
+  }
+
+  uint64_t m_nbrOfBytes;
+};
+
+// decompression alone, fed in blocks of the size of the DATA frames
+void benchmarkDecompress() {
+  const uint32_t size = 256 * 1024;
+  const uint32_t blockSize = 4096;
+  const std::vector<uint8_t> payload = compress(makeCompressibleImage(size, 5), WINDOW_BITS, LOOKAHEAD_BITS);
+  size_t peakHeapBytes = 0;
+  uint32_t iterations = 0;
+  double wallNs = 0;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  do {
+    const size_t heapBytes = g_heapBytes;
+    g_peakHeapBytes = heapBytes;
+    Decompressor decompressor;
+    CountingSink sink;
+    int32_t result = decompressor.start(COMPRESSION_HEATSHRINK | (WINDOW_BITS << 8) | (LOOKAHEAD_BITS << 16));
+    for (uint32_t offset = 0; offset < payload.size() && result == UC_ERR_NONE; offset += blockSize) {
+      const uint32_t updateSize = (payload.size() - offset < blockSize) ? (uint32_t) (payload.size() - offset) : blockSize;
+      result = decompressor.update(&payload[offset], updateSize, sink);
+    }
+    if (result != UC_ERR_NONE || sink.m_nbrOfBytes != size) {
+      fprintf(stderr, "Decompression failed\n");
+      exit(1);
+    }
+    peakHeapBytes = g_peakHeapBytes - heapBytes;
+    iterations++;
+    wallNs = getWallNs(start);
+  } while (wallNs < MIN_WALL_NS);
+  char extra[96];
+  snprintf(extra, sizeof(extra), "\"payload_bytes\": %u, \"peak_heap_bytes\": %u", (uint32_t) payload.size(), (uint32_t) peakHeapBytes);
+  printResult("decompress", "none", size, iterations, wallNs, NULL, extra);
+}
+
+void benchmarkCompareTo() {
+  const uint32_t size = 256 * 1024;
+  FlashUpdater flashUpdater;
+  flashUpdater.init();
+  const std::vector<uint8_t> image = makeImage(size, 6);
+  placeImage(flashUpdater, ACTIVE_HEADER_ADDRESS, 5, image);
+  placeImage(flashUpdater, STORAGE_ADDRESS, 5, image);
+
+  FlashSimulatorStats flashStats;
+  uint32_t iterations = 0;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  double wallNs = 0;
+  do {
+    flashUpdater.resetStats();
+    MbedApplication activeApplication(flashUpdater, ACTIVE_HEADER_ADDRESS, POST_APPLICATION_ADDR);
+    MbedApplication candidateApplication(flashUpdater, STORAGE_ADDRESS, STORAGE_ADDRESS + HEADER_SIZE);
+    activeApplication.compareTo(candidateApplication);
+    flashStats = flashUpdater.getStats();
+    iterations++;
+    wallNs = getWallNs(start);
+  } while (wallNs < MIN_WALL_NS);
+  printResult("compare_to", "stm32f4_1mb", size, iterations, wallNs, &flashStats);
+}
+
+// full slot scan with 4 slots holding versions 3 to 6, the newest one being valid or not
+void benchmarkSlotScan() {
+  const uint32_t size = 100 * 1024;
+  const uint32_t nbrOfSlots = 4;
+  for (bool newestValid : { true, false }) {
+    FlashUpdater flashUpdater;
+    flashUpdater.init();
+    placeImage(flashUpdater, ACTIVE_HEADER_ADDRESS, 2, makeImage(size, 7));
+    for (uint32_t slotIndex = 0; slotIndex < nbrOfSlots; slotIndex++) {
+      const uint32_t slotAddress = STORAGE_ADDRESS + slotIndex * (STORAGE_SIZE / nbrOfSlots);
+      placeImage(flashUpdater, slotAddress, 3 + slotIndex, makeImage(size, 8 + slotIndex));
+      if (slotIndex == nbrOfSlots - 1 && ! newestValid) {
+        flashUpdater.getMemory()[slotAddress + HEADER_SIZE - flashUpdater.get_flash_start()] ^= 0xFF;
+      }
+    }
+
+    FlashSimulatorStats flashStats;
+    uint32_t iterations = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    double wallNs = 0;
+    do {
+      flashUpdater.resetStats();
+      CandidateApplications candidateApplications(flashUpdater, STORAGE_ADDRESS, STORAGE_SIZE, HEADER_SIZE, nbrOfSlots);
+      MbedApplication activeApplication(flashUpdater, ACTIVE_HEADER_ADDRESS, POST_APPLICATION_ADDR);
+      uint32_t newestSlotIndex = 0;
+      if (! candidateApplications.hasValidNewerApplication(activeApplication, newestSlotIndex)) {
+        fprintf(stderr, "Slot scan failed\n");
+        exit(1);
+      }
+      flashStats = flashUpdater.getStats();
+      iterations++;
+      wallNs = getWallNs(start);
+    } while (wallNs < MIN_WALL_NS);
+    printResult(newestValid ? "slot_scan_newest_valid" : "slot_scan_newest_corrupt", "stm32f4_1mb",
+                nbrOfSlots * size, iterations, wallNs, &flashStats);
+  }
+}
+
+// what the bootloader does at each boot: check the active application and look for the
+// newest valid candidate, with 4 slots holding versions 3 to 6. With the verification
+// record, the first boot hashes and records the applications and the next boots only
+// read the headers and the record
+void benchmarkBootScan() {
+  const uint32_t size = 100 * 1024;
+  const uint32_t nbrOfSlots = 4;
+  FlashUpdater flashUpdater;
+  flashUpdater.init();
+  placeImage(flashUpdater, ACTIVE_HEADER_ADDRESS, 2, makeImage(size, 7));
+  for (uint32_t slotIndex = 0; slotIndex < nbrOfSlots; slotIndex++) {
+    const uint32_t slotAddress = STORAGE_ADDRESS + slotIndex * (STORAGE_SIZE / nbrOfSlots);
+    placeImage(flashUpdater, slotAddress, 3 + slotIndex, makeImage(size, 8 + slotIndex));
+  }
+  uint8_t* pRecordSector = flashUpdater.getMemory() + (VERIFICATION_RECORD_ADDRESS - flashUpdater.get_flash_start());
+
+  struct BootScan {
+    const char* name;
+    uint32_t recordAddress;
+    bool firstBoot;
+  };
+  const BootScan bootScans[] = {
+    { "boot_scan_without_record", 0, false },
+    { "boot_scan_record_first_boot", VERIFICATION_RECORD_ADDRESS, true },
+    { "boot_scan_with_record", VERIFICATION_RECORD_ADDRESS, false }
+  };
+  for (const BootScan& bootScan : bootScans) {
+    FlashSimulatorStats flashStats;
+    uint32_t iterations = 0;
+    double wallNs = 0;
+    do {
+      if (bootScan.firstBoot) {
+        // nothing recorded yet
+        memset(pRecordSector, flashUpdater.get_erase_value(), VERIFICATION_RECORD_SECTOR_SIZE);
+      }
+      flashUpdater.resetStats();
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      CandidateApplications candidateApplications(flashUpdater, STORAGE_ADDRESS, STORAGE_SIZE, HEADER_SIZE, nbrOfSlots,
+                                                  bootScan.recordAddress);
+      MbedApplication activeApplication(flashUpdater, ACTIVE_HEADER_ADDRESS, POST_APPLICATION_ADDR);
+      activeApplication.setVerificationRecord(&candidateApplications.getVerificationRecord());
+      uint32_t newestSlotIndex = 0;
+      if (activeApplication.checkApplication() != UC_ERR_NONE ||
+          ! candidateApplications.hasValidNewerApplication(activeApplication, newestSlotIndex)) {
+        fprintf(stderr, "Boot scan failed\n");
+        exit(1);
+      }
+      wallNs += getWallNs(start);
+      flashStats = flashUpdater.getStats();
+      iterations++;
+    } while (wallNs < MIN_WALL_NS);
+    printResult(bootScan.name, "stm32f4_1mb", (nbrOfSlots + 1) * size, iterations, wallNs, &flashStats);
+  }
+}
+
+} // namespace
+
+int main() {
+  printf("{\n  \"benchmarks\": [");
+  benchmarkCrc32();
+  benchmarkSha256();
+  benchmarkHeaderParsing();
+  benchmarkCheckApplication();
+  benchmarkInstallApplication();
+  benchmarkInstallBufferSizes();
+  benchmarkDecompress();
+  benchmarkInstallCompressedApplication();
+  benchmarkCompareTo();
+  benchmarkSlotScan();
+  benchmarkBootScan();
+  printf("\n  ]\n}\n");
+
+  return 0;
+}
+
+#endif // UPDATE_CLIENT_FLASH_SIMULATOR
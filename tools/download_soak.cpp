@@ -0,0 +1,229 @@
+// Host soak test of the download: runs the DownloadSession through a SocketTransport
+// against the flash simulator, the host side of the protocol running in another
+// thread on the other end of a socket pair. Each download sends a new image, so
+// that the slots are erased and programmed again, and the results are printed as
+// JSON on stdout:
+//   - wall_kb_per_s: throughput of the whole download on the host (protocol,
+//     hashing and pipeline), the flash operations take no real time
+//   - sim_us: time spent in flash operations on the simulated clock
+//
+// The link is a socket pair or a pty (raw mode, the device on the master side).
+// The read size limits the bytes returned by each read of the device: 1 receives
+// the data byte per byte, as the getc() loop before block reads did, 0 reads
+// all the data available.
+//
+// Built by the host build (see tests/CMakeLists.txt), run with:
+//   download_soak [image size in KB] [number of downloads] [socket|pty] [read size]
+
+#if defined(UPDATE_CLIENT_FLASH_SIMULATOR) && defined(UPDATE_DOWNLOAD)
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "Crc32.h"
+#include "DownloadProtocol.h"
+#include "DownloadTransport.h"
+#include "DownloadSession.h"
+#include "FlashUpdater.h"
+#include "ImageHasher.h"
+#include "SocketTransport.h"
+#include "UCErrorCodes.h"
+
+using namespace update_client;
+
+namespace {
+
+const uint32_t HEADER_MAGIC = 0x5a51b3d4UL;
+const uint32_t HEADER_SIZE_V2 = 112;
+const uint32_t HEADER_CRC_OFFSET = 108;
+
+std::vector<uint8_t> makeImage(uint32_t size, uint32_t seed) {
+  std::vector<uint8_t> image(size);
+  srand(seed);
+  for (uint32_t index = 0; index < size; index++) {
+    image[index] = (uint8_t) rand();
+  }
+  return image;
+}
+
+void writeUint32(uint8_t* pBuffer, uint32_t value) {
+  pBuffer[0] = (uint8_t) (value >> 24);
+  pBuffer[1] = (uint8_t) (value >> 16);
+  pBuffer[2] = (uint8_t) (value >> 8);
+  pBuffer[3] = (uint8_t) value;
+}
+
+void writeUint64(uint8_t* pBuffer, uint64_t value) {
+  writeUint32(pBuffer, (uint32_t) (value >> 32));
+  writeUint32(pBuffer + 4, (uint32_t) value);
+}
+
+std::vector<uint8_t> makeHeader(uint64_t version, const std::vector<uint8_t>& image) {
+  std::vector<uint8_t> header(HEADER_SIZE_V2, 0);
+  writeUint32(&header[0], HEADER_MAGIC);
+  writeUint32(&header[4], 2);
+  writeUint64(&header[8], version);
+  writeUint64(&header[16], image.size());
+  ImageHasher imageHasher;
+  imageHasher.start();
+  imageHasher.update(image.data(), image.size());
+  imageHasher.finish(&header[24]);
+  writeUint32(&header[HEADER_CRC_OFFSET], Crc32::compute(header.data(), HEADER_CRC_OFFSET));
+  return header;
+}
+
+bool sendFrame(int fd, uint8_t frameType, const uint8_t* pPayload, uint32_t size) {
+  std::vector<uint8_t> frame = { frameType, (uint8_t) (size >> 8), (uint8_t) size };
+  frame.insert(frame.end(), pPayload, pPayload + size);
+  frame.resize(frame.size() + DOWNLOAD_FRAME_CRC_SIZE);
+  writeUint32(&frame[frame.size() - DOWNLOAD_FRAME_CRC_SIZE],
+              Crc32::compute(frame.data(), (uint32_t) frame.size() - DOWNLOAD_FRAME_CRC_SIZE));
+  size_t offset = 0;
+  while (offset < frame.size()) {
+    ssize_t written = write(fd, frame.data() + offset, frame.size() - offset);
+    if (written <= 0) {
+      return false;
+    }
+    offset += (size_t) written;
+  }
+  return true;
+}
+
+bool receiveResponse(int fd, uint8_t& frameType) {
+  uint8_t frame[DOWNLOAD_FRAME_PREFIX_SIZE + DOWNLOAD_RESPONSE_SIZE + DOWNLOAD_FRAME_CRC_SIZE];
+  size_t offset = 0;
+  while (offset < sizeof(frame)) {
+    ssize_t readSize = read(fd, frame + offset, sizeof(frame) - offset);
+    if (readSize <= 0) {
+      return false;
+    }
+    offset += (size_t) readSize;
+  }
+  frameType = frame[0];
+  return true;
+}
+
+// limits the size of the reads of another transport
+class LimitedReadTransport :
+  public DownloadTransport {
+public:
+  LimitedReadTransport(DownloadTransport& transport, uint32_t maxReadSize) :
+    m_transport(transport),
+    m_maxReadSize(maxReadSize) {
+  }
+
+  virtual bool connected() {
+    return m_transport.connected();
+  }
+  virtual bool waitForData(uint32_t timeout) {
+    return m_transport.waitForData(timeout);
+  }
+  virtual uint32_t read(uint8_t* pBuffer, uint32_t size) {
+    return m_transport.read(pBuffer, (m_maxReadSize > 0 && size > m_maxReadSize) ? m_maxReadSize : size);
+  }
+  virtual bool write(const uint8_t* pData, uint32_t size) {
+    return m_transport.write(pData, size);
+  }
+  virtual void interrupt() {
+    m_transport.interrupt();
+  }
+  virtual void clearInterrupt() {
+    m_transport.clearInterrupt();
+  }
+
+private:
+  DownloadTransport& m_transport;
+  const uint32_t m_maxReadSize;
+};
+
+// opens a pty in raw mode, the device uses the master side and the host the slave side
+bool openPty(int& deviceFd, int& hostFd) {
+  deviceFd = posix_openpt(O_RDWR | O_NOCTTY);
+  if (deviceFd < 0 || grantpt(deviceFd) != 0 || unlockpt(deviceFd) != 0) {
+    return false;
+  }
+  hostFd = open(ptsname(deviceFd), O_RDWR | O_NOCTTY);
+  struct termios attributes;
+  if (hostFd < 0 || tcgetattr(hostFd, &attributes) != 0) {
+    return false;
+  }
+  cfmakeraw(&attributes);
+  return tcsetattr(hostFd, TCSANOW, &attributes) == 0;
+}
+
+// sends the update file and returns whether the device acknowledged it
+bool sendUpdate(int fd, uint64_t version, const std::vector<uint8_t>& image) {
+  const std::vector<uint8_t> header = makeHeader(version, image);
+  uint8_t frameType = 0;
+  if (! sendFrame(fd, DOWNLOAD_FRAME_HEADER, header.data(), (uint32_t) header.size()) ||
+      ! receiveResponse(fd, frameType) || frameType != DOWNLOAD_FRAME_ACK) {
+    return false;
+  }
+  for (size_t offset = 0; offset < image.size(); offset += DOWNLOAD_MAX_DATA_SIZE) {
+    const size_t size = (image.size() - offset < DOWNLOAD_MAX_DATA_SIZE) ? image.size() - offset : DOWNLOAD_MAX_DATA_SIZE;
+    if (! sendFrame(fd, DOWNLOAD_FRAME_DATA, &image[offset], (uint32_t) size)) {
+      return false;
+    }
+  }
+  return sendFrame(fd, DOWNLOAD_FRAME_END, NULL, 0) &&
+         receiveResponse(fd, frameType) && frameType == DOWNLOAD_FRAME_ACK;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  const uint32_t imageSize = ((argc > 1) ? (uint32_t) atoi(argv[1]) : 100) * 1024;
+  const uint32_t nbrOfDownloads = (argc > 2) ? (uint32_t) atoi(argv[2]) : 20;
+  const bool pty = (argc > 3) && strcmp(argv[3], "pty") == 0;
+  const uint32_t maxReadSize = (argc > 4) ? (uint32_t) atoi(argv[4]) : 0;
+
+  // fds[0] is the host side, fds[1] the device side
+  int fds[2] = { -1, -1 };
+  if (pty ? ! openPty(fds[1], fds[0]) : socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+    fprintf(stderr, "Cannot create the %s\n", pty ? "pty" : "socket pair");
+    return 1;
+  }
+  FlashUpdater flashUpdater;
+  flashUpdater.init();
+  SocketTransport socketTransport(fds[1]);
+  LimitedReadTransport transport(socketTransport, maxReadSize);
+  DownloadSession session(transport);
+
+  printf("{\n  \"link\": \"%s\",\n  \"read_size\": %u,\n", pty ? "pty" : "socket", maxReadSize);
+  printf("  \"downloads\": [");
+  for (uint32_t download = 0; download < nbrOfDownloads; download++) {
+    const std::vector<uint8_t> image = makeImage(imageSize, download + 1);
+    flashUpdater.resetStats();
+    int32_t result = UC_ERR_NONE;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::thread device([&]() { result = session.download(flashUpdater); });
+    const bool acknowledged = sendUpdate(fds[0], download + 1, image);
+    device.join();
+    const double wallS = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (! acknowledged || result != UC_ERR_NONE) {
+      fprintf(stderr, "Download %u failed: %d\n", download, result);
+      return 1;
+    }
+    const FlashSimulatorStats& flashStats = flashUpdater.getStats();
+    printf("%s\n    {\"download\": %u, \"bytes\": %u, \"wall_kb_per_s\": %.1f, \"time_to_first_byte_ms\": %u, "
+           "\"sim_us\": %llu, \"erases\": %u, \"programs\": %u}",
+           download == 0 ? "" : ",", download, imageSize, imageSize / 1024.0 / wallS, session.getTimeToFirstByte(),
+           (unsigned long long) flashStats.elapsedUs, flashStats.nbrOfErases, flashStats.nbrOfPrograms);
+  }
+  printf("\n  ]\n}\n");
+
+  close(fds[0]);
+  close(fds[1]);
+  return 0;
+}
+
+#endif // UPDATE_CLIENT_FLASH_SIMULATOR && UPDATE_DOWNLOAD
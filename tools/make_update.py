@@ -0,0 +1,236 @@
+#!/usr/bin/env python3
+"""Builds update files for the update client.
+
+The update file is the application header (version 3) followed by the payload,
+the header is sent in the HEADER frame and the payload in the DATA frames of the
+download protocol (see DownloadProtocol.h).
+
+The payload is the application binary, or a delta patch against the active
+application when --base is given (see DeltaPatcher.h). It is compressed with
+heatshrink (see Decompressor.h) unless --no-compression is given.
+
+Example:
+  make_update.py --version 5 --base app_v4.bin app_v5.bin -o update_v5.bin
+"""
+
+import argparse
+import hashlib
+import struct
+import sys
+import zlib
+
+HEADER_MAGIC = 0x5A51B3D4
+HEADER_VERSION_V3 = 3
+HEADER_SIZE_V3 = 124
+HEADER_CRC_OFFSET_V3 = 120
+
+COMPRESSION_NONE = 0
+COMPRESSION_HEATSHRINK = 1
+COMPRESSION_DELTA = 0x01000000
+
+PATCH_MAGIC = 0x55434450
+# matches shorter than this are sent as extra bytes
+MIN_MATCH_SIZE = 16
+# key size used for indexing the base
+KEY_SIZE = 8
+# candidates kept per key
+MAX_CANDIDATES = 8
+# approximate matches end when more bytes than this differ in the last MISMATCH_WINDOW bytes
+MISMATCH_WINDOW = 32
+MAX_MISMATCHES = 8
+
+
+def extend_match(base, image, base_offset, image_offset):
+    """Returns the size of the approximate match, ending on an equal byte."""
+    size = 0
+    matched_size = 0
+    mismatches = []
+    limit = min(len(base) - base_offset, len(image) - image_offset)
+    while size < limit:
+        # skip equal blocks quickly
+        block = min(64, limit - size)
+        if base[base_offset + size:base_offset + size + block] == image[image_offset + size:image_offset + size + block]:
+            size += block
+            matched_size = size
+            continue
+        if base[base_offset + size] == image[image_offset + size]:
+            matched_size = size + 1
+        else:
+            mismatches.append(size)
+            while mismatches and mismatches[0] <= size - MISMATCH_WINDOW:
+                mismatches.pop(0)
+            if len(mismatches) > MAX_MISMATCHES:
+                break
+        size += 1
+    return matched_size
+
+
+def find_matches(base, image):
+    """Returns the (image offset, base offset, size) of the regions of the image found in the base."""
+    index = {}
+    for offset in range(len(base) - KEY_SIZE + 1):
+        candidates = index.setdefault(base[offset:offset + KEY_SIZE], [])
+        if len(candidates) < MAX_CANDIDATES:
+            candidates.append(offset)
+
+    matches = []
+    image_offset = 0
+    # the base offset expected if the previous match continues (e.g. after an insertion)
+    expected_base_offset = 0
+    while image_offset < len(image):
+        candidates = list(index.get(image[image_offset:image_offset + KEY_SIZE], []))
+        if expected_base_offset < len(base):
+            candidates.append(expected_base_offset)
+        best_size = 0
+        best_base_offset = 0
+        for base_offset in candidates:
+            size = extend_match(base, image, base_offset, image_offset)
+            if size > best_size:
+                best_size = size
+                best_base_offset = base_offset
+        if best_size >= MIN_MATCH_SIZE:
+            matches.append((image_offset, best_base_offset, best_size))
+            image_offset += best_size
+            expected_base_offset = best_base_offset + best_size
+        else:
+            image_offset += 1
+            expected_base_offset += 1
+    return matches
+
+
+def make_patch(base, image):
+    """Returns the delta patch rebuilding the image from the base."""
+    patch = bytearray(struct.pack(">IQ", PATCH_MAGIC, len(base)))
+    patch += hashlib.sha256(base).digest()
+
+    matches = find_matches(base, image)
+    # the first record copies the bytes before the first match
+    first = matches[0] if matches else (len(image), 0, 0)
+    records = [(0, 0, 0, first[0], first[1])]
+    for index, (image_offset, base_offset, size) in enumerate(matches):
+        following = matches[index + 1] if index + 1 < len(matches) else (len(image), base_offset + size, 0)
+        records.append((image_offset, base_offset, size, following[0] - image_offset - size,
+                        following[1] - base_offset - size))
+
+    base_position = 0
+    image_position = 0
+    for image_offset, base_offset, diff_size, extra_size, seek in records:
+        assert base_position == base_offset and image_position == image_offset
+        patch += struct.pack(">IIi", diff_size, extra_size, seek)
+        patch += bytes((image[image_offset + i] - base[base_offset + i]) & 0xFF for i in range(diff_size))
+        patch += image[image_offset + diff_size:image_offset + diff_size + extra_size]
+        base_position = base_offset + diff_size + seek
+        image_position = image_offset + diff_size + extra_size
+    return bytes(patch)
+
+
+class BitWriter:
+    def __init__(self):
+        self.data = bytearray()
+        self.value = 0
+        self.count = 0
+
+    def write(self, value, count):
+        for bit in range(count - 1, -1, -1):
+            self.value = (self.value << 1) | ((value >> bit) & 1)
+            self.count += 1
+            if self.count == 8:
+                self.data.append(self.value)
+                self.value = 0
+                self.count = 0
+
+    def flush(self):
+        if self.count:
+            self.data.append(self.value << (8 - self.count))
+            self.value = 0
+            self.count = 0
+        return bytes(self.data)
+
+
+def heatshrink_compress(data, window_bits, lookahead_bits):
+    """Compresses the data in the heatshrink format (see Decompressor.h)."""
+    window_size = 1 << window_bits
+    max_size = 1 << lookahead_bits
+    backref_bits = 1 + window_bits + lookahead_bits
+    writer = BitWriter()
+    chains = {}
+    offset = 0
+    while offset < len(data):
+        best_size = 0
+        best_distance = 0
+        key = data[offset:offset + 2]
+        for position in reversed(chains.get(key, [])):
+            distance = offset - position
+            if distance > window_size:
+                break
+            size = 0
+            while size < max_size and offset + size < len(data) and data[position + size] == data[offset + size]:
+                size += 1
+            if size > best_size:
+                best_size = size
+                best_distance = distance
+                if size == max_size:
+                    break
+        step = 1
+        if best_size * 9 > backref_bits:
+            writer.write(0, 1)
+            writer.write(best_distance - 1, window_bits)
+            writer.write(best_size - 1, lookahead_bits)
+            step = best_size
+        else:
+            writer.write(1, 1)
+            writer.write(data[offset], 8)
+        for position in range(offset, offset + step):
+            chain = chains.setdefault(data[position:position + 2], [])
+            chain.append(position)
+            if len(chain) > 32:
+                del chain[0]
+        offset += step
+    return writer.flush()
+
+
+def make_header(image, version, payload, compression):
+    header = bytearray(HEADER_SIZE_V3)
+    struct.pack_into(">IIQQ", header, 0, HEADER_MAGIC, HEADER_VERSION_V3, version, len(image))
+    header[24:56] = hashlib.sha256(image).digest()
+    struct.pack_into(">QI", header, 108, len(payload), compression)
+    struct.pack_into(">I", header, HEADER_CRC_OFFSET_V3, zlib.crc32(bytes(header[:HEADER_CRC_OFFSET_V3])))
+    return bytes(header)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("image", help="application binary")
+    parser.add_argument("-o", "--output", required=True, help="update file")
+    parser.add_argument("--version", type=int, required=True, help="firmware version")
+    parser.add_argument("--base", help="binary of the active application, for a delta update")
+    parser.add_argument("--window", type=int, default=11, help="heatshrink window bits")
+    parser.add_argument("--lookahead", type=int, default=6, help="heatshrink lookahead bits")
+    parser.add_argument("--no-compression", action="store_true", help="do not compress the payload")
+    args = parser.parse_args()
+
+    with open(args.image, "rb") as image_file:
+        image = image_file.read()
+    payload = image
+    compression = COMPRESSION_NONE
+    if args.base:
+        with open(args.base, "rb") as base_file:
+            payload = make_patch(base_file.read(), image)
+        compression |= COMPRESSION_DELTA
+    if not args.no_compression:
+        if not (4 <= args.window <= 15 and 3 <= args.lookahead < args.window):
+            sys.exit("invalid heatshrink parameters")
+        payload = heatshrink_compress(payload, args.window, args.lookahead)
+        compression |= COMPRESSION_HEATSHRINK | (args.window << 8) | (args.lookahead << 16)
+    if compression == COMPRESSION_NONE and len(payload) != len(image):
+        sys.exit("internal error")
+
+    with open(args.output, "wb") as output_file:
+        output_file.write(make_header(image, args.version, payload, compression))
+        output_file.write(payload)
+    print("image %d bytes, payload %d bytes (%.1f%%), compression 0x%08x" %
+          (len(image), len(payload), 100.0 * len(payload) / max(len(image), 1), compression))
+
+
+if __name__ == "__main__":
+    main()